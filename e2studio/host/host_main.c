@@ -0,0 +1,271 @@
+/* host_main.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * Runs webio and the board web site on a POSIX host, in place of
+ * webif.c and the board tasks. It serves until it gets SIGINT or
+ * SIGTERM, then prints the object pool use, the heap and memory peaks
+ * and the request timing.
+ *
+ * Usage: webio_host [-p port] [-a] [-m image]
+ *    -p port  TCP port to listen on, default 8080
+ *    -a       listen on all addresses, default is loopback only
+ *    -m image mount an EFS image file with em_mount(), mapped read only
+ *             as the OSPI flash is on the board. SIGHUP maps it again
+ *             and mounts it in place of the old mapping, for testing
+ *             an update of the web site while it is being served.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "websys.h"
+#include "webio.h"
+#include "webfs.h"
+#include "common_init.h"
+
+/* The board data the CGI routines show, fixed on the host */
+st_board_status_t    g_board_status =
+{
+   .temperature_f = { 77, 0 },
+   .temperature_c = { 25, 0 },
+};
+char                 g_pwm_dcs_data[] = { 10, 50, 90 };
+char                 g_pwm_rates_data[] = { 1, 5, 10 };
+static const uint16_t g_leds[] = { BSP_LED_LED1, BSP_LED_LED2, BSP_LED_LED3 };
+bsp_leds_t           g_bsp_leds = { 3, g_leds };
+EventGroupHandle_t   g_update_console_event;
+
+extern int  httpport;
+
+/* Most pools host_report() shows */
+#define  HOST_POOLS     8
+
+/* dtrap() - the target stops here for the debugger, the host carries on */
+void
+wsBreakPoint(void)
+{
+   fprintf(stderr, "webio: dtrap\n");
+}
+
+void
+wsPanic(char * pszMessage)
+{
+   fprintf(stderr, "webio: panic: %s\n", pszMessage);
+   abort();
+}
+
+/* Same as webif.c, every file may be read */
+static int
+host_auth(void * fd, char * name, char * password, wi_sess * sess)
+{
+   (void)fd;
+   (void)name;
+   (void)password;
+   (void)sess;
+   return 1;
+}
+
+static void
+host_worker(void * worker)
+{
+   for(;;)
+      wi_thread((wi_worker *)worker);
+}
+
+static void
+host_report(void)
+{
+   struct rusage  usage;
+   wi_pool        pools[HOST_POOLS];
+   u_long         replies[WI_WORKERS];
+   int            npools;
+   int            i;
+
+   /* The workers are still running, copy what they count */
+   WI_LOCK();
+   for(npools = 0; wi_pools[npools] && (npools < HOST_POOLS); npools++)
+      pools[npools] = *wi_pools[npools];
+   for(i = 0; i < WI_WORKERS; i++)
+      replies[i] = wi_workers[i].ww_replies;
+   WI_UNLOCK();
+
+   printf("\nPool          Size   In use   Max use   Failed\n");
+   for(i = 0; i < npools; i++)
+   {
+      printf("%-10s  %6d   %6d    %6d   %6lu\n", pools[i].wp_name,
+         pools[i].wp_count, pools[i].wp_inuse, pools[i].wp_maxuse,
+         pools[i].wp_fails);
+   }
+   printf("\nWorker      Replies\n");
+   for(i = 0; i < WI_WORKERS; i++)
+      printf("%6d      %7lu\n", i, replies[i]);
+
+   getrusage(RUSAGE_SELF, &usage);
+   printf("\nHeap peak: %zu bytes, process peak RSS: %ld KB\n",
+      host_heappeak, usage.ru_maxrss);
+
+#ifdef WI_TIMING
+   {
+      wi_hist     hist;
+      int         tclass;
+      int         phase;
+
+      printf("\nRequest timing (us)     Count     Mean    p50 <    p99 <      Max\n");
+      for(tclass = 0; tclass < WI_TCLASSES; tclass++)
+      {
+         wi_timecopy(tclass, WI_PH_TOTAL, &hist);
+         if(hist.wh_count == 0)
+            continue;
+         for(phase = 0; phase < WI_PHASES; phase++)
+         {
+            wi_timecopy(tclass, phase, &hist);
+            printf("%-6s  %-6s      %9lu %8lu %8lu %8lu %8lu\n",
+               wi_tclassnames[tclass], wi_phasenames[phase], hist.wh_count,
+               hist.wh_count ? (hist.wh_sum / hist.wh_count) : 0UL,
+               wi_timepercent(&hist, 50), wi_timepercent(&hist, 99),
+               hist.wh_max);
+         }
+      }
+   }
+#endif
+   fflush(stdout);
+}
+
+/* The mounted image file mapping */
+static void *  host_image;
+static size_t  host_imagelen;
+
+/* host_mount()
+ *
+ * Map an EFS image file and mount it, then unmap the image it replaced
+ * once no file of it is open.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+static int
+host_mount(const char * name)
+{
+   struct stat st;
+   void *   image;
+   void *   old = host_image;
+   size_t   oldlen = host_imagelen;
+   int      fd;
+   int      error;
+
+   fd = open(name, O_RDONLY);
+   if((fd < 0) || fstat(fd, &st) || (st.st_size == 0))
+   {
+      perror(name);
+      if(fd >= 0)
+         close(fd);
+      return WIE_NOFILE;
+   }
+   image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(image == MAP_FAILED)
+   {
+      perror(name);
+      return WIE_MEMORY;
+   }
+
+   error = em_mount(image, (u_long)st.st_size);
+   if(error)
+   {
+      fprintf(stderr, "%s: not an EFS image, error %d\n", name, error);
+      munmap(image, (size_t)st.st_size);
+      return error;
+   }
+   host_image = image;
+   host_imagelen = (size_t)st.st_size;
+   printf("webio: mounted %s, %lu bytes\n", name, (u_long)st.st_size);
+   fflush(stdout);
+
+   if(old)
+   {
+      while(em_imagebusy(old, oldlen))
+         usleep(1000);
+      munmap(old, oldlen);
+   }
+   return 0;
+}
+
+int
+main(int argc, char * argv[])
+{
+   sigset_t signals;
+   char *   mount = NULL;
+   int      sig;
+   int      opt;
+   int      error;
+   int      i;
+
+   httpport = 8080;
+   while((opt = getopt(argc, argv, "p:am:")) != -1)
+   {
+      switch(opt)
+      {
+      case 'p':
+         httpport = atoi(optarg);
+         break;
+      case 'a':
+         host_bindaddr = htonl(INADDR_ANY);
+         break;
+      case 'm':
+         mount = optarg;
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-p port] [-a] [-m image]\n", argv[0]);
+         return 2;
+      }
+   }
+
+   /* Only this thread takes the signals, the workers inherit the mask */
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGINT);
+   sigaddset(&signals, SIGTERM);
+   sigaddset(&signals, SIGHUP);
+   pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+   error = wi_init();
+   if(error)
+   {
+      fprintf(stderr, "wi_init error %d\n", error);
+      return 1;
+   }
+   emfs.wfs_fauth = host_auth;
+   if(mount && host_mount(mount))
+      return 1;
+
+   for(i = 0; i < WI_WORKERS; i++)
+   {
+      if(xTaskCreate(host_worker, "Webio wi_thread", 0, &wi_workers[i],
+         0, NULL) != pdPASS)
+      {
+         fprintf(stderr, "can't start worker %d\n", i);
+         return 1;
+      }
+   }
+   printf("webio: port %d, %d worker%s\n", httpport, WI_WORKERS,
+      (WI_WORKERS > 1) ? "s" : "");
+   fflush(stdout);
+
+   while((sigwait(&signals, &sig) == 0) && (sig == SIGHUP))
+   {
+      if(mount)
+         host_mount(mount);
+   }
+   host_report();
+   return 0;
+}
@@ -0,0 +1,645 @@
+/* host_port.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * The FreeRTOS and FreeRTOS+TCP calls webio makes, on POSIX. Sockets
+ * are blocking POSIX sockets, a socket set is a list of them waited on
+ * with poll(), tasks are threads and the heap is malloc() with a count
+ * of the bytes in use. Only what webio and webIf use is here, with the
+ * return values they expect from FreeRTOS+TCP.
+ */
+
+#define _GNU_SOURCE
+#define HOST_PORT_IMPL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "host_port.h"
+
+#define HOST_SETSIZE    256   /* sockets per socket set */
+
+struct xSOCKET
+{
+   int                  fd;
+   EventBits_t          want;    /* bits the socket set waits for */
+   EventBits_t          ready;   /* bits the last select found */
+   struct xSOCKET_SET * set;
+};
+
+struct xSOCKET_SET
+{
+   pthread_mutex_t   lock;
+   Socket_t          socks[HOST_SETSIZE];
+   int               count;
+   int               polling;    /* a thread is waiting in select */
+   int               wake[2];    /* pipe to wake it when the set changes */
+};
+
+uint32_t       host_bindaddr;
+size_t         host_heapuse;
+size_t         host_heappeak;
+
+static pthread_mutex_t  host_heaplock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec  host_start;
+
+/*********** Sockets ***************/
+
+static void
+host_wake(SocketSet_t set)
+{
+   char  c = 0;
+
+   if(set->polling)
+      (void)write(set->wake[1], &c, 1);
+}
+
+Socket_t
+FreeRTOS_socket(BaseType_t domain, BaseType_t type, BaseType_t protocol)
+{
+   Socket_t sock;
+   int      on = 1;
+
+   (void)domain;
+   (void)type;
+   (void)protocol;
+
+   sock = calloc(1, sizeof(*sock));
+   if(!sock)
+      return FREERTOS_INVALID_SOCKET;
+   sock->fd = socket(AF_INET, SOCK_STREAM, 0);
+   if(sock->fd < 0)
+   {
+      free(sock);
+      return FREERTOS_INVALID_SOCKET;
+   }
+   setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   return sock;
+}
+
+BaseType_t
+FreeRTOS_setsockopt(Socket_t sock, int32_t level, int32_t name,
+   const void * value, size_t len)
+{
+   int   on;
+
+   (void)level;
+   (void)len;
+
+   /* FreeRTOS+TCP has no Nagle delay, and holding back short segments
+    * is what SET_FULL_SIZE asks for. The buffer, window and timeout
+    * options are left at the host's values.
+    */
+   if(name == FREERTOS_SO_SET_FULL_SIZE)
+   {
+      on = (*(const BaseType_t *)value == pdTRUE);
+      return setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+   }
+   return 0;
+}
+
+BaseType_t
+FreeRTOS_bind(Socket_t sock, struct freertos_sockaddr const * addr,
+   socklen_t len)
+{
+   struct sockaddr_in   sin;
+
+   (void)len;
+
+   memset(&sin, 0, sizeof(sin));
+   sin.sin_family = AF_INET;
+   sin.sin_port = addr->sin_port;
+   sin.sin_addr.s_addr = host_bindaddr;
+   if(bind(sock->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+      return -errno;
+   return 0;
+}
+
+BaseType_t
+FreeRTOS_listen(Socket_t sock, BaseType_t backlog)
+{
+   if(listen(sock->fd, (int)backlog) < 0)
+      return -errno;
+   return 0;
+}
+
+Socket_t
+FreeRTOS_accept(Socket_t sock, struct freertos_sockaddr * addr,
+   socklen_t * len)
+{
+   struct sockaddr_in   sin;
+   socklen_t   sinlen = sizeof(sin);
+   Socket_t    newsock;
+   int         on = 1;
+   int         fd;
+
+   fd = accept(sock->fd, (struct sockaddr *)&sin, &sinlen);
+   if(fd < 0)
+      return FREERTOS_INVALID_SOCKET;
+   newsock = calloc(1, sizeof(*newsock));
+   if(!newsock)
+   {
+      close(fd);
+      return FREERTOS_INVALID_SOCKET;
+   }
+   newsock->fd = fd;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+   if(addr)
+   {
+      addr->sin_len = sizeof(*addr);
+      addr->sin_family = FREERTOS_AF_INET;
+      addr->sin_port = sin.sin_port;
+      addr->sin_addr = sin.sin_addr.s_addr;
+   }
+   if(len)
+      *len = sizeof(*addr);
+   return newsock;
+}
+
+/* FreeRTOS_recv()
+ *
+ * Returns: the number of bytes read, 0 if there are none yet, or
+ * negative errno. A connection closed by the peer is -ENOTCONN.
+ */
+
+int32_t
+FreeRTOS_recv(Socket_t sock, void * buf, size_t len, BaseType_t flags)
+{
+   ssize_t  got;
+
+   do
+      got = recv(sock->fd, buf, len,
+         (flags & FREERTOS_MSG_DONTWAIT) ? MSG_DONTWAIT : 0);
+   while((got < 0) && (errno == EINTR));
+
+   if(got > 0)
+      return (int32_t)got;
+   if(got == 0)
+   {
+      errno = ENOTCONN;
+      return -ENOTCONN;
+   }
+   if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+   {
+      errno = EWOULDBLOCK;
+      return 0;
+   }
+   return -errno;
+}
+
+/* FreeRTOS_send()
+ *
+ * Returns: the number of bytes sent, or negative errno if none were.
+ */
+
+int32_t
+FreeRTOS_send(Socket_t sock, const void * buf, size_t len, BaseType_t flags)
+{
+   const char *   cp = buf;
+   size_t         sent = 0;
+   ssize_t        n;
+
+   while(sent < len)
+   {
+      n = send(sock->fd, cp + sent, len - sent, MSG_NOSIGNAL |
+         ((flags & FREERTOS_MSG_DONTWAIT) ? MSG_DONTWAIT : 0));
+      if(n < 0)
+      {
+         if(errno == EINTR)
+            continue;
+         if(errno == EAGAIN)
+            errno = EWOULDBLOCK;
+         break;
+      }
+      sent += (size_t)n;
+   }
+   return sent ? (int32_t)sent : -errno;
+}
+
+BaseType_t
+FreeRTOS_closesocket(Socket_t sock)
+{
+   if(sock->set)
+      FreeRTOS_FD_CLR(sock, sock->set, eSELECT_ALL);
+   close(sock->fd);
+   free(sock);
+   return 0;
+}
+
+SocketSet_t
+FreeRTOS_CreateSocketSet(void)
+{
+   SocketSet_t set;
+
+   set = calloc(1, sizeof(*set));
+   if(!set)
+      return NULL;
+   if(pipe2(set->wake, O_NONBLOCK | O_CLOEXEC) < 0)
+   {
+      free(set);
+      return NULL;
+   }
+   pthread_mutex_init(&set->lock, NULL);
+   return set;
+}
+
+void
+FreeRTOS_FD_SET(Socket_t sock, SocketSet_t set, EventBits_t bits)
+{
+   pthread_mutex_lock(&set->lock);
+   if(!sock->set)
+   {
+      configASSERT(set->count < HOST_SETSIZE);
+      set->socks[set->count++] = sock;
+      sock->set = set;
+   }
+   sock->want |= bits;
+   host_wake(set);
+   pthread_mutex_unlock(&set->lock);
+}
+
+void
+FreeRTOS_FD_CLR(Socket_t sock, SocketSet_t set, EventBits_t bits)
+{
+   int   i;
+
+   pthread_mutex_lock(&set->lock);
+   sock->want &= ~bits;
+   sock->ready &= ~bits;
+   if((sock->want == 0) && (sock->set == set))
+   {
+      for(i = 0; i < set->count; i++)
+      {
+         if(set->socks[i] == sock)
+         {
+            set->socks[i] = set->socks[--set->count];
+            break;
+         }
+      }
+      sock->set = NULL;
+   }
+   pthread_mutex_unlock(&set->lock);
+}
+
+EventBits_t
+FreeRTOS_FD_ISSET(Socket_t sock, SocketSet_t set)
+{
+   (void)set;
+   return sock->ready;
+}
+
+/* FreeRTOS_select()
+ *
+ * Only the task which owns a set takes sockets out of it, so the
+ * sockets polled are still there afterwards. Sockets another task adds
+ * while this one waits wake it up.
+ *
+ * Returns: the number of sockets with events, or 0 after the timeout.
+ */
+
+BaseType_t
+FreeRTOS_select(SocketSet_t set, TickType_t ticks)
+{
+   struct pollfd  fds[HOST_SETSIZE + 1];
+   Socket_t       socks[HOST_SETSIZE];
+   char           drain[64];
+   EventBits_t    ready;
+   short          events;
+   int            count;
+   int            found = 0;
+   int            i;
+
+   pthread_mutex_lock(&set->lock);
+   count = set->count;
+   fds[0].fd = set->wake[0];
+   fds[0].events = POLLIN;
+   for(i = 0; i < count; i++)
+   {
+      socks[i] = set->socks[i];
+      socks[i]->ready = 0;
+      events = 0;
+      if(socks[i]->want & eSELECT_READ)
+         events |= POLLIN;
+      if(socks[i]->want & eSELECT_WRITE)
+         events |= POLLOUT;
+      if(socks[i]->want & eSELECT_EXCEPT)
+         events |= POLLRDHUP;
+      fds[i + 1].fd = socks[i]->fd;
+      fds[i + 1].events = events;
+   }
+   set->polling = 1;
+   pthread_mutex_unlock(&set->lock);
+
+   while(poll(fds, (nfds_t)count + 1,
+      (ticks == portMAX_DELAY) ? -1 : (int)ticks) < 0)
+   {
+      if(errno != EINTR)
+         break;
+   }
+
+   pthread_mutex_lock(&set->lock);
+   set->polling = 0;
+   while(read(set->wake[0], drain, sizeof(drain)) > 0)
+      ;
+   for(i = 0; i < count; i++)
+   {
+      events = fds[i + 1].revents;
+      ready = 0;
+      if(events & POLLIN)
+         ready |= eSELECT_READ;
+      if(events & POLLOUT)
+         ready |= eSELECT_WRITE;
+      if(events & (POLLRDHUP | POLLHUP | POLLERR))
+         ready |= eSELECT_EXCEPT;
+      socks[i]->ready = ready & socks[i]->want;
+      if(socks[i]->ready)
+         found++;
+   }
+   pthread_mutex_unlock(&set->lock);
+
+   return found;
+}
+
+uint16_t
+FreeRTOS_htons(uint16_t value)
+{
+   return htons(value);
+}
+
+uint32_t
+FreeRTOS_htonl(uint32_t value)
+{
+   return htonl(value);
+}
+
+/*********** Tasks ***************/
+
+struct host_task
+{
+   void (*fn)(void *);
+   void * param;
+};
+
+static void *
+host_taskmain(void * arg)
+{
+   struct host_task task = *(struct host_task *)arg;
+
+   free(arg);
+   task.fn(task.param);
+   return NULL;
+}
+
+BaseType_t
+xTaskCreate(void (*fn)(void *), const char * name, uint32_t stack,
+   void * param, UBaseType_t prio, TaskHandle_t * handle)
+{
+   struct host_task *   task;
+   pthread_t            thread;
+
+   (void)name;
+   (void)stack;
+   (void)prio;
+
+   task = malloc(sizeof(*task));
+   if(!task)
+      return pdFAIL;
+   task->fn = fn;
+   task->param = param;
+   if(pthread_create(&thread, NULL, host_taskmain, task) != 0)
+   {
+      free(task);
+      return pdFAIL;
+   }
+   pthread_detach(thread);
+   if(handle)
+      *handle = (TaskHandle_t)thread;
+   return pdPASS;
+}
+
+void
+R_OS_DeleteTask(void * task)
+{
+   pthread_cancel((pthread_t)task);
+}
+
+void
+vTaskDelay(TickType_t ticks)
+{
+   usleep((useconds_t)ticks * 1000);
+}
+
+TickType_t
+xTaskGetTickCount(void)
+{
+   struct timespec   now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (TickType_t)((now.tv_sec - host_start.tv_sec) * 1000 +
+      (now.tv_nsec - host_start.tv_nsec) / 1000000);
+}
+
+void
+host_assert(const char * expr, const char * file, int line)
+{
+   fprintf(stderr, "%s:%d: assertion failed: %s\n", file, line, expr);
+   abort();
+}
+
+/*********** Semaphores, queues and events ***************/
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void)
+{
+   pthread_mutex_t * mutex = malloc(sizeof(*mutex));
+
+   if(mutex)
+      pthread_mutex_init(mutex, NULL);
+   return mutex;
+}
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+   (void)ticks;
+   return (pthread_mutex_lock(sem) == 0) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t sem)
+{
+   return (pthread_mutex_unlock(sem) == 0) ? pdTRUE : pdFALSE;
+}
+
+struct host_queue
+{
+   pthread_mutex_t   lock;
+   UBaseType_t       length;
+   UBaseType_t       size;
+   UBaseType_t       head;
+   UBaseType_t       count;
+   char              items[];
+};
+
+QueueHandle_t
+xQueueCreate(UBaseType_t length, UBaseType_t size)
+{
+   struct host_queue *  queue;
+
+   queue = calloc(1, sizeof(*queue) + length * size);
+   if(!queue)
+      return NULL;
+   pthread_mutex_init(&queue->lock, NULL);
+   queue->length = length;
+   queue->size = size;
+   return queue;
+}
+
+/* webio only sends and receives without waiting, so neither of these
+ * blocks.
+ */
+
+BaseType_t
+xQueueSend(QueueHandle_t handle, const void * item, TickType_t ticks)
+{
+   struct host_queue *  queue = handle;
+   BaseType_t           sent = pdFAIL;
+
+   (void)ticks;
+   pthread_mutex_lock(&queue->lock);
+   if(queue->count < queue->length)
+   {
+      memcpy(&queue->items[((queue->head + queue->count) % queue->length) *
+         queue->size], item, queue->size);
+      queue->count++;
+      sent = pdPASS;
+   }
+   pthread_mutex_unlock(&queue->lock);
+   return sent;
+}
+
+BaseType_t
+xQueueReceive(QueueHandle_t handle, void * item, TickType_t ticks)
+{
+   struct host_queue *  queue = handle;
+   BaseType_t           got = pdFAIL;
+
+   (void)ticks;
+   pthread_mutex_lock(&queue->lock);
+   if(queue->count)
+   {
+      memcpy(item, &queue->items[queue->head * queue->size], queue->size);
+      queue->head = (queue->head + 1) % queue->length;
+      queue->count--;
+      got = pdPASS;
+   }
+   pthread_mutex_unlock(&queue->lock);
+   return got;
+}
+
+EventBits_t
+xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+   (void)group;
+   return bits;
+}
+
+/*********** Heap ***************/
+
+/* Each block starts with its size so the bytes in use can be counted */
+typedef union
+{
+   size_t      size;
+   long double align;
+} host_block;
+
+void *
+pvPortMalloc(size_t size)
+{
+   host_block *   block = malloc(sizeof(host_block) + size);
+
+   if(!block)
+      return NULL;
+   block->size = size;
+   pthread_mutex_lock(&host_heaplock);
+   host_heapuse += size;
+   if(host_heapuse > host_heappeak)
+      host_heappeak = host_heapuse;
+   pthread_mutex_unlock(&host_heaplock);
+   return block + 1;
+}
+
+void
+vPortFree(void * mem)
+{
+   host_block *   block;
+
+   if(!mem)
+      return;
+   block = (host_block *)mem - 1;
+   pthread_mutex_lock(&host_heaplock);
+   host_heapuse -= block->size;
+   pthread_mutex_unlock(&host_heaplock);
+   free(block);
+}
+
+void
+vPortGetHeapStats(HeapStats_t * stats)
+{
+   pthread_mutex_lock(&host_heaplock);
+   stats->xAvailableHeapSpaceInBytes = configTOTAL_HEAP_SIZE - host_heapuse;
+   stats->xSizeOfLargestFreeBlockInBytes = stats->xAvailableHeapSpaceInBytes;
+   stats->xMinimumEverFreeBytesRemaining = configTOTAL_HEAP_SIZE - host_heappeak;
+   pthread_mutex_unlock(&host_heaplock);
+}
+
+/*********** Board ***************/
+
+int            g_ioport_ctrl;
+CoreDebug_Type host_coredebug;
+uint32_t       SystemCoreClock = 1000000000;
+
+void
+host_pinwrite(uint16_t pin, uint32_t level)
+{
+   (void)pin;
+   (void)level;
+}
+
+/* host_dwt()
+ *
+ * Returns: the DWT registers with CYCCNT set to the nanoseconds since
+ * start up, which is a 1 GHz cycle counter.
+ */
+
+DWT_Type *
+host_dwt(void)
+{
+   static __thread DWT_Type   dwt;
+   struct timespec            now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   dwt.CYCCNT = (uint32_t)((uint64_t)now.tv_sec * 1000000000 +
+      (uint64_t)now.tv_nsec);
+   return &dwt;
+}
+
+/* Runs before main() so the tick count starts at 0 */
+static void __attribute__((constructor))
+host_portinit(void)
+{
+   clock_gettime(CLOCK_MONOTONIC, &host_start);
+   host_bindaddr = htonl(INADDR_LOOPBACK);
+}
@@ -0,0 +1,205 @@
+/* host_port.h
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * The FreeRTOS, FreeRTOS+TCP and FSP definitions webio and webIf use,
+ * for building them on a POSIX host. The Makefile generates each of the
+ * FreeRTOS and FSP header names the sources include as a one line file
+ * including this one, so the sources build unchanged. host_port.c maps
+ * the calls onto POSIX sockets, poll() and pthreads.
+ */
+
+#ifndef _HOST_PORT_H_
+#define _HOST_PORT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+
+/*********** FreeRTOS ***************/
+
+typedef long            BaseType_t;
+typedef unsigned long   UBaseType_t;
+typedef uint32_t        TickType_t;
+typedef uint32_t        EventBits_t;
+typedef void *          TaskHandle_t;
+typedef void *          SemaphoreHandle_t;
+typedef void *          QueueHandle_t;
+typedef void *          EventGroupHandle_t;
+
+typedef struct
+{
+   size_t   xAvailableHeapSpaceInBytes;
+   size_t   xSizeOfLargestFreeBlockInBytes;
+   size_t   xMinimumEverFreeBytesRemaining;
+} HeapStats_t;
+
+#define pdTRUE                   1
+#define pdFALSE                  0
+#define pdPASS                   1
+#define pdFAIL                   0
+#define portMAX_DELAY            0xFFFFFFFFUL
+#define portTICK_PERIOD_MS       1
+#define pdMS_TO_TICKS(ms)        ((TickType_t)(ms))
+#define configMINIMAL_STACK_SIZE 128
+#define configTOTAL_HEAP_SIZE    (256 * 1024)
+#define configASSERT(x)          do { if(!(x)) host_assert(#x, __FILE__, __LINE__); } while(0)
+
+extern void          host_assert(const char * expr, const char * file, int line);
+
+extern BaseType_t    xTaskCreate(void (*fn)(void *), const char * name,
+                        uint32_t stack, void * param, UBaseType_t prio,
+                        TaskHandle_t * handle);
+extern void          vTaskDelay(TickType_t ticks);
+extern TickType_t    xTaskGetTickCount(void);
+extern void          R_OS_DeleteTask(void * task);
+
+extern SemaphoreHandle_t xSemaphoreCreateMutex(void);
+extern BaseType_t    xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+extern BaseType_t    xSemaphoreGive(SemaphoreHandle_t sem);
+
+extern QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size);
+extern BaseType_t    xQueueSend(QueueHandle_t queue, const void * item,
+                        TickType_t ticks);
+extern BaseType_t    xQueueReceive(QueueHandle_t queue, void * item,
+                        TickType_t ticks);
+
+extern EventBits_t   xEventGroupSetBits(EventGroupHandle_t group,
+                        EventBits_t bits);
+
+extern void *        pvPortMalloc(size_t size);
+extern void          vPortFree(void * mem);
+extern void          vPortGetHeapStats(HeapStats_t * stats);
+extern size_t        host_heapuse;     /* bytes allocated now */
+extern size_t        host_heappeak;    /* most bytes allocated at once */
+
+/*********** FreeRTOS+TCP ***************/
+
+#define ipconfigUSE_DHCP         0
+#define ipconfigTCP_MSS          1460
+
+typedef struct xSOCKET *      Socket_t;
+typedef struct xSOCKET_SET *  SocketSet_t;
+typedef uint32_t              socklen_t;
+
+struct freertos_sockaddr
+{
+   uint8_t  sin_len;
+   uint8_t  sin_family;
+   uint16_t sin_port;         /* network byte order */
+   uint32_t sin_addr;         /* network byte order */
+};
+
+typedef struct
+{
+   int32_t  lTxBufSize;
+   int32_t  lTxWinSize;
+   int32_t  lRxBufSize;
+   int32_t  lRxWinSize;
+} WinProperties_t;
+
+typedef enum eSELECT_EVENT
+{
+   eSELECT_READ   = 0x0001,
+   eSELECT_WRITE  = 0x0002,
+   eSELECT_EXCEPT = 0x0004,
+   eSELECT_INTR   = 0x0008,
+   eSELECT_ALL    = 0x000F
+} eSelectEvent_t;
+
+/* A pointer with every bit set, as (Socket_t)~0U is on the board */
+#define FREERTOS_INVALID_SOCKET     ((Socket_t)~(uintptr_t)0)
+#define FREERTOS_AF_INET            2
+#define FREERTOS_SOCK_STREAM        1
+#define FREERTOS_IPPROTO_TCP        6
+#define FREERTOS_SO_RCVTIMEO        0
+#define FREERTOS_SO_SNDTIMEO        1
+#define FREERTOS_SO_SNDBUF          4
+#define FREERTOS_SO_RCVBUF          5
+#define FREERTOS_SO_WIN_PROPERTIES  13
+#define FREERTOS_SO_SET_FULL_SIZE   14
+#define FREERTOS_MSG_DONTWAIT       2
+
+extern Socket_t      FreeRTOS_socket(BaseType_t domain, BaseType_t type,
+                        BaseType_t protocol);
+extern BaseType_t    FreeRTOS_setsockopt(Socket_t sock, int32_t level,
+                        int32_t name, const void * value, size_t len);
+extern BaseType_t    FreeRTOS_bind(Socket_t sock,
+                        struct freertos_sockaddr const * addr, socklen_t len);
+extern BaseType_t    FreeRTOS_listen(Socket_t sock, BaseType_t backlog);
+extern Socket_t      FreeRTOS_accept(Socket_t sock,
+                        struct freertos_sockaddr * addr, socklen_t * len);
+extern int32_t       FreeRTOS_recv(Socket_t sock, void * buf, size_t len,
+                        BaseType_t flags);
+extern int32_t       FreeRTOS_send(Socket_t sock, const void * buf,
+                        size_t len, BaseType_t flags);
+extern BaseType_t    FreeRTOS_closesocket(Socket_t sock);
+extern SocketSet_t   FreeRTOS_CreateSocketSet(void);
+extern BaseType_t    FreeRTOS_select(SocketSet_t set, TickType_t ticks);
+extern void          FreeRTOS_FD_SET(Socket_t sock, SocketSet_t set,
+                        EventBits_t bits);
+extern void          FreeRTOS_FD_CLR(Socket_t sock, SocketSet_t set,
+                        EventBits_t bits);
+extern EventBits_t   FreeRTOS_FD_ISSET(Socket_t sock, SocketSet_t set);
+extern uint16_t      FreeRTOS_htons(uint16_t value);
+extern uint32_t      FreeRTOS_htonl(uint32_t value);
+
+/* webclib.c uses htonl() without a prefix. Files that include the libc
+ * byte order macros keep them.
+ */
+#if !defined(HOST_PORT_IMPL) && !defined(htonl)
+#define htonl(x)     FreeRTOS_htonl(x)
+#endif
+
+/* Address the listen socket is bound to, network byte order. Loopback
+ * unless host_main.c is told otherwise.
+ */
+extern uint32_t      host_bindaddr;
+
+/*********** FSP and board ***************/
+
+typedef int fsp_err_t;
+#define FSP_SUCCESS              0
+
+typedef struct
+{
+   uint16_t          led_count;
+   uint16_t const *  p_leds;
+} bsp_leds_t;
+
+#define BOARD_RA6M4_EK  1
+#define BSP_LED_LED1    0
+#define BSP_LED_LED2    1
+#define BSP_LED_LED3    2
+
+extern EventGroupHandle_t  g_update_console_event;
+
+extern int           g_ioport_ctrl;
+#define R_IOPORT_PinWrite(ctrl, pin, level)   host_pinwrite(pin, level)
+extern void          host_pinwrite(uint16_t pin, uint32_t level);
+
+#define __NOP()
+
+/* The DWT cycle counter counts nanoseconds on the host */
+typedef struct
+{
+   uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct
+{
+   uint32_t CTRL;
+   uint32_t CYCCNT;
+} DWT_Type;
+
+extern CoreDebug_Type   host_coredebug;
+extern DWT_Type *       host_dwt(void);
+extern uint32_t         SystemCoreClock;
+
+#define CoreDebug                   (&host_coredebug)
+#define DWT                         (host_dwt())
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL)
+
+#endif   /* _HOST_PORT_H_ */
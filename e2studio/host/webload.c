@@ -0,0 +1,551 @@
+/* webload.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * Load generator for the host build of webio. Each client is a thread
+ * which sends GET requests on a persistent connection, one at a time,
+ * and times each from sending the request to reading the end of the
+ * reply. At the end it reports the throughput, the latency percentiles
+ * and the peak memory of the server.
+ *
+ * Usage: webload [options]
+ *    -c clients     concurrent connections, default 8
+ *    -n requests    stop after this many requests in all
+ *    -d seconds     stop after this long, default 10 without -n
+ *    -u url         URL to request, may be given more than once. The
+ *                   clients go through them in turn. Default /index.html
+ *    -p port        server port, default 8080
+ *    -K             a new connection for each request
+ *    -z             send "Accept-Encoding: gzip", and count a reply
+ *                   that is not gzip as not 200. Without -z a gzip
+ *                   reply is counted so
+ *    -s server      start this server binary with -p port, and stop it
+ *                   with SIGINT at the end so it prints its report
+ *    -P pid         pid of a server already running, for its peak memory
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAXURLS   16
+#define RXSIZE    (64 * 1024)
+
+struct client
+{
+   pthread_t   thread;
+   int         id;
+   int         sock;
+   char *      rx;         /* reply buffer */
+   int         rxlen;      /* bytes in rx */
+   int         rxpos;      /* start of the unread bytes */
+   double *    lat;        /* latency of each request, microseconds */
+   long        nlat;
+   long        maxlat;
+   long        errors;
+   long        bad;        /* replies other than 200, or wrong encoding */
+   long        connects;
+   long long   bytes;
+};
+
+static int        clients = 8;
+static long       requests;
+static double     seconds;
+static char *     urls[MAXURLS];
+static int        nurls;
+static int        port = 8080;
+static int        closeeach;
+static int        gzipped;
+
+static long       sent;          /* requests started, all clients */
+static double     endtime;
+static pthread_mutex_t  countlock = PTHREAD_MUTEX_INITIALIZER;
+
+static double
+now(void)
+{
+   struct timespec   ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int
+client_connect(struct client * cl)
+{
+   struct sockaddr_in   sin;
+   int   on = 1;
+
+   cl->sock = socket(AF_INET, SOCK_STREAM, 0);
+   if(cl->sock < 0)
+      return -1;
+   setsockopt(cl->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   memset(&sin, 0, sizeof(sin));
+   sin.sin_family = AF_INET;
+   sin.sin_port = htons((uint16_t)port);
+   sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if(connect(cl->sock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+   {
+      close(cl->sock);
+      cl->sock = -1;
+      return -1;
+   }
+   cl->rxlen = cl->rxpos = 0;
+   cl->connects++;
+   return 0;
+}
+
+static void
+client_close(struct client * cl)
+{
+   if(cl->sock >= 0)
+      close(cl->sock);
+   cl->sock = -1;
+}
+
+/* Read more of the reply into rx, moving the unread part to the front
+ * first. Returns the number of bytes read, 0 at end of connection.
+ */
+static int
+client_fill(struct client * cl)
+{
+   ssize_t  got;
+
+   if(cl->rxpos)
+   {
+      memmove(cl->rx, cl->rx + cl->rxpos, (size_t)(cl->rxlen - cl->rxpos));
+      cl->rxlen -= cl->rxpos;
+      cl->rxpos = 0;
+   }
+   if(cl->rxlen >= RXSIZE - 1)
+      return -1;
+   do
+      got = recv(cl->sock, cl->rx + cl->rxlen, (size_t)(RXSIZE - 1 - cl->rxlen), 0);
+   while((got < 0) && (errno == EINTR));
+   if(got > 0)
+   {
+      cl->rxlen += (int)got;
+      cl->rx[cl->rxlen] = 0;
+      cl->bytes += got;
+   }
+   return (int)got;
+}
+
+/* Skip len bytes of body. Returns 0 if OK */
+static int
+client_skip(struct client * cl, long len)
+{
+   long  avail;
+
+   while(len > 0)
+   {
+      avail = cl->rxlen - cl->rxpos;
+      if(avail == 0)
+      {
+         if(client_fill(cl) <= 0)
+            return -1;
+         continue;
+      }
+      if(avail > len)
+         avail = len;
+      cl->rxpos += (int)avail;
+      len -= avail;
+   }
+   return 0;
+}
+
+/* Get the next line of the reply. Returns a pointer to it with the end
+ * of line removed, or NULL if the connection ended first.
+ */
+static char *
+client_line(struct client * cl)
+{
+   char *   line;
+   char *   eol;
+
+   for(;;)
+   {
+      line = cl->rx + cl->rxpos;
+      eol = memchr(line, '\n', (size_t)(cl->rxlen - cl->rxpos));
+      if(eol)
+      {
+         cl->rxpos = (int)(eol + 1 - cl->rx);
+         if((eol > line) && (eol[-1] == '\r'))
+            eol--;
+         *eol = 0;
+         return line;
+      }
+      if(client_fill(cl) <= 0)
+         return NULL;
+   }
+}
+
+/* Read one reply. Returns its status code, or -1 if the connection
+ * failed. *keep is cleared if the server is closing the connection,
+ * *gzip is set if the reply is gzip encoded.
+ */
+static int
+client_reply(struct client * cl, int * keep, int * gzip)
+{
+   char *   line;
+   long     length = -1;
+   int      chunked = 0;
+   int      status;
+
+   line = client_line(cl);
+   if(!line || (sscanf(line, "HTTP/%*d.%*d %d", &status) != 1))
+      return -1;
+   while((line = client_line(cl)) != NULL)
+   {
+      if(*line == 0)
+         break;
+      if(strncasecmp(line, "Content-Length:", 15) == 0)
+         length = atol(line + 15);
+      else if((strncasecmp(line, "Transfer-Encoding:", 18) == 0) &&
+         strcasestr(line, "chunked"))
+      {
+         chunked = 1;
+      }
+      else if((strncasecmp(line, "Content-Encoding:", 17) == 0) &&
+         strcasestr(line, "gzip"))
+      {
+         *gzip = 1;
+      }
+      else if((strncasecmp(line, "Connection:", 11) == 0) &&
+         strcasestr(line, "close"))
+      {
+         *keep = 0;
+      }
+   }
+   if(!line)
+      return -1;
+
+   if(chunked)
+   {
+      for(;;)
+      {
+         line = client_line(cl);
+         if(!line)
+            return -1;
+         length = strtol(line, NULL, 16);
+         if(length == 0)
+            break;
+         if(client_skip(cl, length) || !client_line(cl))
+            return -1;
+      }
+      /* Trailer, up to the empty line */
+      while((line = client_line(cl)) != NULL && *line)
+         ;
+      return line ? status : -1;
+   }
+   if(length >= 0)
+      return client_skip(cl, length) ? -1 : status;
+
+   /* No length, the body ends with the connection */
+   *keep = 0;
+   while(client_fill(cl) > 0)
+      cl->rxpos = cl->rxlen;
+   return status;
+}
+
+static int
+next_request(void)
+{
+   int   go = 1;
+
+   pthread_mutex_lock(&countlock);
+   if(requests && (sent >= requests))
+      go = 0;
+   else if(!requests && (now() >= endtime))
+      go = 0;
+   else
+      sent++;
+   pthread_mutex_unlock(&countlock);
+   return go;
+}
+
+static void *
+client_main(void * arg)
+{
+   struct client *   cl = arg;
+   char     req[1024];
+   double   start;
+   long     n = 0;
+   int      reqlen;
+   int      status;
+   int      keep;
+   int      gzip;
+
+   cl->sock = -1;
+   while(next_request())
+   {
+      if((cl->sock < 0) && client_connect(cl))
+      {
+         cl->errors++;
+         usleep(1000);
+         continue;
+      }
+      reqlen = snprintf(req, sizeof(req),
+         "GET %s HTTP/1.1\r\nHost: 127.0.0.1:%d\r\n%s%s\r\n",
+         urls[(cl->id + n++) % nurls], port,
+         gzipped ? "Accept-Encoding: gzip\r\n" : "",
+         closeeach ? "Connection: close\r\n" : "");
+
+      start = now();
+      keep = !closeeach;
+      gzip = 0;
+      if((send(cl->sock, req, (size_t)reqlen, MSG_NOSIGNAL) != reqlen) ||
+         ((status = client_reply(cl, &keep, &gzip)) < 0))
+      {
+         cl->errors++;
+         client_close(cl);
+         continue;
+      }
+      if(cl->nlat == cl->maxlat)
+      {
+         cl->maxlat = cl->maxlat ? cl->maxlat * 2 : 4096;
+         cl->lat = realloc(cl->lat, (size_t)cl->maxlat * sizeof(double));
+         if(!cl->lat)
+         {
+            perror("webload");
+            exit(1);
+         }
+      }
+      cl->lat[cl->nlat++] = (now() - start) * 1e6;
+      if((status != 200) || (gzip != gzipped))
+         cl->bad++;
+      if(!keep)
+         client_close(cl);
+   }
+   client_close(cl);
+   return NULL;
+}
+
+static int
+cmpdouble(const void * a, const void * b)
+{
+   double   x = *(const double *)a;
+   double   y = *(const double *)b;
+
+   return (x > y) - (x < y);
+}
+
+static double
+percentile(double * lat, long count, double percent)
+{
+   long  i = (long)((double)count * percent / 100.0 + 0.5);
+
+   if(i >= count)
+      i = count - 1;
+   return count ? lat[i] : 0.0;
+}
+
+/* Returns: peak resident memory of a process in KB, or -1 */
+static long
+peak_rss(pid_t pid)
+{
+   char     path[64];
+   char     line[256];
+   FILE *   fp;
+   long     kb = -1;
+
+   snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+   fp = fopen(path, "r");
+   if(!fp)
+      return -1;
+   while(fgets(line, sizeof(line), fp))
+   {
+      if(sscanf(line, "VmHWM: %ld", &kb) == 1)
+         break;
+   }
+   fclose(fp);
+   return kb;
+}
+
+static pid_t
+start_server(const char * server)
+{
+   struct client  probe;
+   char     portstr[16];
+   pid_t    pid;
+   int      tries;
+
+   snprintf(portstr, sizeof(portstr), "%d", port);
+   pid = fork();
+   if(pid < 0)
+      return -1;
+   if(pid == 0)
+   {
+      execl(server, server, "-p", portstr, (char *)NULL);
+      perror(server);
+      _exit(127);
+   }
+
+   /* Wait for it to listen */
+   memset(&probe, 0, sizeof(probe));
+   for(tries = 0; tries < 200; tries++)
+   {
+      if(client_connect(&probe) == 0)
+      {
+         client_close(&probe);
+         return pid;
+      }
+      usleep(10000);
+   }
+   kill(pid, SIGKILL);
+   waitpid(pid, NULL, 0);
+   return -1;
+}
+
+static void
+usage(void)
+{
+   fprintf(stderr, "usage: webload [-c clients] [-n requests | -d seconds] "
+      "[-u url]... [-p port] [-K] [-z] [-s server | -P pid]\n");
+   exit(2);
+}
+
+int
+main(int argc, char * argv[])
+{
+   struct client *   cl;
+   const char *      server = NULL;
+   pid_t    pid = 0;
+   double   start;
+   double   elapsed;
+   double * all;
+   long     total = 0;
+   long     errors = 0;
+   long     bad = 0;
+   long     connects = 0;
+   long long bytes = 0;
+   long     rss;
+   int      opt;
+   int      i;
+
+   while((opt = getopt(argc, argv, "c:n:d:u:p:Kzs:P:")) != -1)
+   {
+      switch(opt)
+      {
+      case 'c':
+         clients = atoi(optarg);
+         break;
+      case 'n':
+         requests = atol(optarg);
+         break;
+      case 'd':
+         seconds = atof(optarg);
+         break;
+      case 'u':
+         if(nurls == MAXURLS)
+            usage();
+         urls[nurls++] = optarg;
+         break;
+      case 'p':
+         port = atoi(optarg);
+         break;
+      case 'K':
+         closeeach = 1;
+         break;
+      case 'z':
+         gzipped = 1;
+         break;
+      case 's':
+         server = optarg;
+         break;
+      case 'P':
+         pid = (pid_t)atoi(optarg);
+         break;
+      default:
+         usage();
+      }
+   }
+   if((optind != argc) || (clients < 1))
+      usage();
+   if(nurls == 0)
+      urls[nurls++] = "/index.html";
+   if(!requests && (seconds <= 0))
+      seconds = 10;
+
+   if(server)
+   {
+      pid = start_server(server);
+      if(pid < 0)
+      {
+         fprintf(stderr, "webload: can't start %s\n", server);
+         return 1;
+      }
+   }
+
+   cl = calloc((size_t)clients, sizeof(*cl));
+   if(!cl)
+      return 1;
+   start = now();
+   endtime = start + seconds;
+   for(i = 0; i < clients; i++)
+   {
+      cl[i].id = i;
+      cl[i].rx = malloc(RXSIZE);
+      if(!cl[i].rx ||
+         pthread_create(&cl[i].thread, NULL, client_main, &cl[i]))
+      {
+         perror("webload");
+         return 1;
+      }
+   }
+   for(i = 0; i < clients; i++)
+   {
+      pthread_join(cl[i].thread, NULL);
+      total += cl[i].nlat;
+   }
+   elapsed = now() - start;
+
+   all = malloc((size_t)(total ? total : 1) * sizeof(double));
+   total = 0;
+   for(i = 0; i < clients; i++)
+   {
+      memcpy(all + total, cl[i].lat, (size_t)cl[i].nlat * sizeof(double));
+      total += cl[i].nlat;
+      errors += cl[i].errors;
+      bad += cl[i].bad;
+      connects += cl[i].connects;
+      bytes += cl[i].bytes;
+   }
+   qsort(all, (size_t)total, sizeof(double), cmpdouble);
+
+   printf("%d clients, %ld requests in %.2f s, %ld connections, "
+      "%ld errors, %ld not 200\n",
+      clients, total, elapsed, connects, errors, bad);
+   printf("throughput: %.0f requests/s, %.2f MB/s\n",
+      (double)total / elapsed, (double)bytes / elapsed / (1024 * 1024));
+   printf("latency (us): p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+      percentile(all, total, 50), percentile(all, total, 90),
+      percentile(all, total, 99), percentile(all, total, 99.9),
+      total ? all[total - 1] : 0.0);
+   if(pid > 0)
+   {
+      rss = peak_rss(pid);
+      if(rss >= 0)
+         printf("server peak RSS: %ld KB\n", rss);
+   }
+   fflush(stdout);
+
+   if(server)
+   {
+      kill(pid, SIGINT);
+      waitpid(pid, NULL, 0);
+   }
+   return (errors || bad) ? 1 : 0;
+}
@@ -40,6 +40,7 @@
 
 #include "r_qspi.h"
 #include "qspi_ep.h"
+#include "efsOspi.h"
 
 
 #define CONNECTION_ABORT_CRTL          (0x00)
@@ -641,6 +642,13 @@ test_fn ext_display_menu(void)
         R_GPT_InfoGet(g_memory_performance.p_ctrl, &timer_info);
         timer_frequency = timer_info.clock_frequency;
 
+        /* The test opens the Octo-SPI flash itself and writes over the start of it, where a web site may be */
+        if (NULL != efsOspiImage(NULL))
+        {
+            print_to_console("Unmounting the web site in Octo-SPI flash, the test will overwrite it\r\n");
+            efsOspiUnmount();
+        }
+
         ospi_performance_test (block_size_actual, &ospi_performance_write_result, &ospi_performance_read_result);
 
         /* Multiply uSec calcs by 100, to avoid losses due to small results in integer maths
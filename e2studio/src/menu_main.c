@@ -56,6 +56,7 @@ static st_menu_fn_tbl_t s_menu_items[] =
     {"Web Server"                             , eth_emb_display_menu},
     {"Network Name Lookup"                    , eth_www_display_menu},
     {"Quad-SPI and Octo-SPI Speed Comparison" , ext_display_menu},
+    {"Web Server Statistics"                  , web_stats_display_menu},
     {"Next Steps"                             , ns_display_menu},
     {"", NULL}
 };
@@ -29,6 +29,7 @@
 #include "menu_eth_emb.h"
 #include "menu_eth_www.h"
 #include "menu_ext.h"
+#include "menu_web_stats.h"
 
 #ifndef MENU_MAIN_H_
 #define MENU_MAIN_H_
@@ -0,0 +1,407 @@
+/**********************************************************************************************************************
+ * File Name    : menu_web_stats.c
+ * Version      : .
+ * Description  : The web server statistics screen display.
+ *********************************************************************************************************************/
+/***********************************************************************************************************************
+ * Copyright [2020] Renesas Electronics Corporation and/or its affiliates.  All Rights Reserved.
+ *
+ * This software and documentation are supplied by Renesas Electronics America Inc. and may only be used with products
+ * of Renesas Electronics Corp. and its affiliates ("Renesas").  No other uses are authorized.  Renesas products are
+ * sold pursuant to Renesas terms and conditions of sale.  Purchasers are solely responsible for the selection and use
+ * of Renesas products and Renesas assumes no liability.  No license, express or implied, to any intellectual property
+ * right is granted by Renesas. This software is protected under all applicable laws, including copyright laws. Renesas
+ * reserves the right to change or discontinue this software and/or this documentation. THE SOFTWARE AND DOCUMENTATION
+ * IS DELIVERED TO YOU "AS IS," AND RENESAS MAKES NO REPRESENTATIONS OR WARRANTIES, AND TO THE FULLEST EXTENT
+ * PERMISSIBLE UNDER APPLICABLE LAW, DISCLAIMS ALL WARRANTIES, WHETHER EXPLICITLY OR IMPLICITLY, INCLUDING WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NONINFRINGEMENT, WITH RESPECT TO THE SOFTWARE OR
+ * DOCUMENTATION.  RENESAS SHALL HAVE NO LIABILITY ARISING OUT OF ANY SECURITY VULNERABILITY OR BREACH.  TO THE MAXIMUM
+ * EXTENT PERMITTED BY LAW, IN NO EVENT WILL RENESAS BE LIABLE TO YOU IN CONNECTION WITH THE SOFTWARE OR DOCUMENTATION
+ * (OR ANY PERSON OR ENTITY CLAIMING RIGHTS DERIVED FROM YOU) FOR ANY LOSS, DAMAGES, OR CLAIMS WHATSOEVER, INCLUDING,
+ * WITHOUT LIMITATION, ANY DIRECT, CONSEQUENTIAL, SPECIAL, INDIRECT, PUNITIVE, OR INCIDENTAL DAMAGES; ANY LOST PROFITS,
+ * OTHER ECONOMIC DAMAGE, PROPERTY DAMAGE, OR PERSONAL INJURY; AND EVEN IF RENESAS HAS BEEN ADVISED OF THE POSSIBILITY
+ * OF SUCH LOSS, DAMAGES, CLAIMS OR COSTS.
+ **********************************************************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "FreeRTOSConfig.h"
+#include "semphr.h"
+#include "queue.h"
+#include "task.h"
+
+#include "bsp_api.h"
+#include "common_init.h"
+#include "common_data.h"
+#include "common_utils.h"
+#include "menu_web_stats.h"
+
+#include "websys.h"
+#include "webio.h"
+#include "efsFile.h"
+#include "efsWebSites.h"
+#include "efsOspi.h"
+
+#define CONNECTION_ABORT_CRTL    (0x00)
+#define MENU_EXIT_CRTL           (0x20)
+#define TIMING_RESET_CRTL        ('r')
+#define OSPI_MOUNT_CRTL          ('m')
+#define OSPI_UNMOUNT_CRTL        ('u')
+
+/* Number of headers built for each timing */
+#define HDR_TEST_COUNT           (1000)
+
+/* Times each EFS image is read for the throughput comparison */
+#define EFS_READ_PASSES          (4)
+
+/* Bound for checking the image linked into the internal code flash */
+#define INTERNAL_FLASH_SIZE      (0x00100000UL)
+
+#define MODULE_NAME     "\r\n%d. WEB SERVER STATISTICS\r\n"
+
+/* Terminal window escape sequences */
+static const char * const sp_clear_screen   = "\x1b[2J";
+static const char * const sp_cursor_home    = "\x1b[H";
+
+static char print_buffer [BUFFER_LINE_LENGTH] = {};
+
+/* Session and file data for the header timing, so the web server sessions are not touched */
+static wi_sess s_hdr_sess;
+static const char s_hdr_file[] = "header timing";
+static char s_hdr_buffer[HDRBUFSIZE];
+
+/* Buffer the EFS images are read into, the size em_fread() reads at a time */
+static char s_efs_buffer[WI_FSBUFSIZE];
+
+/**********************************************************************************************************************
+ * Function Name: time_header
+ * Description  : Times HDR_TEST_COUNT reply headers, built either by formatting every field or from a file template.
+ * Argument     : use_template - true to build the headers from a template
+ * Return Value : Timer counts for all of the headers.
+ *********************************************************************************************************************/
+static uint32_t time_header(bool_t use_template)
+{
+    timer_status_t status = {};
+    int test_var;
+
+    s_hdr_sess.ws_ftype = "text/html";
+    s_hdr_sess.ws_flags = WF_PERSIST;
+
+    R_GPT_Open(g_memory_performance.p_ctrl, g_memory_performance.p_cfg);
+
+    /* Build the template once so only the cached case is timed */
+    if (use_template)
+    {
+        wi_buildfilehdr(&s_hdr_sess, s_hdr_buffer, s_hdr_file, 12345);
+    }
+
+    R_GPT_Start(g_memory_performance.p_ctrl);
+    for (test_var = 0; test_var < HDR_TEST_COUNT; test_var++)
+    {
+        if (use_template)
+        {
+            wi_buildfilehdr(&s_hdr_sess, s_hdr_buffer, s_hdr_file, 12345);
+        }
+        else
+        {
+            wi_buildhdr(&s_hdr_sess, s_hdr_buffer, 12345);
+        }
+    }
+    R_GPT_Stop(g_memory_performance.p_ctrl);
+
+    R_GPT_StatusGet(g_memory_performance.p_ctrl, &status);
+    R_GPT_Reset(g_memory_performance.p_ctrl);
+    R_GPT_Close(g_memory_performance.p_ctrl);
+
+    return (status.counter);
+}
+/**********************************************************************************************************************
+ End of function time_header
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: time_efs_read
+ * Description  : Times EFS_READ_PASSES reads of the first size bytes of an EFS image, copied out WI_FSBUFSIZE bytes at a
+ *                time as the web server sends a file.
+ * Arguments    : p_image - the image
+ *              : size - bytes of it to read
+ * Return Value : Timer counts for all of the reads.
+ *********************************************************************************************************************/
+static uint32_t time_efs_read(const void * p_image, uint32_t size)
+{
+    timer_status_t status = {};
+    const char * p_src;
+    uint32_t offset;
+    uint32_t chunk;
+    int pass;
+
+    R_GPT_Open(g_memory_performance.p_ctrl, g_memory_performance.p_cfg);
+
+    R_GPT_Start(g_memory_performance.p_ctrl);
+    for (pass = 0; pass < EFS_READ_PASSES; pass++)
+    {
+        p_src = (const char *) p_image;
+        for (offset = 0; offset < size; offset += chunk)
+        {
+            chunk = ((size - offset) < sizeof(s_efs_buffer)) ? (size - offset) : sizeof(s_efs_buffer);
+            memcpy(s_efs_buffer, p_src + offset, chunk);
+        }
+    }
+    R_GPT_Stop(g_memory_performance.p_ctrl);
+
+    R_GPT_StatusGet(g_memory_performance.p_ctrl, &status);
+    R_GPT_Reset(g_memory_performance.p_ctrl);
+    R_GPT_Close(g_memory_performance.p_ctrl);
+
+    return (status.counter);
+}
+/**********************************************************************************************************************
+ End of function time_efs_read
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: print_efs_read
+ * Description  : Prints whether there is a web site mounted from the Octo-SPI flash and, if there is, the throughput of
+ *                reading it through the XIP memory map against reading the same number of bytes of the image linked
+ *                into the internal code flash.
+ * Argument     : timer_frequency - the GPT counts per second
+ * Return Value : None.
+ *********************************************************************************************************************/
+static void print_efs_read(uint32_t timer_frequency)
+{
+    const void * p_ospi_image;
+    uint32_t ospi_size = 0;
+    uint32_t internal_size = 0;
+    uint32_t internal_counts;
+    uint32_t ospi_counts;
+    uint64_t bytes;
+
+    p_ospi_image = efsOspiImage(&ospi_size);
+    if (NULL == p_ospi_image)
+    {
+        print_to_console("\r\n\r\nWeb site in Octo-SPI flash: not mounted");
+        return;
+    }
+    sprintf(print_buffer, "\r\n\r\nWeb site in Octo-SPI flash: mounted at 0x%08lx, %lu bytes", (uint32_t) p_ospi_image,
+            ospi_size);
+    print_to_console(print_buffer);
+
+    if ((0 == gEFSL.stNumberOfElements) || (NULL == gEFSL.ppvEfs[0])
+            || (EFS_OK != efsCheckImage(gEFSL.ppvEfs[0], INTERNAL_FLASH_SIZE, &internal_size)))
+    {
+        return;
+    }
+
+    /* The same bytes from each, the smaller image's size */
+    if (ospi_size < internal_size)
+    {
+        internal_size = ospi_size;
+    }
+    internal_counts = time_efs_read(gEFSL.ppvEfs[0], internal_size);
+    ospi_counts     = time_efs_read(p_ospi_image, internal_size);
+    bytes           = (uint64_t) internal_size * EFS_READ_PASSES;
+
+    sprintf(print_buffer, "\r\nEFS read, %lu bytes from internal flash: %7lu KB/s", internal_size,
+            (0 != internal_counts) ? (uint32_t) ((bytes * timer_frequency) / internal_counts / 1024) : 0UL);
+    print_to_console(print_buffer);
+    sprintf(print_buffer, "\r\nEFS read, %lu bytes from Octo-SPI XIP:   %7lu KB/s", internal_size,
+            (0 != ospi_counts) ? (uint32_t) ((bytes * timer_frequency) / ospi_counts / 1024) : 0UL);
+    print_to_console(print_buffer);
+}
+/**********************************************************************************************************************
+ End of function print_efs_read
+ *********************************************************************************************************************/
+
+#ifdef WI_TIMING
+/**********************************************************************************************************************
+ * Function Name: print_timing
+ * Description  : Prints the request phase timings of each kind of URL that has been requested, then the histogram of
+ *                the total time of each.
+ * Return Value : None.
+ *********************************************************************************************************************/
+static void print_timing(void)
+{
+    wi_hist hist;
+    wi_hist * p_hist = &hist;
+    int class_ndx;
+    int phase_ndx;
+    int bucket_ndx;
+
+    print_to_console("\r\n\r\n---------------------------------------------------------------");
+    print_to_console("\r\nRequest timing (us)     Count     Mean    p50 <    p99 <      Max");
+    print_to_console("\r\n---------------------------------------------------------------");
+    for (class_ndx = 0; class_ndx < WI_TCLASSES; class_ndx++)
+    {
+        /* The workers may be adding to them, copy each under the lock */
+        wi_timecopy(class_ndx, WI_PH_TOTAL, p_hist);
+        if (0 == p_hist->wh_count)
+        {
+            continue;
+        }
+        for (phase_ndx = 0; phase_ndx < WI_PHASES; phase_ndx++)
+        {
+            wi_timecopy(class_ndx, phase_ndx, p_hist);
+            sprintf(print_buffer, "\r\n%-6s  %-6s      %9lu %8lu %8lu %8lu %8lu", wi_tclassnames[class_ndx],
+                    wi_phasenames[phase_ndx], p_hist->wh_count,
+                    (p_hist->wh_count) ? (p_hist->wh_sum / p_hist->wh_count) : 0UL,
+                    wi_timepercent(p_hist, 50), wi_timepercent(p_hist, 99), p_hist->wh_max);
+            print_to_console(print_buffer);
+        }
+    }
+    print_to_console("\r\n---------------------------------------------------------------");
+
+    /* Only the buckets in use, the last one is open ended */
+    for (class_ndx = 0; class_ndx < WI_TCLASSES; class_ndx++)
+    {
+        wi_timecopy(class_ndx, WI_PH_TOTAL, p_hist);
+        if (0 == p_hist->wh_count)
+        {
+            continue;
+        }
+        sprintf(print_buffer, "\r\n%s total:", wi_tclassnames[class_ndx]);
+        print_to_console(print_buffer);
+        for (bucket_ndx = 0; bucket_ndx < WI_TIMEBUCKETS; bucket_ndx++)
+        {
+            if (0 == p_hist->wh_bucket[bucket_ndx])
+            {
+                continue;
+            }
+            if (bucket_ndx < (WI_TIMEBUCKETS - 1))
+            {
+                sprintf(print_buffer, "\r\n  < %7lu us  %8lu", 1UL << bucket_ndx, p_hist->wh_bucket[bucket_ndx]);
+            }
+            else
+            {
+                sprintf(print_buffer, "\r\n  longer      %8lu", p_hist->wh_bucket[bucket_ndx]);
+            }
+            print_to_console(print_buffer);
+        }
+    }
+}
+/**********************************************************************************************************************
+ End of function print_timing
+ *********************************************************************************************************************/
+#endif /* WI_TIMING */
+
+/**********************************************************************************************************************
+ * Function Name: web_stats_display_menu
+ * Description  : .
+ * Return Value : The web server statistics screen.
+ *********************************************************************************************************************/
+test_fn web_stats_display_menu(void)
+{
+    int c = -1;
+    int pool_ndx;
+    int worker_ndx;
+    wi_pool pool;
+    u_long worker_sessions;
+    u_long worker_replies;
+    u_long bin_files;
+    u_long bin_bytes;
+    u_long bin_ticks;
+    timer_info_t timer_info;
+    uint32_t timer_frequency;
+    uint32_t format_result;
+    uint32_t template_result;
+
+    sprintf(print_buffer, "%s%s", sp_clear_screen, sp_cursor_home);
+    print_to_console(print_buffer);
+
+    sprintf(print_buffer, MODULE_NAME, g_selected_menu);
+    print_to_console(print_buffer);
+
+    print_to_console("\r\n-------------------------------------------------");
+    print_to_console("\r\nPool          Size   In use   Max use   Failed");
+    print_to_console("\r\n-------------------------------------------------");
+    for (pool_ndx = 0; NULL != wi_pools[pool_ndx]; pool_ndx++)
+    {
+        /* The web server tasks change the counts under the lock */
+        WI_LOCK();
+        pool = *wi_pools[pool_ndx];
+        WI_UNLOCK();
+        sprintf(print_buffer, "\r\n%-10s  %6d   %6d    %6d   %6lu", pool.wp_name, pool.wp_count, pool.wp_inuse,
+                pool.wp_maxuse, pool.wp_fails);
+        print_to_console(print_buffer);
+    }
+    print_to_console("\r\n-------------------------------------------------");
+
+    print_to_console("\r\n\r\nWorker      Sessions   Replies");
+    for (worker_ndx = 0; worker_ndx < WI_WORKERS; worker_ndx++)
+    {
+        WI_LOCK();
+        worker_sessions = wi_workers[worker_ndx].ww_assigned - wi_workers[worker_ndx].ww_released;
+        worker_replies  = wi_workers[worker_ndx].ww_replies;
+        WI_UNLOCK();
+        sprintf(print_buffer, "\r\n%6d      %8lu  %8lu", worker_ndx, worker_sessions, worker_replies);
+        print_to_console(print_buffer);
+    }
+
+    WI_LOCK();
+    bin_files = wi_binfiles;
+    bin_bytes = wi_binbytes;
+    bin_ticks = wi_binticks;
+    WI_UNLOCK();
+    sprintf(print_buffer, "\r\n\r\nBinary files sent: %lu, %lu bytes", bin_files, bin_bytes);
+    print_to_console(print_buffer);
+    if (0 != bin_ticks)
+    {
+        sprintf(print_buffer, "\r\nBinary file throughput: %lu KB/s",
+                (bin_bytes / bin_ticks) * TPS / 1024);
+        print_to_console(print_buffer);
+    }
+
+    R_GPT_InfoGet(g_memory_performance.p_ctrl, &timer_info);
+    timer_frequency = timer_info.clock_frequency;
+
+    /* Multiply uSec calcs by 100, to avoid losses due to small results in integer maths */
+    format_result   = ((100000000 / timer_frequency) * time_header(false)) / 100;
+    template_result = ((100000000 / timer_frequency) * time_header(true)) / 100;
+
+    sprintf(print_buffer, "\r\n\r\nReply header, formatted:     %6lu ns", (format_result * 1000) / HDR_TEST_COUNT);
+    print_to_console(print_buffer);
+    sprintf(print_buffer, "\r\nReply header, from template: %6lu ns", (template_result * 1000) / HDR_TEST_COUNT);
+    print_to_console(print_buffer);
+
+    print_efs_read(timer_frequency);
+
+#ifdef WI_TIMING
+    print_timing();
+    print_to_console("\r\n\r\n> Press r to clear the request timings");
+#endif
+    print_to_console("\r\n> Press m to mount or u to unmount the web site in Octo-SPI flash");
+
+    sprintf(print_buffer, MENU_RETURN_INFO);
+    print_to_console(print_buffer);
+
+    while ((CONNECTION_ABORT_CRTL != c))
+    {
+        c = input_from_console();
+        if ((MENU_EXIT_CRTL == c) || (CONNECTION_ABORT_CRTL == c))
+        {
+            break;
+        }
+#ifdef WI_TIMING
+        if (TIMING_RESET_CRTL == c)
+        {
+            wi_timereset();
+            print_to_console("\r\nRequest timings cleared");
+        }
+#endif
+        if (OSPI_MOUNT_CRTL == c)
+        {
+            print_to_console(efsOspiMount() ? "\r\nOcto-SPI web site mounted"
+                                            : "\r\nNo web site in Octo-SPI flash");
+        }
+        if (OSPI_UNMOUNT_CRTL == c)
+        {
+            efsOspiUnmount();
+            print_to_console("\r\nOcto-SPI web site unmounted");
+        }
+    }
+    return (0);
+}
+/**********************************************************************************************************************
+ End of function web_stats_display_menu
+ *********************************************************************************************************************/
@@ -362,7 +362,7 @@ int32_t fmtOut(const char    *pszFormat,
                 /* Get variable from the argument list */
             if ('p' == Fmt.chFmt)
                 {
-                    ulValue = (uint32_t) va_arg(ap,char   *);
+                    ulValue = (uint32_t) (uintptr_t) va_arg(ap,char   *);
                 }
                 else if (sizeof(int16_t) == sizeof(int32_t))
                 {
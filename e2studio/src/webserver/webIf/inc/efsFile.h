@@ -71,6 +71,16 @@ Includes   <System Includes> , "Project Includes"
 Enumerated Types
 ******************************************************************************/
 
+/* The versions of the binary, in VERSION.ulVersion.
+   Version 1 is the EFILE chain alone, directly after the VERSION header.
+   Version 2 puts an EFSINDEX header after the VERSION header and appends
+   a hash table of the files to the chain, which is otherwise unchanged:
+   VERSION, EFSINDEX, EFILE chain (at ulRootOffset), EFSSLOT table (at
+   ulSlotOffset), and optionally the entity tag table (at ulETagOffset)
+   and the tags */
+#define EFS_VERSION_CHAIN       1UL
+#define EFS_VERSION_INDEXED     2UL
+
 typedef enum _EFSERR
 {
     EFS_OK = 0,
@@ -78,7 +88,8 @@ typedef enum _EFSERR
     EFS_DIRECTORY_NOT_FOUND = -2,
     EFS_BINARY_NOT_FOUND = -3,
     EFS_BINARY_ENDIAN_ERROR = -4,
-    EFS_BINARY_ALIGNMENT_ERROR = -5
+    EFS_BINARY_ALIGNMENT_ERROR = -5,
+    EFS_BINARY_FORMAT_ERROR = -6
 } EFSERR;
 
 /*****************************************************************************
@@ -108,6 +119,40 @@ typedef struct _EFHDR
 } EFHDR,
 *PEFHDR;
 
+/* The header of the hash table in a version 2 binary. All offsets are
+   from the start of the binary */
+typedef struct _EFSINDEX
+{
+    
+    uint32_t   ulHeaderSize;      /*!< The size of this header, so later versions can extend it */
+    
+    uint32_t   ulRootOffset;      /*!< The offset of the root directory entry */
+    
+    uint32_t   ulSlotOffset;      /*!< The offset of the hash table */
+    
+    uint32_t   ulSlotCount;       /*!< The number of slots in the table, a power of two */
+
+    uint32_t   ulETagOffset;      /*!< The offset of the entity tag table, only there when
+                                     ulHeaderSize is 20 or more. It has an offset for each
+                                     slot of the hash table, of the quoted entity tag of the
+                                     file, a null terminated string. Zero if there is none */
+} EFSINDEX,
+*PEFSINDEX;
+
+/* A slot of the hash table. Files are found by open addressing: start at
+   slot (hash & (ulSlotCount - 1)) and step on by one until the file or an
+   empty slot. The table is never more than half full */
+typedef struct _EFSSLOT
+{
+    
+    uint32_t   ulHash;            /*!< efsHashPath() of the path and name of the file */
+    
+    uint32_t   ulFileOffset;      /*!< The offset of the file entry, zero for an empty slot */
+    
+    uint32_t   ulDirOffset;       /*!< The offset of the entry of the directory holding it */
+} EFSSLOT,
+*PEFSSLOT;
+
 /* The structure of the embedded file */
 typedef struct _EFILE
 {
@@ -138,9 +183,19 @@ typedef struct _EFS
     uint32_t        ulFileLength;    /*!< The length of the data */
     
     _Bool           bfDataAllocated; /*!< Flag to specify that the file data must be freed on close */
+
+    const char      *pszETag;        /*!< Pointer to the quoted entity tag of the file when the
+                                          binary has one, else NULL */
 } EFS,
 *PEFS;
 
+/* The function efsEnumFiles calls for each file, with the name of its
+   directory as stored in the binary (e.g. "\" or "\images") and its
+   name */
+typedef void (*PEFSENUMFN)(void         *pvContext,
+                           const int8_t *pszPath,
+                           const int8_t *pszName);
+
 /*****************************************************************************
 Public Functions
 ******************************************************************************/
@@ -164,6 +219,39 @@ extern  EFSERR efsFindFile(void     *pvBin,
                            int8_t   *pszFilePathAndName,
                            PEFS     pEfsFile);
 
+/**
+ * @brief         Function to call a function for each file in a binary file
+ *                created by the EmbedFS utility, in the order they are stored
+ *   
+ * @param[in]     pvBin: Pointer to the encapsulated file system
+ * @param[in]     pfnFile: Pointer to the function to call
+ * @param[in]     pvContext: Pointer passed to the function
+ * 
+ * @retval        0:  Success 
+ * @retval        ER_CODE: error code
+ */
+extern  EFSERR efsEnumFiles(void       *pvBin,
+                            PEFSENUMFN pfnFile,
+                            void       *pvContext);
+
+/**
+ * @brief         Function to check that a binary is one the other functions
+ *                can use safely: every offset of the headers, the chain and
+ *                the hash table must stay inside the memory given. For a
+ *                binary that may have been changed since the firmware was
+ *                built, e.g. one in external flash
+ *   
+ * @param[in]     pvBin: Pointer to the encapsulated file system
+ * @param[in]     ulMaxSize: The size of the memory holding it
+ * @param[out]    pulSize: Pointer to the size of the binary, may be NULL
+ * 
+ * @retval        0:  Success 
+ * @retval        ER_CODE: error code
+ */
+extern  EFSERR efsCheckImage(const void *pvBin,
+                             uint32_t   ulMaxSize,
+                             uint32_t   *pulSize);
+
 /**
  * @brief         Function to search the encapsulated file system for a file
  *     
@@ -176,6 +264,23 @@ extern  EFSERR efsFindFile(void     *pvBin,
  */
 extern  EFSERR efsSearch(PEFILE pfsFile, int8_t *pszFind, PEFS pEfsFile);
 
+/**
+ * @brief         Function to find a file with the hash table of a version 2
+ *                binary
+ *     
+ * @param[in]     pvBin:  Pointer to the encapsulated file system
+ * @param[in]     pIndex: Pointer to the hash table header
+ * @param[in]     pszFind: Pointer to the file path and name
+ * @param[out]    pEfsFile: Pointer to the encapsulated file information
+ * 
+ * @retval        0:  Success 
+ * @retval        ER_CODE: error code
+ */
+extern  EFSERR efsSearchIndex(void      *pvBin,
+                              PEFSINDEX pIndex,
+                              int8_t    *pszFind,
+                              PEFS      pEfsFile);
+
 /**
  * @brief         Function to split a file name and path into the name and path
  *     
@@ -201,6 +306,17 @@ extern  void efsSplitFileNameAndPath(int8_t  *pszFilePathAndName,
  */
 extern  _Bool efsIsRoot(int8_t *pszPath, size_t stLength);
 
+/**
+ * @brief         Function to check a directory entry is the one in a file path
+ *     
+ * @param[in]     pfsDir: Pointer to the directory
+ * @param[in]     pszPath: Pointer to the file path
+ * @param[in]     stPathLength: The length of the file path
+ * 
+ * @retval        TRUE: If the directory is the one in the path
+ */
+extern  _Bool efsIsDir(PEFILE pfsDir, int8_t *pszPath, size_t stPathLength);
+
 /**
  * @brief         Function to search the encapsulated file system for a directory
  *     
@@ -229,6 +345,17 @@ extern  EFSERR efsSearchForFile(PEFILE pfsFile,
                                 int8_t *pszFile,
                                 PEFS   pEfsFile);
 
+/**
+ * @brief         Function to hash a file path and name for the hash table of
+ *                a version 2 binary. The first slash is dropped, and the
+ *                hash ignores case and the kind of slash, as the searches do
+ *   
+ * @param[in]     pszPath: Pointer to the file path and name
+ * 
+ * @return        The hash
+ */
+extern  uint32_t efsHashPath(const int8_t *pszPath);
+
 /**
  * @brief         Function to compare two strings case insensitive
  *   
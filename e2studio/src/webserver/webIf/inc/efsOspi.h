@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * DISCLAIMER
+ * This software is supplied by Renesas Electronics Corporation and is only
+ * intended for use with Renesas products. No other uses are authorized. This
+ * software is owned by Renesas Electronics Corporation and is protected under
+ * all applicable laws, including copyright laws.
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND RENESAS MAKES NO WARRANTIES REGARDING
+ * THIS SOFTWARE, WHETHER EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT
+ * LIMITED TO WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+ * AND NON-INFRINGEMENT. ALL SUCH WARRANTIES ARE EXPRESSLY DISCLAIMED.
+ * TO THE MAXIMUM EXTENT PERMITTED NOT PROHIBITED BY LAW, NEITHER RENESAS
+ * ELECTRONICS CORPORATION NOR ANY OF ITS AFFILIATED COMPANIES SHALL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, SPECIAL, INCIDENTAL OR CONSEQUENTIAL DAMAGES FOR
+ * ANY REASON RELATED TO THIS SOFTWARE, EVEN IF RENESAS OR ITS AFFILIATES HAVE
+ * BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ * Renesas reserves the right, without notice, to make changes to this software
+ * and to discontinue the availability of this software. By using this
+ * software, you agree to the additional terms and conditions found by
+ * accessing the following link:
+ * http://www.renesas.com/disclaimer
+*******************************************************************************
+* Copyright (C) 2020 Renesas Electronics Corporation. All rights reserved.
+ *****************************************************************************/
+/******************************************************************************
+ * @headerfile     efsOspi.h
+ * @brief          Mounts an embedded file system programmed into the Octo-SPI
+ *                 flash, read through its XIP memory map
+ * @version        1.00
+ *****************************************************************************/
+/******************************************************************************
+  WARNING!  IN ACCORDANCE WITH THE USER LICENCE THIS CODE MUST NOT BE CONVEYED
+  OR REDISTRIBUTED IN COMBINATION WITH ANY SOFTWARE LICENSED UNDER TERMS THE
+  SAME AS OR SIMILAR TO THE GNU GENERAL PUBLIC LICENCE
+******************************************************************************/
+/* Multiple inclusion prevention macro */
+#ifndef EFSOSPI_H
+#define EFSOSPI_H
+
+/**************************************************************************//**
+ * @ingroup R_SW_PKG_93_EFS_FILE
+ * @{
+ *****************************************************************************/
+/******************************************************************************
+Includes   <System Includes> , "Project Includes"
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+Macro definitions
+******************************************************************************/
+
+/* Where the Octo-SPI flash is mapped for XIP reads */
+#define EFS_OSPI_BASE               (0x68000000UL)
+
+/* The size of the Octo-SPI flash device on the EK-RA6M4, 512 Mbit */
+#define EFS_OSPI_SIZE               (0x04000000UL)
+
+/******************************************************************************
+Public Functions
+******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief         Function to open the Octo-SPI flash, enter XIP mode and
+ *                mount the EFS image at EFS_OSPI_BASE in the web server.
+ *                The image is checked first, it is served ahead of the
+ *                images linked into the firmware
+ *
+ * @retval        True:  If the image was mounted
+ * @retval        False: If there is no good image, the flash is closed
+ */
+extern  _Bool efsOspiMount(void);
+
+/**
+ * @brief         Function to unmount the Octo-SPI image, wait until no
+ *                session is still reading it, then leave XIP mode and
+ *                close the flash so that it may be erased or programmed
+ * @return        None.
+ */
+extern  void efsOspiUnmount(void);
+
+/**
+ * @brief         Function to get the mounted Octo-SPI image
+ *
+ * @param[out]    pulSize: Pointer to the size of the image, may be NULL
+ *
+ * @return        The image, or NULL if none is mounted
+ */
+extern  const void *efsOspiImage(uint32_t *pulSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EFSOSPI_H */
+/**************************************************************************//**
+ * @} (end addtogroup)
+ *****************************************************************************/
+/******************************************************************************
+End  Of File
+******************************************************************************/
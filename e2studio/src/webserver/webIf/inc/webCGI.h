@@ -121,6 +121,27 @@ extern  int khanCompare(const int8_t *pszS1,
  */
 extern  PSVRFN cgiGetFunction(int8_t *pszSsiFileName);
 
+/**
+ * @brief         Function to add the table of embedded CGI functions to the
+ *                route table being built. A file name may have {name}
+ *                parameters, which the function gets with em_routearg()
+ *      
+ * @param[in]     pRoutes: Pointer to the route table
+ * 
+ * @retval        0: Success
+ * @retval        ER_CODE: error code
+ */
+extern  int cgiAddRoutes(em_routes *pRoutes);
+
+/**
+ * @brief         Function to check the table of WebSocket endpoints for the
+ *                given file name
+ * @param[in]     pszFileName: Pointer to the file name
+ * @retval        p_handler: Pointer to the endpoint.
+ * @retval        NULL:      If there is no endpoint by that name
+ */
+extern  wi_wshandler *cgiGetWsHandler(int8_t *pszFileName);
+
 /**
  * @brief         Function to get the arguments passed to the CGI function
  *     
@@ -110,6 +110,17 @@ extern "C" {
  */
 extern  PSVRFN ssiGetFunction(int8_t *pszSsiFileName);
 
+/**
+ * @brief         Function to add the table of embedded SSI functions to the
+ *                route table being built
+ * 
+ * @param[in]     pRoutes: Pointer to the route table
+ * 
+ * @retval        0: Success
+ * @retval        ER_CODE: error code
+ */
+extern  int ssiAddRoutes(em_routes *pRoutes);
+
 #ifdef __cplusplus
 }
 #endif
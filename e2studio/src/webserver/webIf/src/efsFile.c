@@ -75,9 +75,10 @@ EFSERR efsFindFile(void *pvBin, int8_t *pszFilePathAndName, PEFS pEfsFile)
 {
     if (pvBin)
     {
-        PEFILE  pfsFile = (PEFILE)(((int8_t*)pvBin) + sizeof(VERSION));
-#ifdef _DEBUG_
         PVERSION    pVer = pvBin;
+        PEFILE      pfsFile = (PEFILE)(((int8_t*)pvBin) + sizeof(VERSION));
+        PEFSINDEX   pIndex = NULL;
+#ifdef _DEBUG_
         if ((size_t)pvBin & 0x03)
         {
             TRACE(("efsFindFile: **Error: EFS_BINARY_ALIGNMENT_ERROR\r\n"));
@@ -89,9 +90,21 @@ EFSERR efsFindFile(void *pvBin, int8_t *pszFilePathAndName, PEFS pEfsFile)
             return EFS_BINARY_ENDIAN_ERROR;
         }
 #endif
+        /* A version 2 binary has the hash table header in front of the
+           root directory entry */
+        if (pVer->ulVersion >= EFS_VERSION_INDEXED)
+        {
+            pIndex = (PEFSINDEX)pfsFile;
+            pfsFile = (PEFILE)(((int8_t*)pvBin) + pIndex->ulRootOffset);
+        }
         /* Check for the root directory entry */
         if (strcmp("\\", (const char *) &pfsFile->szName) == 0)
         {
+            if (pIndex)
+            {
+                /* Look the file up in the hash table */
+                return efsSearchIndex(pvBin, pIndex, pszFilePathAndName, pEfsFile);
+            }
             /* Search the encapsulated file system for the file */
             return efsSearch(pfsFile, pszFilePathAndName, pEfsFile);
         }
@@ -102,6 +115,258 @@ EFSERR efsFindFile(void *pvBin, int8_t *pszFilePathAndName, PEFS pEfsFile)
 End of function  efsFindFile
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: efsEnumFiles
+Description:   Function to call a function for each file in a binary file
+               created by the EmbedFS utility, in the order they are stored
+Arguments:     IN  pvBin - Pointer to the encapsulated file system
+               IN  pfnFile - Pointer to the function to call
+               IN  pvContext - Pointer passed to the function
+Return value:  0 for success or error code
+*****************************************************************************/
+EFSERR efsEnumFiles(void *pvBin, PEFSENUMFN pfnFile, void *pvContext)
+{
+    if (pvBin)
+    {
+        PVERSION    pVer = pvBin;
+        PEFILE      pfsDir = (PEFILE)(((int8_t*)pvBin) + sizeof(VERSION));
+        if (pVer->ulEndianTag != 0x87654321UL)
+        {
+            return EFS_BINARY_ENDIAN_ERROR;
+        }
+        if (pVer->ulVersion >= EFS_VERSION_INDEXED)
+        {
+            pfsDir = (PEFILE)(((int8_t*)pvBin)
+                   + ((PEFSINDEX)pfsDir)->ulRootOffset);
+        }
+        /* Each directory entry until the end of the list */
+        while (pfsDir->fileHeader.ulNextOffset)
+        {
+            PEFILE  pDirEnd = (PEFILE)(((uint8_t*)pfsDir)
+                            + pfsDir->fileHeader.ulDataLength);
+            PEFILE  pfsFile = (PEFILE)(((uint8_t*)pfsDir)
+                            + pfsDir->fileHeader.ulNextOffset);
+            /* Each file in the directory */
+            while (pfsFile < pDirEnd)
+            {
+                pfnFile(pvContext, &pfsDir->szName, &pfsFile->szName);
+                pfsFile = (PEFILE)(((uint8_t*)pfsFile)
+                        + pfsFile->fileHeader.ulNextOffset);
+            }
+            pfsDir = pDirEnd;
+        }
+        return EFS_OK;
+    }
+    return EFS_BINARY_NOT_FOUND;
+}
+/*****************************************************************************
+End of function  efsEnumFiles
+******************************************************************************/
+
+/*****************************************************************************
+Function Name: efsCheckName
+Description:   Function to check that the name of an entry is null
+               terminated before the end of the binary
+Arguments:     IN  pbyBin - Pointer to the encapsulated file system
+               IN  ulEntry - The offset of the entry
+               IN  ulMaxSize - The size of the binary
+Return value:  The offset of the end of the name, or zero if it has none
+*****************************************************************************/
+static uint32_t efsCheckName(const uint8_t *pbyBin, uint32_t ulEntry, uint32_t ulMaxSize)
+{
+    uint32_t ulName = ulEntry + offsetof(EFILE, szName);
+    const uint8_t *pbyEnd;
+
+    if ((ulEntry > ulMaxSize) || (ulName >= ulMaxSize))
+    {
+        return 0;
+    }
+    pbyEnd = memchr(pbyBin + ulName, 0, ulMaxSize - ulName);
+    return (pbyEnd) ? (uint32_t)(pbyEnd - pbyBin) + 1 : 0;
+}
+/*****************************************************************************
+End of function  efsCheckName
+******************************************************************************/
+
+/*****************************************************************************
+Function Name: efsCheckImage
+Description:   Function to check that a binary is one the other functions
+               can use safely, by walking it with every offset checked
+               against the size of the memory holding it
+Arguments:     IN  pvBin - Pointer to the encapsulated file system
+               IN  ulMaxSize - The size of the memory holding it
+               OUT pulSize - Pointer to the size of the binary, may be NULL
+Return value:  0 for success or error code
+*****************************************************************************/
+EFSERR efsCheckImage(const void *pvBin, uint32_t ulMaxSize, uint32_t *pulSize)
+{
+    const uint8_t   *pbyBin = pvBin;
+    PVERSION        pVer = (PVERSION)pvBin;
+    PEFSINDEX       pIndex = NULL;
+    uint32_t        ulRoot = sizeof(VERSION);
+    uint32_t        ulDir;
+    uint32_t        ulDirEnd;
+    uint32_t        ulFile;
+    uint32_t        ulEnd;
+    uint32_t        ulSlot;
+
+    if (NULL == pvBin)
+    {
+        return EFS_BINARY_NOT_FOUND;
+    }
+    if ((size_t)pvBin & 0x03)
+    {
+        return EFS_BINARY_ALIGNMENT_ERROR;
+    }
+    if (ulMaxSize < (sizeof(VERSION) + sizeof(EFILE)))
+    {
+        return EFS_BINARY_NOT_FOUND;
+    }
+    if (pVer->ulEndianTag != 0x87654321UL)
+    {
+        return EFS_BINARY_ENDIAN_ERROR;
+    }
+    if ((pVer->ulVersion != EFS_VERSION_CHAIN) && (pVer->ulVersion != EFS_VERSION_INDEXED))
+    {
+        return EFS_BINARY_FORMAT_ERROR;
+    }
+
+    /* The hash table header and where it puts the chain */
+    if (EFS_VERSION_INDEXED == pVer->ulVersion)
+    {
+        pIndex = (PEFSINDEX)(pbyBin + sizeof(VERSION));
+        if ((ulMaxSize < (sizeof(VERSION) + offsetof(EFSINDEX, ulETagOffset)))
+        ||  (pIndex->ulHeaderSize < offsetof(EFSINDEX, ulETagOffset))
+        ||  (pIndex->ulHeaderSize > (ulMaxSize - sizeof(VERSION))))
+        {
+            return EFS_BINARY_FORMAT_ERROR;
+        }
+        ulRoot = pIndex->ulRootOffset;
+    }
+    if ((ulRoot & 0x03) || (ulRoot > (ulMaxSize - sizeof(EFILE)))
+    ||  (strcmp("\\", (const char *) &((PEFILE)(pbyBin + ulRoot))->szName) != 0))
+    {
+        return EFS_BINARY_FORMAT_ERROR;
+    }
+
+    /* Each directory entry, whose data length is the offset of the next,
+       until the end entry */
+    ulDir = ulRoot;
+    for (;;)
+    {
+        PEFHDR  pDir = (PEFHDR)(pbyBin + ulDir);
+
+        ulEnd = efsCheckName(pbyBin, ulDir, ulMaxSize);
+        if ((0 == ulEnd) || (0 != pDir->ulDataOffset))
+        {
+            return EFS_BINARY_FORMAT_ERROR;
+        }
+        if (0 == pDir->ulNextOffset)
+        {
+            break;
+        }
+        ulDirEnd = ulDir + pDir->ulDataLength;
+        if ((pDir->ulDataLength & 0x03) || (pDir->ulDataLength < pDir->ulNextOffset)
+        ||  (ulDirEnd <= ulDir) || (ulDirEnd > (ulMaxSize - sizeof(EFILE))))
+        {
+            return EFS_BINARY_FORMAT_ERROR;
+        }
+
+        /* Each file in the directory, with its data inside it */
+        for (ulFile = ulDir + pDir->ulNextOffset; ulFile < ulDirEnd; )
+        {
+            PEFHDR  pFile = (PEFHDR)(pbyBin + ulFile);
+
+            if ((ulFile & 0x03) || (0 == efsCheckName(pbyBin, ulFile, ulDirEnd))
+            ||  (0 == pFile->ulNextOffset) || (pFile->ulNextOffset > (ulDirEnd - ulFile))
+            ||  (pFile->ulDataOffset > pFile->ulNextOffset)
+            ||  (pFile->ulDataLength > (pFile->ulNextOffset - pFile->ulDataOffset)))
+            {
+                return EFS_BINARY_FORMAT_ERROR;
+            }
+            ulFile += pFile->ulNextOffset;
+        }
+        ulDir = ulDirEnd;
+    }
+
+    /* The hash table and the entity tags must point into the chain and
+       the binary */
+    if (pIndex)
+    {
+        PEFSSLOT    pSlots;
+        uint32_t    ulETags = 0;
+
+        if ((0 == pIndex->ulSlotCount) || (pIndex->ulSlotCount & (pIndex->ulSlotCount - 1))
+        ||  (pIndex->ulSlotOffset & 0x03) || (pIndex->ulSlotOffset > ulMaxSize)
+        ||  (pIndex->ulSlotCount > ((ulMaxSize - pIndex->ulSlotOffset) / sizeof(EFSSLOT))))
+        {
+            return EFS_BINARY_FORMAT_ERROR;
+        }
+        pSlots = (PEFSSLOT)(pbyBin + pIndex->ulSlotOffset);
+        if (ulEnd < (pIndex->ulSlotOffset + (pIndex->ulSlotCount * sizeof(EFSSLOT))))
+        {
+            ulEnd = pIndex->ulSlotOffset + (pIndex->ulSlotCount * sizeof(EFSSLOT));
+        }
+        if ((pIndex->ulHeaderSize >= sizeof(EFSINDEX)) && (pIndex->ulETagOffset))
+        {
+            ulETags = pIndex->ulETagOffset;
+            if ((ulETags & 0x03) || (ulETags > ulMaxSize)
+            ||  (pIndex->ulSlotCount > ((ulMaxSize - ulETags) / sizeof(uint32_t))))
+            {
+                return EFS_BINARY_FORMAT_ERROR;
+            }
+            if (ulEnd < (ulETags + (pIndex->ulSlotCount * sizeof(uint32_t))))
+            {
+                ulEnd = ulETags + (pIndex->ulSlotCount * sizeof(uint32_t));
+            }
+        }
+        for (ulSlot = 0; ulSlot < pIndex->ulSlotCount; ulSlot++)
+        {
+            if (0 == pSlots[ulSlot].ulFileOffset)
+            {
+                continue;
+            }
+            if ((pSlots[ulSlot].ulFileOffset < ulRoot) || (pSlots[ulSlot].ulFileOffset >= ulDir)
+            ||  (pSlots[ulSlot].ulDirOffset < ulRoot) || (pSlots[ulSlot].ulDirOffset >= ulDir))
+            {
+                return EFS_BINARY_FORMAT_ERROR;
+            }
+            if (ulETags)
+            {
+                uint32_t ulTag = ((const uint32_t *)(pbyBin + ulETags))[ulSlot];
+                const uint8_t *pbyTagEnd;
+
+                if (0 == ulTag)
+                {
+                    continue;
+                }
+                if (ulTag >= ulMaxSize)
+                {
+                    return EFS_BINARY_FORMAT_ERROR;
+                }
+                pbyTagEnd = memchr(pbyBin + ulTag, 0, ulMaxSize - ulTag);
+                if (NULL == pbyTagEnd)
+                {
+                    return EFS_BINARY_FORMAT_ERROR;
+                }
+                if (ulEnd < ((uint32_t)(pbyTagEnd - pbyBin) + 1))
+                {
+                    ulEnd = (uint32_t)(pbyTagEnd - pbyBin) + 1;
+                }
+            }
+        }
+    }
+
+    if (pulSize)
+    {
+        *pulSize = ulEnd;
+    }
+    return EFS_OK;
+}
+/*****************************************************************************
+End of function  efsCheckImage
+******************************************************************************/
+
 /*****************************************************************************
 Function Name: efsSearch
 Description:   Function to search the encapsulated file system for a file
@@ -137,6 +402,75 @@ EFSERR efsSearch(PEFILE pfsFile, int8_t *pszFind, PEFS pEfsFile)
 End of function  efsSearch
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: efsSearchIndex
+Description:   Function to find a file with the hash table of a version 2
+               binary. Only the entries with the same hash are compared with
+               the file path and name
+Arguments:     IN  pvBin - Pointer to the encapsulated file system
+               IN  pIndex - Pointer to the hash table header
+               IN  pszFind - Pointer to the file path and name
+               OUT pEfsFile - Pointer to the encapsulated file
+Return value:  0 for success or error code
+*****************************************************************************/
+EFSERR efsSearchIndex(void *pvBin, PEFSINDEX pIndex, int8_t *pszFind, PEFS pEfsFile)
+{
+    uint8_t     *pbyBin = (uint8_t*)pvBin;
+    PEFSSLOT    pSlots = (PEFSSLOT)(pbyBin + pIndex->ulSlotOffset);
+    uint32_t    ulMask = pIndex->ulSlotCount - 1UL;
+    uint32_t    ulHash = efsHashPath(pszFind);
+    uint32_t    ulSlot = ulHash & ulMask;
+    uint32_t    ulProbes;
+    int8_t      *pszPath;
+    size_t      stPathLength;
+    int8_t      *pszFile;
+    /* Split the string into the name and the path */
+    efsSplitFileNameAndPath(pszFind, &pszPath, &stPathLength, &pszFile);
+    /* Until an empty slot, there always is one */
+    for (ulProbes = 0; ulProbes < pIndex->ulSlotCount; ulProbes++)
+    {
+        PEFSSLOT    pSlot = &pSlots[ulSlot];
+        if (!pSlot->ulFileOffset)
+        {
+            break;
+        }
+        if (pSlot->ulHash == ulHash)
+        {
+            PEFILE  pfsFile = (PEFILE)(pbyBin + pSlot->ulFileOffset);
+            PEFILE  pfsDir = (PEFILE)(pbyBin + pSlot->ulDirOffset);
+            /* Confirm the name and then the directory */
+            if ((!efsStricmp(pszFile, &pfsFile->szName))
+            &&  (efsIsDir(pfsDir, pszPath, stPathLength)))
+            {
+                /* Set the file information */
+                pEfsFile->pszFilePath = &pfsDir->szName;
+                pEfsFile->pszFileName = &pfsFile->szName;
+                pEfsFile->pbyFileData = (uint8_t *)(((uint8_t*)pfsFile)
+                                      + pfsFile->fileHeader.ulDataOffset);
+                pEfsFile->ulFileLength = pfsFile->fileHeader.ulDataLength;
+                pEfsFile->bfDataAllocated = false;
+                pEfsFile->pszETag = NULL;
+                /* The entity tag table is in the later headers */
+                if ((pIndex->ulHeaderSize >= sizeof(EFSINDEX))
+                &&  (pIndex->ulETagOffset))
+                {
+                    uint32_t *pulETags = (uint32_t*)(pbyBin + pIndex->ulETagOffset);
+                    if (pulETags[ulSlot])
+                    {
+                        pEfsFile->pszETag = (const char *)(pbyBin + pulETags[ulSlot]);
+                    }
+                }
+                return EFS_OK;
+            }
+        }
+        ulSlot = (ulSlot + 1UL) & ulMask;
+    }
+    return EFS_FILE_NOT_FOUND;
+}
+/*****************************************************************************
+End of function  efsSearchIndex
+******************************************************************************/
+
 /*****************************************************************************
 Function Name: efsSplit
 Description:   Function to split a file name and path into the name and path
@@ -215,6 +549,40 @@ _Bool efsIsRoot(int8_t *pszPath, size_t stLength)
 End of function  efsIsRoot
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: efsIsDir
+Description:   Function to check a directory entry is the one in a file path
+Arguments:     IN  pfsDir - Pointer to the directory
+               IN  pszPath - Pointer to the file path
+               IN  stPathLength - The length of the file path
+Return value:  true if the directory is the one in the path
+*****************************************************************************/
+_Bool efsIsDir(PEFILE pfsDir, int8_t *pszPath, size_t stPathLength)
+{
+    int8_t *pszName = &pfsDir->szName;
+    if (efsIsRoot(pszPath, stPathLength))
+    {
+        return (strcmp("\\", (const char *)pszName) == 0);
+    }
+    /* Drop the first slash of the file path and of the name */
+    if ((*pszPath == '\\')
+    ||  (*pszPath == '/'))
+    {
+        pszPath++;
+        stPathLength--;
+    }
+    if ((*pszName == '\\')
+    ||  (*pszName == '/'))
+    {
+        pszName++;
+    }
+    /* The last slash of the path is not part of the name */
+    return (!efsKhanCompare(pszPath, pszName, stPathLength - 1));
+}
+/*****************************************************************************
+End of function  efsIsDir
+******************************************************************************/
+
 /*****************************************************************************
 Function Name: efsSearchForDir
 Description:   Function to search the encapsulated file system for a directory
@@ -304,6 +672,7 @@ EFSERR efsSearchForFile(PEFILE pfsFile,
                                       + pfsFile->fileHeader.ulDataOffset);
                 pEfsFile->ulFileLength = pfsFile->fileHeader.ulDataLength;
                 pEfsFile->bfDataAllocated = false;
+                pEfsFile->pszETag = NULL;
                 return EFS_OK;
             }
             /* Point at the next entry */
@@ -317,6 +686,37 @@ EFSERR efsSearchForFile(PEFILE pfsFile,
 End of function  efsSearchForFile
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: efsHashPath
+Description:   Function to hash a file path and name for the hash table of a
+               version 2 binary. This is the 32 bit FNV-1a hash of the path
+               without its first slash, with the case and the slashes folded
+               the way efsStricmp and efsKhanCompare ignore them
+Arguments:     IN  pszPath - Pointer to the file path and name
+Return value:  The hash
+*****************************************************************************/
+uint32_t efsHashPath(const int8_t *pszPath)
+{
+    uint32_t    ulHash = 2166136261UL;
+    /* Drop the first slash */
+    if ((*pszPath == '\\')
+    ||  (*pszPath == '/'))
+    {
+        pszPath++;
+    }
+    while (*pszPath)
+    {
+        uint8_t byChar = (uint8_t)*pszPath++;
+        byChar = (byChar == '\\') ? (uint8_t)'/' : (uint8_t)(byChar | 0x20);
+        ulHash ^= byChar;
+        ulHash *= 16777619UL;
+    }
+    return ulHash;
+}
+/*****************************************************************************
+End of function  efsHashPath
+******************************************************************************/
+
 /*****************************************************************************
 Function Name: efsStricmp
 Description:   Function to compare two strings case insensitive
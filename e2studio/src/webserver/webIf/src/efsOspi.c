@@ -0,0 +1,157 @@
+/******************************************************************************
+* DISCLAIMER
+* This software is supplied by Renesas Electronics Corporation and is only
+* intended for use with Renesas products. No other uses are authorized. This
+* software is owned by Renesas Electronics Corporation and is protected under
+* all applicable laws, including copyright laws.
+* THIS SOFTWARE IS PROVIDED "AS IS" AND RENESAS MAKES NO WARRANTIES REGARDING
+* THIS SOFTWARE, WHETHER EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT
+* LIMITED TO WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE
+* AND NON-INFRINGEMENT. ALL SUCH WARRANTIES ARE EXPRESSLY DISCLAIMED.
+* TO THE MAXIMUM EXTENT PERMITTED NOT PROHIBITED BY LAW, NEITHER RENESAS
+* ELECTRONICS CORPORATION NOR ANY OF ITS AFFILIATED COMPANIES SHALL BE LIABLE
+* FOR ANY DIRECT, INDIRECT, SPECIAL, INCIDENTAL OR CONSEQUENTIAL DAMAGES FOR
+* ANY REASON RELATED TO THIS SOFTWARE, EVEN IF RENESAS OR ITS AFFILIATES HAVE
+* BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+* Renesas reserves the right, without notice, to make changes to this software
+* and to discontinue the availability of this software. By using this software,
+* you agree to the additional terms and conditions found by accessing the
+* following link:
+* http://www.renesas.com/disclaimer
+*******************************************************************************
+* Copyright (C) 2020 Renesas Electronics Corporation. All rights reserved.
+*******************************************************************************
+* File Name    : efsOspi.c
+* Version      : 1.00
+* Description  : Mounts an embedded file system programmed into the Octo-SPI
+*                flash, read through its XIP memory map
+*******************************************************************************
+* History      : DD.MM.YYYY Version Description
+*              : 17.10.2026 1.00    First Release
+******************************************************************************/
+
+/******************************************************************************
+  WARNING!  IN ACCORDANCE WITH THE USER LICENCE THIS CODE MUST NOT BE CONVEYED
+  OR REDISTRIBUTED IN COMBINATION WITH ANY SOFTWARE LICENSED UNDER TERMS THE
+  SAME AS OR SIMILAR TO THE GNU GENERAL PUBLIC LICENCE
+******************************************************************************/
+
+/******************************************************************************
+Includes   <System Includes> , "Project Includes"
+******************************************************************************/
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "hal_data.h"
+
+#include "websys.h"
+#include "webio.h"
+#include "webfs.h"
+#include "efsOspi.h"
+
+/******************************************************************************
+Macro definitions
+******************************************************************************/
+
+/* Time between checks for sessions still reading an unmounted image */
+#define EFS_OSPI_DRAIN_MS           (10)
+
+/******************************************************************************
+Private global variables and functions
+******************************************************************************/
+
+/* The size of the mounted image, 0 when none is */
+static uint32_t gs_ulImageSize = 0;
+
+/******************************************************************************
+Public Functions
+******************************************************************************/
+
+/*****************************************************************************
+ Function Name: efsOspiMount
+ Description:   Function to open the Octo-SPI flash, enter XIP mode and mount
+                the EFS image at EFS_OSPI_BASE in the web server
+ Arguments:     none
+ Return value:  true if the image was mounted
+ *****************************************************************************/
+_Bool efsOspiMount (void)
+{
+    void *pvImage = (void *) EFS_OSPI_BASE;
+    uint32_t ulSize = 0;
+
+    if (0 != gs_ulImageSize)
+    {
+        return true;
+    }
+
+    if (FSP_SUCCESS != R_OSPI_Open(g_ospi.p_ctrl, g_ospi.p_cfg))
+    {
+        return false;
+    }
+    R_OSPI_XipEnter(g_ospi.p_ctrl);
+
+    /* Erased or foreign flash is refused, em_mount() checks it again */
+    if ((EFS_OK == efsCheckImage(pvImage, EFS_OSPI_SIZE, &ulSize))
+            && (0 == em_mount(pvImage, EFS_OSPI_SIZE)))
+    {
+        gs_ulImageSize = ulSize;
+        return true;
+    }
+
+    R_OSPI_XipExit(g_ospi.p_ctrl);
+    R_OSPI_Close(g_ospi.p_ctrl);
+    return false;
+}
+/*****************************************************************************
+ End of function  efsOspiMount
+ ******************************************************************************/
+
+/*****************************************************************************
+ Function Name: efsOspiUnmount
+ Description:   Function to unmount the Octo-SPI image, wait until no session
+                is still reading it, then leave XIP mode and close the flash
+ Arguments:     none
+ Return value:  none
+ *****************************************************************************/
+void efsOspiUnmount (void)
+{
+    if (0 != gs_ulImageSize)
+    {
+        em_mount(NULL, 0);
+
+        /* Sessions that opened a file before the unmount send it to the end */
+        while (em_imagebusy((void *) EFS_OSPI_BASE, EFS_OSPI_SIZE))
+        {
+            vTaskDelay(pdMS_TO_TICKS(EFS_OSPI_DRAIN_MS));
+        }
+        gs_ulImageSize = 0;
+
+        R_OSPI_XipExit(g_ospi.p_ctrl);
+        R_OSPI_Close(g_ospi.p_ctrl);
+    }
+}
+/*****************************************************************************
+ End of function  efsOspiUnmount
+ ******************************************************************************/
+
+/*****************************************************************************
+ Function Name: efsOspiImage
+ Description:   Function to get the mounted Octo-SPI image
+ Arguments:     OUT pulSize - Pointer to the size of the image, may be NULL
+ Return value:  The image, or NULL if none is mounted
+ *****************************************************************************/
+const void *efsOspiImage (uint32_t *pulSize)
+{
+    if (NULL != pulSize)
+    {
+        *pulSize = gs_ulImageSize;
+    }
+    return (0 != gs_ulImageSize) ? (const void *) EFS_OSPI_BASE : NULL;
+}
+/*****************************************************************************
+ End of function  efsOspiImage
+ ******************************************************************************/
+
+/******************************************************************************
+End  Of File
+******************************************************************************/
@@ -114,6 +114,7 @@ static int liveCreateFile(const int8_t *pszFileName, PEFS pEfsFile, char *pszDat
     pEfsFile->pbyFileData = (uint8_t*)pszData;
     pEfsFile->ulFileLength = (uint32_t)strlen(pszData);
     pEfsFile->bfDataAllocated = true;
+    pEfsFile->pszETag = NULL;
     return 0;
 }
 /******************************************************************************
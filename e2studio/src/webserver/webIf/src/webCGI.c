@@ -207,6 +207,29 @@ PSVRFN cgiGetFunction (int8_t *pszCgiFileName)
  End of function  cgiGetFunction
  ******************************************************************************/
 
+/*****************************************************************************
+ Function Name: cgiAddRoutes
+ Description:   Function to add the table of embedded CGI functions to the
+ route table being built
+ Arguments:     IN  pRoutes - Pointer to the route table
+ Return value:  0 for success or error code
+ *****************************************************************************/
+int cgiAddRoutes (em_routes *pRoutes)
+{
+    size_t stIndex;
+    int iError = 0;
+
+    for (stIndex = 0; (stIndex < gCgiTab.stNumber) && (!iError); stIndex++)
+    {
+        iError = em_routeadd(pRoutes, (const char *) gCgiTab.pCgiList[stIndex].pszCgiFileName, EM_RT_CGI,
+                gCgiTab.pCgiList[stIndex].pCgiFunction);
+    }
+    return iError;
+}
+/*****************************************************************************
+ End of function  cgiAddRoutes
+ ******************************************************************************/
+
 /*****************************************************************************
  Function Name: cgiGetArgument
  Description:   Function to get the arguments passed to the CGI function
@@ -228,7 +251,7 @@ char *cgiGetArgument (PSESS pSess, _Bool bfFirst)
         {
             if ('-' == *pszResult)
             {
-                return strtok(pszResult, "-");
+                return strtok_r(pszResult, "-", &pSess->ws_argnext);
             }
             else
             {
@@ -240,7 +263,7 @@ char *cgiGetArgument (PSESS pSess, _Bool bfFirst)
     else
     {
         /* Search for the next one */
-        return strtok(NULL, "-");
+        return strtok_r(NULL, "-", &pSess->ws_argnext);
     }
 }
 /*****************************************************************************
@@ -564,6 +587,113 @@ static int cgiGetTime (PSESS pSess, PEOFILE pEoFile)
  End of function  cgiGetTime
  ******************************************************************************/
 
+/*****************************************************************************
+ Function Name: cgiPrintStatus
+ Description:   Function to format the board status as compact JSON for the
+ status stream and the board WebSocket
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ Return value:  none
+ *****************************************************************************/
+static void cgiPrintStatus (PSESS pSess)
+{
+    wi_printf(pSess,
+            "{\"tf\":\"%d.%d\",\"tc\":\"%d.%d\",\"hz\":%d,\"dc\":%d}",
+            g_board_status.temperature_f.whole_number, g_board_status.temperature_f.mantissa,
+            g_board_status.temperature_c.whole_number, g_board_status.temperature_c.mantissa,
+            g_pwm_rates_data[g_board_status.led_frequency],
+            g_pwm_dcs_data[g_board_status.led_intensity]
+            );
+}
+/*****************************************************************************
+ End of function  cgiPrintStatus
+ ******************************************************************************/
+
+/*****************************************************************************
+ Function Name: cgiStatusEvents
+ Description:   Function to stream the board status to the dashboard as
+ Server-Sent Events. The first call starts the stream, later
+ calls are polled by the web server and format the current
+ status, which is only sent when it has changed
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ IN/OUT pEoFile - Pointer to the embedded file object
+ Return value:  0 for success or error code
+ *****************************************************************************/
+static int cgiStatusEvents (PSESS pSess, PEOFILE pEoFile)
+{
+    (void) pEoFile;
+
+    if (!(pSess->ws_flags & WF_SVRPUSH))
+    {
+        return wi_pushstart(pSess);
+    }
+
+    wi_printf(pSess, "data: ");
+    cgiPrintStatus(pSess);
+    wi_printf(pSess, "\n\n");
+
+    return 0;
+}
+/*****************************************************************************
+ End of function  cgiStatusEvents
+ ******************************************************************************/
+
+/*****************************************************************************
+ Function Name: cgiTiming
+ Description:   Function to report the request phase timing histograms as
+ JSON. "us" has the upper limit of each bucket in
+ microseconds, the last bucket has no limit
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ IN/OUT pEoFile - Pointer to the embedded file object
+ Return value:  0 for success or error code
+ *****************************************************************************/
+static int cgiTiming (PSESS pSess, PEOFILE pEoFile)
+{
+#ifdef WI_TIMING
+    wi_hist hist;
+    wi_hist *p_hist = &hist;
+    int iClass;
+    int iPhase;
+    int iBucket;
+
+    (void) pEoFile;
+
+    wi_printf(pSess, "{\"us\":[");
+    for (iBucket = 0; iBucket < (WI_TIMEBUCKETS - 1); iBucket++)
+    {
+        wi_printf(pSess, "%s%lu", (iBucket) ? "," : "", 1UL << iBucket);
+    }
+    wi_printf(pSess, "]");
+
+    for (iClass = 0; iClass < WI_TCLASSES; iClass++)
+    {
+        wi_printf(pSess, ",\r\n\"%s\":{", wi_tclassnames[iClass]);
+        for (iPhase = 0; iPhase < WI_PHASES; iPhase++)
+        {
+            wi_timecopy(iClass, iPhase, p_hist);
+            wi_printf(pSess, "%s\r\n\"%s\":{\"n\":%lu,\"mean\":%lu,\"p50\":%lu,\"p99\":%lu,\"max\":%lu,\"hist\":[",
+                    (iPhase) ? "," : "", wi_phasenames[iPhase], p_hist->wh_count,
+                    (p_hist->wh_count) ? (p_hist->wh_sum / p_hist->wh_count) : 0UL,
+                    wi_timepercent(p_hist, 50), wi_timepercent(p_hist, 99), p_hist->wh_max);
+            for (iBucket = 0; iBucket < WI_TIMEBUCKETS; iBucket++)
+            {
+                wi_printf(pSess, "%s%lu", (iBucket) ? "," : "", p_hist->wh_bucket[iBucket]);
+            }
+            wi_printf(pSess, "]}");
+        }
+        wi_printf(pSess, "}");
+    }
+    wi_printf(pSess, "}\r\n");
+#else
+    (void) pEoFile;
+
+    wi_printf(pSess, "{}\r\n");
+#endif
+    return 0;
+}
+/*****************************************************************************
+ End of function  cgiTiming
+ ******************************************************************************/
+
 
 
 /******************************************************************************
@@ -666,6 +796,41 @@ static int cgiLedCtrl (PSESS pSess, PEOFILE pEoFile)
  End of function  cgiLedCtrl
  ******************************************************************************/
 
+/******************************************************************************
+ Function Name: cgiApiLed
+ Description:   Function to get or set an LED, routed from "api/led/{n}" where
+ n is 1 to the number of LEDs. The argument state=on or
+ state=off sets it. The reply is the state of the LED as JSON
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ IN/OUT pEoFile - Pointer to the embedded file object
+ Return value:  0 for success or error code
+ ******************************************************************************/
+static int cgiApiLed (PSESS pSess, PEOFILE pEoFile)
+{
+    static _Bool gbfLedOn[8];
+    const char *pszLed = em_routearg(pEoFile, "n");
+    char *pszState;
+    int iLed = (pszLed) ? atoi(pszLed) : 0;
+
+    pSess->ws_ftype = "application/json";
+    if ((iLed < 1) || (iLed > (int) g_bsp_leds.led_count) || (iLed > (int) sizeof(gbfLedOn)))
+    {
+        wi_printf(pSess, "{\"error\":\"no LED %s\"}", (pszLed) ? pszLed : "");
+        return (0);
+    }
+    pszState = wi_formvalue(pSess, "state");
+    if (pszState)
+    {
+        gbfLedOn[iLed - 1] = (0 == stricmp(pszState, "on"));
+        R_IOPORT_PinWrite(&g_ioport_ctrl, g_bsp_leds.p_leds[iLed - 1], (gbfLedOn[iLed - 1]) ? ON : OFF);
+    }
+    wi_printf(pSess, "{\"led\":%d,\"state\":\"%s\"}", iLed, (gbfLedOn[iLed - 1]) ? "on" : "off");
+    return (0);
+}
+/******************************************************************************
+ End of function  cgiApiLed
+ ******************************************************************************/
+
 /******************************************************************************
  Function Name: cgiSetTime
  Description:   Function to set the time
@@ -913,6 +1078,75 @@ static int cgiSetPassword (PSESS pSess, PEOFILE pEoFile)
  End of function  cgiSetPassword
  ******************************************************************************/
 
+/******************************************************************************
+ Function Name: cgiWsBoardMessage
+ Description:   Function to handle a command from the board WebSocket. "sw1"
+ and "sw2" act like the virtual buttons, anything else (e.g.
+ "status") only asks for the board status, which is the reply
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ IN  iOpcode - The WebSocket message type
+ IN  pszData - Pointer to the message
+ IN  iLength - The length of the message
+ Return value:  0 for success or error code
+ ******************************************************************************/
+static int cgiWsBoardMessage (PSESS pSess, int iOpcode, char *pszData, int iLength)
+{
+    (void) iOpcode;
+    (void) iLength;
+
+    if (!strcmp(pszData, "sw1"))
+    {
+        cgiSW1Ctrl(pSess, NULL);
+    }
+    else if (!strcmp(pszData, "sw2"))
+    {
+        cgiSW2Ctrl(pSess, NULL);
+    }
+    cgiPrintStatus(pSess);
+    return (0);
+}
+/******************************************************************************
+ End of function  cgiWsBoardMessage
+ ******************************************************************************/
+
+/******************************************************************************
+ Function Name: cgiWsBoardPoll
+ Description:   Function to format the board status for the board WebSocket.
+ The server only sends it when it has changed
+ Arguments:     IN/OUT pSess - Pointer to the session data
+ Return value:  0 for success or error code
+ ******************************************************************************/
+static int cgiWsBoardPoll (PSESS pSess)
+{
+    cgiPrintStatus(pSess);
+    return (0);
+}
+/******************************************************************************
+ End of function  cgiWsBoardPoll
+ ******************************************************************************/
+
+/******************************************************************************
+ Function Name: cgiGetWsHandler
+ Description:   Function to check the table of WebSocket endpoints for the
+ given file name
+ Arguments:     IN  pszFileName - Pointer to the file name
+ Return value:  Pointer to the endpoint or NULL if not found
+ ******************************************************************************/
+wi_wshandler *cgiGetWsHandler (int8_t *pszFileName)
+{
+    static wi_wshandler board_handler =
+    { cgiWsBoardMessage, cgiWsBoardPoll };
+
+    if (!pathCompare("board.ws", (const char *) pszFileName))
+    {
+        return &board_handler;
+    }
+    return NULL;
+}
+/******************************************************************************
+ End of function  cgiGetWsHandler
+ ******************************************************************************/
+
 /*****************************************************************************
  Constant Data
  ******************************************************************************/
@@ -920,9 +1154,12 @@ static int cgiSetPassword (PSESS pSess, PEOFILE pEoFile)
 static const CGIFNASS gpCgiFnAss[] =
 {
     {(int8_t *) "get_time.cgi", cgiGetTime},
+    {(int8_t *) "status_events.cgi", cgiStatusEvents},
+    {(int8_t *) "timing.cgi", cgiTiming},
     {(int8_t *) "led_ctrl.cgi", cgiLedCtrl},
     {(int8_t *) "sw1_ctrl.cgi", cgiSW1Ctrl},
     {(int8_t *) "sw2_ctrl.cgi", cgiSW2Ctrl},
+    {(int8_t *) "api/led/{n}", cgiApiLed},
 
 //	{(int8_t *) "ms_explore.cgi", cgiMsExplore},
 //	{(int8_t *) "ms_test.cgi", cgiMsTest},
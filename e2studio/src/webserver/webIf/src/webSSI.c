@@ -111,6 +111,32 @@ PSVRFN ssiGetFunction(int8_t *pszSsiFileName)
 End of function  ssiGetFunction
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: ssiAddRoutes
+Description:   Function to add the table of embedded SSI functions to the
+               route table being built
+Arguments:     IN  pRoutes - Pointer to the route table
+Return value:  0 for success or error code
+*****************************************************************************/
+int ssiAddRoutes(em_routes *pRoutes)
+{
+    size_t  st_index;
+    int     iError = 0;
+
+    for (st_index = 0; (st_index < gSsiTab.stNumber) && (!iError); st_index++)
+    {
+        iError = em_routeadd(pRoutes,
+                             (const char *) gSsiTab.pSsiList[st_index].pszSsiFileName,
+                             EM_RT_SSI,
+                             gSsiTab.pSsiList[st_index].pSsiFunction);
+    }
+
+    return iError;
+}
+/*****************************************************************************
+End of function  ssiAddRoutes
+******************************************************************************/
+
 /*****************************************************************************
 Private Functions
 ******************************************************************************/
@@ -43,6 +43,7 @@
 #include "webio.h"
 #include "webfs.h"
 #include "webif.h"
+#include "efsOspi.h"
 
 #include "board_cfg.h"
 
@@ -88,7 +89,8 @@ extern socktype wi_listen;
  ******************************************************************************/
 extern _Bool cmdCheckUserNameAndPassword(char *pszUserName, char *pszPassword);
 
-static TaskHandle_t *gs_pgui_webio_task_id = NULL;
+/* One task for each Webio worker */
+static TaskHandle_t gs_pgui_webio_task_id[WI_WORKERS];
 
 /*****************************************************************************
  Public Functions
@@ -102,9 +104,10 @@ static TaskHandle_t *gs_pgui_webio_task_id = NULL;
  *****************************************************************************/
 _Bool wsStart (uint16_t usPortNumber)
 {
-    if (NULL == gs_pgui_webio_task_id)
+    if (NULL == gs_pgui_webio_task_id[0])
     {
         int iError;
+        int iWorker;
 
         /* Set the port number for the Webio server */
         httpport = usPortNumber;
@@ -118,16 +121,25 @@ _Bool wsStart (uint16_t usPortNumber)
             /* Install our port-local authentication routine */
             emfs.wfs_fauth = wsAuthenticate;
 
-            /* Create the task to run the Webio server */
+            /* Serve the web site in the Octo-SPI flash, if one has been
+               programmed, ahead of the one linked in */
+            efsOspiMount();
 
-            /* Create the task to run the Webio server */
-            xTaskCreate(wsMain,
-                       (const char*) "Webio wi_thread",
-                       configMINIMAL_STACK_SIZE * 32, NULL,
-                       10, // close to idle
-                       &gs_pgui_webio_task_id);
+            /* Create the tasks to run the Webio server, one per worker */
+            for (iWorker = 0; iWorker < WI_WORKERS; iWorker++)
+            {
+                xTaskCreate(wsMain,
+                           (const char*) "Webio wi_thread",
+                           configMINIMAL_STACK_SIZE * 32, &wi_workers[iWorker],
+                           10, // close to idle
+                           &gs_pgui_webio_task_id[iWorker]);
+                if (NULL == gs_pgui_webio_task_id[iWorker])
+                {
+                    break;
+                }
+            }
 
-            if (NULL != gs_pgui_webio_task_id)
+            if (WI_WORKERS == iWorker)
             {
                 return true;
             }
@@ -158,25 +170,33 @@ _Bool wsStart (uint16_t usPortNumber)
  *****************************************************************************/
 void wsStop (void)
 {
-    if (NULL != gs_pgui_webio_task_id)
+    if (NULL != gs_pgui_webio_task_id[0])
     {
         wi_sess *pSess;
         wi_sess *pNext;
+        int iWorker;
 
-        /* Kill the Webio task */
-        R_OS_DeleteTask(gs_pgui_webio_task_id);
-        gs_pgui_webio_task_id = NULL;
-
-        /* No function to uninit Webio */
-        pSess = wi_sessions;
-        while (pSess)
+        for (iWorker = 0; iWorker < WI_WORKERS; iWorker++)
         {
-            pNext = pSess->ws_next;
-            wi_delsess(pSess);
-            pSess = pNext;
+            /* Kill the Webio task */
+            if (NULL != gs_pgui_webio_task_id[iWorker])
+            {
+                R_OS_DeleteTask(gs_pgui_webio_task_id[iWorker]);
+                gs_pgui_webio_task_id[iWorker] = NULL;
+            }
+
+            /* No function to uninit Webio */
+            pSess = wi_workers[iWorker].ww_sessions;
+            while (pSess)
+            {
+                pNext = pSess->ws_next;
+                wi_delsess(pSess);
+                pSess = pNext;
+            }
         }
 
         /* Close the listening socket */
+        FreeRTOS_FD_CLR(wi_listen, wi_workers[0].ww_sockset, eSELECT_ALL);
         closesocket(wi_listen);
     }
 }
@@ -226,7 +246,7 @@ void wsPanic (char *pszMessage)
     /* This is similar to John's test code but it is not suitable for an
      embedded web server! */
 #if 0
-    gs_pgui_webio_task_id = NULL;
+    gs_pgui_webio_task_id[0] = NULL;
     taskExit();
 #endif
 }
@@ -280,8 +300,8 @@ static void wsMain( void *pvParameters )
 
     while (true)
     {
-        /* Run the Webio main task */
-        wi_thread();
+        /* Run the Webio main task for this worker */
+        wi_thread((wi_worker *) pvParameters);
     }
 }
 /*****************************************************************************
@@ -47,6 +47,9 @@ wi_putchar(char ch, void * pv_sess)
       /* or it won't fit, */
       (1 >= (WI_TXBUFSIZE - sess->ws_txtail->tb_total)))
    {
+      /* send the full ones first if the reply can be chunked */
+      if(sess->ws_txtail && wi_txflush(sess))
+         return -1;
       /* get another buffer */
       if(wi_txalloc(sess) == NULL)
          return -1;
@@ -74,7 +74,10 @@ wi_filesys emfs = {
    em_fwrite,
    em_fclose,
    em_fseek,
-   em_ftell
+   em_ftell,
+   NULL,          /* wfs_fauth, set by wsStart() */
+   em_push,
+   em_fmap
 };
 #endif   /* WI_EMBFILES */
 
@@ -108,7 +111,8 @@ wi_file *      wi_allfiles;   /* list of all open files */
  * webio top level file open routine. This is just wrapper for the lower
  * level routine - either the Embedded FS, and the host system's native FS.
  *
- * Returns: 0 if OK else negative WIE_ error code.
+ * Returns: 0 if OK else negative WIE_ error code. WIE_MEMORY means a pool
+ * was empty, so the file may be there when the server is less busy.
  * 
  */
 
@@ -136,9 +140,22 @@ wi_fopen(wi_sess * sess, char * name, char * mode)
             fsys->wfs_fclose(fd);
             return WIE_MEMORY;
          }
+/* ++ REE/EDC */
+#ifdef USE_EMFILES
+         if(fsys == &emfs)
+            ((EOFILE*)fd)->eo_sess = wi_poolhandle(&wi_sesspool, sess);
+#endif
+/* -- REE/EDC */
          return 0;
       }
    }
+/* ++ REE/EDC */
+   /* A file system finds no file when it has no descriptor to give */
+#ifdef USE_EMFILES
+   if(wi_poolempty(&wi_eopool))
+      return WIE_MEMORY;
+#endif
+/* -- REE/EDC */
    return WIE_NOFILE;
 }
 
@@ -200,27 +217,18 @@ wi_ftell(WI_FILE * fd)
 #include "efsWebSites.h"
 /* -- REE/EDC */
 
-/* transient list of em_ files which are currently open */
-EOFILE * em_openlist;
-
 /* em_verify()
  * 
- * Make sure a passed fd is really an EOFILE.
+ * Make sure a passed fd is really an EOFILE. Every open EOFILE is a
+ * block of wi_eopool in use, so this is a check of the pointer rather
+ * than a search of the open files.
  * 
  * Returns 0 if it is, or WIE_BADFILE if not.
  */
 int
 em_verify(EOFILE * fd)
 {
-   EOFILE *    eofile;
-
-   /* verify file pointer is valid */
-   for(eofile = em_openlist; eofile;eofile = eofile->eo_next)
-   {
-      if(eofile == fd)
-         break;
-   }
-   if(!eofile)
+   if(wi_poolindex(&wi_eopool, fd) < 0)
       return WIE_BADFILE;
 
    return 0;
@@ -228,57 +236,61 @@ em_verify(EOFILE * fd)
 
 /* em_lookupsess()
  * 
- * Lookup web session based on an emf fd 
+ * Lookup web session based on an emf fd, from the session handle
+ * wi_fopen() or em_callfn() left in it.
  *
- * returns session, or NULL if not found.
+ * returns session, or NULL if the fd is not open or its session has been
+ * deleted.
  */
 
 wi_sess * 
 em_lookupsess(void * fd)
 {
-   wi_sess *   sess;
-
-   for(sess = wi_sessions; sess; sess = sess->ws_next)
-      if(sess->ws_filelist->wf_fd == fd)
-         return sess;
+   if(em_verify((EOFILE*)fd))
+      return NULL;
 
-   return NULL;
+   return (wi_sess *)wi_poolobj(&wi_sesspool, ((EOFILE*)fd)->eo_sess);
 }
 
-WI_FILE *
-em_fopen(char * name, char * mode)
+/* ++ REE/EDC */
+/* em_search()
+ *
+ * Find a file or routine without the route table: try each EFS image,
+ * then the SSI and the CGI tables. em_fopen() does this if em_routeinit()
+ * has not built the table.
+ *
+ * Returns: 0 if found, else an EFSERR.
+ */
+
+static int
+em_search(char * name, PEFS eo_file, void ** ppvEfs, PSVRFN * eo_function)
 {
-   /* ++ REE/EDC - replaced John Bartas's compiled file system with a number
+   /* replaced John Bartas's compiled file system with a number
       of encapsulated file systems contained in the gEFSL data struct */
    size_t  st_number = gEFSL.stNumberOfElements;
    EFSERR  efs_error = EFS_FILE_NOT_FOUND;
-   void    *pvEfs = NULL;
-   /* The encapsulated file system file information structure */
-   EFS     eo_file;
-   EOFILE *eofile;
-   void   *eo_function = NULL;
-   /* All files are RO,otherwise return NULL */
-   if( *mode != 'r' )
-      return NULL;
+
    /* First check the externally loaded website */
    if (wi_pvEfs)
    {
-       efs_error = efsFindFile(wi_pvEfs, name, &eo_file);
+       efs_error = efsFindFile(wi_pvEfs, name, eo_file);
        if (EFS_OK == efs_error)
        {
-           pvEfs = wi_pvEfs;
+           *ppvEfs = wi_pvEfs;
+           return 0;
        }
    }
    /* For each of the embedded file systems */
-   while ((efs_error) && (st_number--))
+   while (st_number--)
    {
       /* Look to see if the file exists */
       efs_error = efsFindFile(gEFSL.ppvEfs[st_number],
                               name,
-                              &eo_file);
+                              eo_file);
       if(efs_error == EFS_OK)
       {
-         break;
+         *ppvEfs = gEFSL.ppvEfs[st_number];
+         return 0;
       }
 #ifdef _DEBUG_
       else if(efs_error < EFS_DIRECTORY_NOT_FOUND)
@@ -309,34 +321,72 @@ em_fopen(char * name, char * mode)
 #endif
    }
    /* If an encapsulated file was not found - check for a live file */
-   if(efs_error)
+   /* stubbed out */
+//   efs_error = liveFindFile(name, eo_file);
+
+   /* Try looking for an SSI files */
+   *eo_function = ssiGetFunction(name);
+   /* An SSI file was not found, try CGI files */
+   if (!*eo_function)
    {
-       /* stubbed out */
-//       efs_error = liveFindFile(name, &eo_file);
+      *eo_function = cgiGetFunction(name);
    }
+   /* A CGI file was not found, fail open */
+   return (*eo_function) ? 0 : (int)efs_error;
+}
+/* -- REE/EDC */
 
-#if 1 // RC2020
-   /* If an encapsulated file or live file have not been found */
-   if(efs_error)
+WI_FILE *
+em_fopen(char * name, char * mode)
+{
+   /* ++ REE/EDC */
+   void    *pvEfs = NULL;
+   /* The encapsulated file system file information structure */
+   EFS     eo_file;
+   EOFILE *eofile;
+   PSVRFN  eo_function = NULL;
+   em_route route;
+   char    args[WI_ROUTEARGSIZE];
+   int     error;
+   /* All files are RO,otherwise return NULL */
+   if( *mode != 'r' )
+      return NULL;
+
+   /* The file is found and its EOFILE taken under one lock, so that an
+    * image being unmounted is either not found or seen by em_imagebusy()
+    */
+   WI_LOCK();
+
+   /* One walk of the route table finds the file or the routine */
+   error = em_routefind(name, &route, args, sizeof(args));
+   if(error == 0)
    {
-      /* Try looking for an SSI files */
-      eo_function = ssiGetFunction(name);
-      /* An SSI file was not found, try CGI files */
-      if (!eo_function)
+      if(route.er_type == EM_RT_EFS)
       {
-         eo_function = cgiGetFunction(name);
-         if (!eo_function)
-            return NULL;
+         eo_file = route.er_file;
+         pvEfs = route.er_efs;
       }
-      /* A CGI file was not found, fail open */
-      if (!eo_function)
-         return NULL;
+      else
+      {
+         eo_function = route.er_function;
+      }
+   }
+   else if((error == WIE_NOFILE) ||
+           em_search(name, &eo_file, &pvEfs, &eo_function))
+   {
+      WI_UNLOCK();
+      return NULL;
    }
+
    /* We're going to open file. Allocate the transient control structure */
-   eofile = (EOFILE *)wi_alloc(sizeof(EOFILE));
+   eofile = (EOFILE *)wi_pooltake(&wi_eopool);
+   if(eofile && !eo_function)
+      eofile->eo_file = eo_file;
+   WI_UNLOCK();
    WI_TRACE_ALLOC(eofile);
    if(!eofile)
       return NULL;
+   eofile->eo_pattern = NULL;
    /* Either a data file was found or a function to handle the file */
    if (eo_function)
    {
@@ -344,37 +394,65 @@ em_fopen(char * name, char * mode)
        eofile->eo_function = eo_function;
        memset(&eofile->eo_file, 0, sizeof(EFS));
        eofile->eo_authenticate = 0;
+       /* Keep the values of any {name} parameters of the route */
+       if ((error == 0) && strchr(route.er_pattern, '{'))
+       {
+           eofile->eo_pattern = route.er_pattern;
+           memcpy(eofile->eo_args, args, sizeof(args));
+       }
    }
    else
    {
-       /* An encapsulate file was found */
-       eofile->eo_file = eo_file;
+       /* An encapsulate file was found, eo_file is set already */
        eofile->eo_function = NULL;
-       if (pvEfs)
-       {
-           em_check_authentication(pvEfs, eofile, name);
-       }
-       else if ((st_number >= 0)
-            &&  (st_number < gEFSL.stNumberOfElements))
-       {
-           em_check_authentication(gEFSL.ppvEfs[st_number],
-                                   eofile,
-                                   name);
-       }
+       em_check_authentication(pvEfs, eofile, name);
    }
 
-#endif
    /* Set the file position index */
    /* -- REE/EDC */
    eofile->eo_position = 0;
 
-   /* Add new open struct to open files list */
-   eofile->eo_next = em_openlist;
-   em_openlist = eofile;
-
    return ( (WI_FILE*)eofile);
 }
 
+/* ++ REE/EDC */
+/* em_callfn()
+ *
+ * Run the routine of a code-generated file included by a precompiled
+ * page. The routine was found by em_fopen() when the page was compiled;
+ * it is called with an open file as wi_ssi() would do.
+ *
+ * Returns: return value of the routine, or negative WIE_ error code.
+ */
+
+int
+em_callfn(wi_sess * sess, PSVRFN function)
+{
+   EOFILE *    eofile;
+   wi_file *   fi;
+   int         error;
+
+   eofile = (EOFILE *)wi_poolalloc(&wi_eopool);
+   WI_TRACE_ALLOC(eofile);
+   if(!eofile)
+      return WIE_MEMORY;
+   eofile->eo_function = function;
+   eofile->eo_pattern = NULL;
+   eofile->eo_sess = wi_poolhandle(&wi_sesspool, sess);
+
+   fi = wi_newfile(&emfs, sess, eofile);
+   if(!fi)
+   {
+      em_fclose(eofile);
+      return WIE_MEMORY;
+   }
+   error = function(sess, eofile);
+   wi_fclose(fi);
+
+   return error;
+}
+/* -- REE/EDC */
+
 int
 em_fread(char * buf, unsigned size1, unsigned size2, void * fd)
 {
@@ -429,27 +507,11 @@ int
 em_fclose(void * voidfd)
 {
    EOFILE *    passedfd;
-   EOFILE *    tmpfd;
-   EOFILE *    last;
 
    passedfd = (EOFILE *)voidfd;
 
    /* verify file pointer is valid */
-   last = NULL;
-   for(tmpfd = em_openlist; tmpfd; tmpfd = tmpfd->eo_next)
-   {
-      if(tmpfd == passedfd)  /* If we found it, unlink */
-      {
-         if(last)
-            last->eo_next = passedfd->eo_next;
-         else
-            em_openlist = passedfd->eo_next;
-         break;
-      }
-      last = tmpfd;
-   }
-
-   if(tmpfd == NULL)       /* fd not in list? */
+   if(em_verify(passedfd))
       return WIE_BADFILE;
    /* ++ REE/EDC */
    if(passedfd->eo_file.bfDataAllocated)
@@ -457,7 +519,7 @@ em_fclose(void * voidfd)
       free((void*)passedfd->eo_file.pbyFileData);
    }
    /* -- REE/EDC */
-   wi_free(passedfd);
+   wi_poolfree(&wi_eopool, passedfd);
    WI_TRACE_FREE(passedfd);
    return 0;
 }
@@ -508,6 +570,31 @@ em_fseek(void * fd, long offset, int mode)
 }
 
 
+/* ++ REE/EDC */
+/* em_fmap()
+ *
+ * Embedded files are already in memory, usually the flash copy of the
+ * EFS image. This gives direct access to the data so it can be sent
+ * without first copying it to a read buffer.
+ *
+ * Returns: pointer to the data at the current file position with the
+ * number of bytes left in *length, or NULL if fd is not valid.
+ */
+
+const char *
+em_fmap(void * fd, int * length)
+{
+   EOFILE *    emf;
+
+   emf = (EOFILE *)fd;
+   if(em_verify(emf))
+      return NULL;
+
+   *length = (int)(emf->eo_file.ulFileLength - emf->eo_position);
+   return (const char *)&emf->eo_file.pbyFileData[emf->eo_position];
+}
+/* -- REE/EDC */
+
 int
 em_ftell(void * fd)
 {
@@ -555,7 +642,18 @@ em_check_authentication(void    *pvEfs,
                         char    *name)
 {
    EFS     eo_file;
+   char    plain[WI_MAXURLSIZE];
+   size_t  len = strlen(name);
    pEoFile->eo_authenticate = 0;
+   /* The gzip copy of a file is protected if the file is */
+   if ((len > 3)
+   &&  (len < sizeof(plain))
+   &&  (stricmp(name + len - 3, ".gz") == 0))
+   {
+       memcpy(plain, name, len - 3);
+       plain[len - 3] = '\0';
+       name = plain;
+   }
    /* Look for the file htaccess.txt in the root of the encapsulated
       file system */
    if (!efsFindFile(pvEfs,
@@ -572,5 +670,561 @@ em_check_authentication(void    *pvEfs,
 }
 /* -- REE/EDC */
 
+/* ++ REE/EDC */
+/* Precompiled SSI pages, in the order they were compiled */
+static em_tmpl * em_tmpllist;
+
+static em_tmpl * em_findtmpl(const uint8_t * data, int len, int depth);
+
+/* em_ssinext()
+ *
+ * Find the next complete SSI directive in a block of EFS file data.
+ *
+ * Returns offset of the directive with its length in *dirlen, or len
+ * if there are no more.
+ */
+
+static int
+em_ssinext(const char * data, int len, int * dirlen)
+{
+   const char *   cp = data;
+   const char *   end = data + len;
+   const char *   ce;
+
+   while((cp = memchr(cp, '<', (size_t)(end - cp))) != NULL)
+   {
+      if((end - cp) < (WI_SSIMARKLEN + 3))
+         break;
+      if(memcmp(cp, WI_SSIMARK, WI_SSIMARKLEN) == 0)
+      {
+         ce = cp + WI_SSIMARKLEN;
+         while((ce = memchr(ce, '-', (size_t)(end - ce))) != NULL)
+         {
+            if((end - ce) < 3)
+               break;
+            if(memcmp(ce, "-->", 3) == 0)
+            {
+               *dirlen = (int)(ce + 3 - cp);
+               return (int)(cp - data);
+            }
+            ce++;
+         }
+         break;      /* unterminated, rest of file is text */
+      }
+      cp++;
+   }
+   return len;
+}
+
+/* em_findarg()
+ *
+ * Find name= in a directive and return the quoted value following it,
+ * with its length in *arglen. Returns NULL if there is none.
+ */
+
+static const char *
+em_findarg(const char * dir, int dirlen, const char * name, int * arglen)
+{
+   const char *   end = dir + dirlen;
+   const char *   cp;
+   const char *   ce;
+   int            namelen = (int)strlen(name);
+
+   for(cp = dir; (end - cp) > namelen; cp++)
+   {
+      if((memcmp(cp, name, (size_t)namelen) == 0) &&
+         ((cp[namelen] == '\"') || (cp[namelen] == '\'')))
+      {
+         cp += namelen + 1;
+         ce = memchr(cp, cp[-1], (size_t)(end - cp));
+         if(!ce)
+            return NULL;
+         *arglen = (int)(ce - cp);
+         return cp;
+      }
+   }
+   return NULL;
+}
+
+/* em_compiledir()
+ *
+ * Add the segment for an SSI directive to a page being compiled. An
+ * include is resolved to the page or routine it names; includes which
+ * pass form values, are nested too deep or are not in the EFS are left
+ * for wi_ssi() to handle when the page is sent. Directives which
+ * wi_readfile() would ignore are dropped.
+ */
+
+static void
+em_compiledir(em_tmpl * tmpl, const char * dir, int dirlen, int depth)
+{
+   em_seg *       seg = &tmpl->et_segs[tmpl->et_nsegs];
+   const char *   arg;
+   const char *   cp;
+   int            arglen;
+   char           name[128];
+   EOFILE *       eofile;
+
+   seg->es_text = dir;
+   seg->es_len = dirlen;
+
+   if((dirlen > 12) && (strncmp(dir, "<!--#include", 12) == 0))
+   {
+      if(dirlen >= WI_FSBUFSIZE)
+         return;     /* too long for wi_readfile() too */
+      tmpl->et_nsegs++;
+      seg->es_type = EMS_SSI;
+
+      arg = em_findarg(dir, dirlen, "file=", &arglen);
+      if(!arg || memchr(arg, '?', (size_t)arglen))
+         return;
+      cp = memchr(arg, ' ', (size_t)arglen);
+      if(cp)
+         arglen = (int)(cp - arg);
+      if((arglen >= (int)sizeof(name)) || (depth >= (WI_SSIDEPTH - 1)))
+         return;
+      memcpy(name, arg, (size_t)arglen);
+      name[arglen] = 0;
+
+      eofile = (EOFILE *)em_fopen(name, "r");
+      if(!eofile)
+         return;
+      if(eofile->eo_function)
+      {
+         seg->es_type = EMS_CODE;
+         seg->es_function = eofile->eo_function;
+      }
+      else
+      {
+         seg->es_tmpl = em_findtmpl(eofile->eo_file.pbyFileData,
+            (int)eofile->eo_file.ulFileLength, depth + 1);
+         if(seg->es_tmpl)
+            seg->es_type = EMS_FILE;
+      }
+      em_fclose(eofile);
+   }
+   else if((dirlen > 10) && (strncmp(dir, "<!--#exec ", 10) == 0) &&
+      (strncmp(dir + 10, "cmd_argument=", 13) == 0))
+   {
+      arg = em_findarg(dir + 10, dirlen - 10, "cmd_argument=", &arglen);
+      if(!arg || (arglen >= WI_FSBUFSIZE))
+         return;
+      tmpl->et_nsegs++;
+      seg->es_type = EMS_EXEC;
+      seg->es_text = arg;
+      seg->es_len = arglen;
+   }
+}
+
+/* em_compile()
+ *
+ * Build the segment table of a precompiled page from its EFS data.
+ *
+ * Returns: the new page, or NULL if out of memory.
+ */
+
+static em_tmpl *
+em_compile(const uint8_t * data, int len, int depth)
+{
+   const char *   text = (const char *)data;
+   em_tmpl *      tmpl;
+   em_seg *       seg;
+   int            nsegs = 1;
+   int            pos;
+   int            off;
+   int            dirlen;
+
+   /* Each directive adds at most itself and the text after it */
+   for(pos = 0; pos < len; pos += off + dirlen)
+   {
+      off = em_ssinext(&text[pos], len - pos, &dirlen);
+      if(off >= (len - pos))
+         break;
+      nsegs += 2;
+   }
+
+   tmpl = (em_tmpl *)wi_alloc((int)(sizeof(em_tmpl) + (sizeof(em_seg) * nsegs)));
+   if(!tmpl)
+      return NULL;
+   tmpl->et_data = data;
+   tmpl->et_segs = (em_seg *)(tmpl + 1);
+
+   for(pos = 0; pos < len; pos += dirlen)
+   {
+      off = em_ssinext(&text[pos], len - pos, &dirlen);
+      if(off)
+      {
+         seg = &tmpl->et_segs[tmpl->et_nsegs++];
+         seg->es_type = EMS_TEXT;
+         seg->es_text = &text[pos];
+         seg->es_len = off;
+      }
+      pos += off;
+      if(pos >= len)
+         break;
+      em_compiledir(tmpl, &text[pos], dirlen, depth);
+   }
+
+   return tmpl;
+}
+
+/* em_findtmpl()
+ *
+ * Find the precompiled page for some EFS file data, compiling it if
+ * this is the first time it is used.
+ *
+ * Returns: the page, or NULL if it could not be compiled.
+ */
+
+static em_tmpl *
+em_findtmpl(const uint8_t * data, int len, int depth)
+{
+   em_tmpl *   tmpl;
+   em_tmpl *   newtmpl;
+
+   WI_LOCK();
+   for(tmpl = em_tmpllist; tmpl; tmpl = tmpl->et_next)
+   {
+      if(tmpl->et_data == data)
+         break;
+   }
+   WI_UNLOCK();
+   if(tmpl)
+      return tmpl;
+
+   /* Compiling opens included files, so it is done unlocked */
+   newtmpl = em_compile(data, len, depth);
+   if(!newtmpl)
+      return NULL;
+
+   /* Keep the first copy if another worker compiled it meanwhile */
+   WI_LOCK();
+   for(tmpl = em_tmpllist; tmpl; tmpl = tmpl->et_next)
+   {
+      if(tmpl->et_data == data)
+         break;
+   }
+   if(!tmpl)
+   {
+      tmpl = newtmpl;
+      tmpl->et_next = em_tmpllist;
+      em_tmpllist = tmpl;
+      newtmpl = NULL;
+   }
+   WI_UNLOCK();
+   if(newtmpl)
+      wi_free(newtmpl);
+
+   return tmpl;
+}
+
+/* em_gettmpl()
+ *
+ * Get the precompiled page for an open EFS text file.
+ *
+ * Returns: the page, or NULL if the file is code-generated or the page
+ * could not be compiled.
+ */
+
+em_tmpl *
+em_gettmpl(EOFILE * eofile)
+{
+   if(eofile->eo_function || !eofile->eo_file.pbyFileData)
+      return NULL;
+
+   return em_findtmpl(eofile->eo_file.pbyFileData,
+      (int)eofile->eo_file.ulFileLength, 0);
+}
+
+/* Entity tags of EFS files, made from a hash of the file data the first
+ * time each is asked for. Images built with "embedfs -e" carry the tags,
+ * which are then used as they are.
+ */
+typedef struct em_etag_s
+{
+   struct em_etag_s * ee_next;
+   const uint8_t *   ee_data;       /* EFS file data, the lookup key */
+   char              ee_tag[24];    /* quoted tag */
+} em_etagent;
+
+static em_etagent * em_etaglist;
+
+/* em_etag()
+ *
+ * Get the entity tag of an EFS file whose reply is the same every time
+ * it is sent: a binary file, or a text file without SSI directives.
+ *
+ * Returns: the quoted tag, or NULL if the file has none.
+ */
+
+const char *
+em_etag(EOFILE * eofile, int binary)
+{
+   em_etagent *   etag;
+   em_tmpl *      tmpl;
+   const uint8_t * data = eofile->eo_file.pbyFileData;
+   u_long         len = eofile->eo_file.ulFileLength;
+   u_long         hash = 0x811c9dc5;   /* FNV-1a */
+   u_long         i;
+
+   if(eofile->eo_function || !data)
+      return NULL;
+   if(!binary)
+   {
+      tmpl = em_gettmpl(eofile);
+      if(!tmpl)
+         return NULL;
+      for(i = 0; i < (u_long)tmpl->et_nsegs; i++)
+      {
+         if(tmpl->et_segs[i].es_type != EMS_TEXT)
+            return NULL;
+      }
+   }
+
+   /* A version 2 image may have the tag made already */
+   if(eofile->eo_file.pszETag)
+      return eofile->eo_file.pszETag;
+
+   WI_LOCK();
+   for(etag = em_etaglist; etag; etag = etag->ee_next)
+   {
+      if(etag->ee_data == data)
+         break;
+   }
+   WI_UNLOCK();
+   if(etag)
+      return etag->ee_tag;
+
+   etag = (em_etagent *)wi_alloc(sizeof(em_etagent));
+   if(!etag)
+      return NULL;
+   for(i = 0; i < len; i++)
+      hash = (hash ^ data[i]) * 0x01000193;
+   sprintf(etag->ee_tag, "\"%08lx-%lx\"", hash & 0xffffffff, len);
+   etag->ee_data = data;
+
+   /* Another worker may have added the same file meanwhile; the tags are
+    * the same so either will do.
+    */
+   WI_LOCK();
+   etag->ee_next = em_etaglist;
+   em_etaglist = etag;
+   WI_UNLOCK();
+
+   return etag->ee_tag;
+}
+
+/* Precompiled pages and entity tags flushed while a session was still
+ * sending them, freed by a later em_flush() once none is.
+ */
+static em_tmpl *     em_tmplold;
+static em_etagent *  em_etagold;
+
+/* em_oldinuse()
+ *
+ * Returns: TRUE if a session is sending any of the flushed pages or tags.
+ */
+
+static int
+em_oldinuse(void)
+{
+   wi_file *      fi;
+   wi_sess *      sess;
+   em_tmpl *      tmpl;
+   em_etagent *   etag;
+   int            i;
+   int            depth;
+
+   for(i = 0; i < wi_filepool.wp_count; i++)
+   {
+      fi = (wi_file *)wi_poolat(&wi_filepool, i);
+      if(!fi)
+         continue;
+      for(depth = 0; depth < fi->wf_depth; depth++)
+      {
+         for(tmpl = em_tmplold; tmpl; tmpl = tmpl->et_next)
+         {
+            if(fi->wf_tmpls[depth] == tmpl)
+               return TRUE;
+         }
+      }
+   }
+   for(i = 0; i < wi_sesspool.wp_count; i++)
+   {
+      sess = (wi_sess *)wi_poolat(&wi_sesspool, i);
+      if(!sess || !sess->ws_etag)
+         continue;
+      for(etag = em_etagold; etag; etag = etag->ee_next)
+      {
+         if(sess->ws_etag == etag->ee_tag)
+            return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/* em_flush()
+ *
+ * Drop the precompiled pages, the entity tags and the header templates,
+ * which are all keyed by the address of the file data, so that an image
+ * mounted where another one was is not served with the old one's.
+ *
+ * A worker may have just found a page or tag it has not yet stored in
+ * its session, so what is dropped now is only freed by a later flush,
+ * and then only if no session is sending any of it. A dropped page may
+ * include others, so they are all freed together or not at all.
+ */
+
+static void
+em_flush(void)
+{
+   em_tmpl *      tmpl = NULL;
+   em_etagent *   etag = NULL;
+   em_tmpl *      tmplnext;
+   em_etagent *   etagnext;
+
+   WI_LOCK();
+   if(!em_oldinuse())
+   {
+      tmpl = em_tmplold;
+      etag = em_etagold;
+      em_tmplold = NULL;
+      em_etagold = NULL;
+   }
+   while((tmplnext = em_tmpllist) != NULL)
+   {
+      em_tmpllist = tmplnext->et_next;
+      tmplnext->et_next = em_tmplold;
+      em_tmplold = tmplnext;
+   }
+   while((etagnext = em_etaglist) != NULL)
+   {
+      em_etaglist = etagnext->ee_next;
+      etagnext->ee_next = em_etagold;
+      em_etagold = etagnext;
+   }
+   WI_UNLOCK();
+
+   while(tmpl)
+   {
+      tmplnext = tmpl->et_next;
+      wi_free(tmpl);
+      tmpl = tmplnext;
+   }
+   while(etag)
+   {
+      etagnext = etag->ee_next;
+      wi_free(etag);
+      etag = etagnext;
+   }
+   wi_flushhdrtmpls();
+}
+
+/* em_mount()
+ *
+ * Mount an EFS image, e.g. one in external flash, as the loaded image,
+ * wi_pvEfs, which is searched ahead of the images linked in. The image
+ * is checked against size first, as it may not be one this firmware was
+ * built with. It takes the place of the old one in a single store, so a
+ * request finds its file in one image or the other, then the route table
+ * is rebuilt and the caches keyed by file data address are flushed.
+ * image NULL unmounts the loaded image.
+ *
+ * The old image's files may still be open when this returns; see
+ * em_imagebusy() before changing its memory.
+ *
+ * Returns: 0 if OK, or WIE_BADFILE if image is not a good EFS image, in
+ * which case the old one stays mounted.
+ */
+
+int
+em_mount(void * image, u_long size)
+{
+   if(image && (efsCheckImage(image, (uint32_t)size, NULL) != EFS_OK))
+      return WIE_BADFILE;
+
+   WI_LOCK();
+   wi_pvEfs = image;
+   WI_UNLOCK();
+
+   em_routeinit();
+   em_flush();
+   return 0;
+}
+
+/* em_imagebusy()
+ *
+ * Returns: the number of open EFS files, pages being sent and entity
+ * tags held by sessions that are in the size bytes at image. Once an
+ * unmounted image has none, its memory may be changed.
+ */
+
+#define  EM_INIMAGE(p)  (((const uint8_t *)(p) >= start) && \
+                         ((const uint8_t *)(p) < start + size))
+
+/* em_tmplinimage()
+ *
+ * Returns: TRUE if a precompiled page, or one it includes, has its data
+ * in the size bytes at start.
+ */
+
+static int
+em_tmplinimage(em_tmpl * tmpl, const uint8_t * start, u_long size, int depth)
+{
+   int   i;
+
+   if(EM_INIMAGE(tmpl->et_data))
+      return TRUE;
+   for(i = 0; (depth < WI_SSIDEPTH) && (i < tmpl->et_nsegs); i++)
+   {
+      if((tmpl->et_segs[i].es_type == EMS_FILE) &&
+         em_tmplinimage(tmpl->et_segs[i].es_tmpl, start, size, depth + 1))
+      {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+int
+em_imagebusy(const void * image, u_long size)
+{
+   EOFILE *    eofile;
+   wi_file *   fi;
+   wi_sess *   sess;
+   const uint8_t * start = (const uint8_t *)image;
+   int         busy = 0;
+   int         i;
+
+   /* em_fopen() takes and fills in an EOFILE under the lock */
+   WI_LOCK();
+   for(i = 0; i < wi_eopool.wp_count; i++)
+   {
+      eofile = (EOFILE *)wi_poolat(&wi_eopool, i);
+      if(eofile && EM_INIMAGE(eofile->eo_file.pbyFileData))
+         busy++;
+   }
+   /* A page may include one from another image */
+   for(i = 0; i < wi_filepool.wp_count; i++)
+   {
+      fi = (wi_file *)wi_poolat(&wi_filepool, i);
+      if(fi && fi->wf_depth &&
+         em_tmplinimage(fi->wf_tmpls[0], start, size, 1))
+      {
+         busy++;
+      }
+   }
+   /* A version 2 image's tags are in the image */
+   for(i = 0; i < wi_sesspool.wp_count; i++)
+   {
+      sess = (wi_sess *)wi_poolat(&wi_sesspool, i);
+      if(sess && sess->ws_etag && EM_INIMAGE(sess->ws_etag))
+         busy++;
+   }
+   WI_UNLOCK();
+   return busy;
+}
+/* -- REE/EDC */
+
 #endif  /* USE_EMFILES */
 
@@ -36,7 +36,8 @@
  */
 typedef struct wi_file_s
 {
-   struct wi_file_s *      wf_next;       /* list link */
+   struct wi_file_s *      wf_next;       /* list links */
+   struct wi_file_s *      wf_prev;
    void *                  wf_fd;         /* lower layer descriptor */
    struct wi_filesys_s *   wf_routines;   /* routines to use */
    struct wi_sess_s *      wf_sess;       /* session for this file */
@@ -45,6 +46,11 @@ typedef struct wi_file_s
    /* -- REE/EDC */
    int      wf_inbuf;               /* number of bytes in wf_data */
    int      wf_nextbuf;             /* next byte to process in wf_data */
+   /* ++ REE/EDC */
+   struct em_tmpl_s * wf_tmpls[WI_SSIDEPTH]; /* precompiled pages being sent */
+   int      wf_segs[WI_SSIDEPTH];   /* next segment of each page */
+   int      wf_depth;               /* pages in wf_tmpls[], 0 if none */
+   /* -- REE/EDC */
 } wi_file;
 
 extern   wi_file * wi_allfiles;
@@ -63,6 +69,7 @@ typedef struct wi_filesys_s
    int         (*wfs_ftell) (void * fd);
    int         (*wfs_fauth) (void * fd, char * name, char * pw, wi_sess * sess);  /* Optional, for authentication */
    int         (*wfs_push) (void * fd, wi_sess * sess);  /* Optional, server push */
+   const char * (*wfs_fmap) (void * fd, int * length);   /* Optional, data in memory */
 } wi_filesys;
 
 
@@ -107,6 +114,7 @@ extern   int         em_fwrite(char * buf, unsigned size1, unsigned size2, void
 extern   int         em_fclose(void * fd);
 extern   int         em_fseek(void * fd, long offset, int mode);
 extern   int         em_ftell(void * fd);
+extern   const char * em_fmap(void * fd, int * length);
 
 extern   wi_filesys emfs;
 
@@ -122,17 +130,19 @@ typedef int(*const PCSVRFN)(PSESS pSess, PEOFILE pEoFile);
 
 typedef struct em_open_s
 {
-   struct em_open_s * eo_next;
    /* ++ REE/EDC - removed em_files */
    EFS         eo_file;         /* file data retrieved by efsFindFile() */
    int         eo_authenticate; /* non zero when file requires authentication */
    PSVRFN      eo_function;     /* function pointer for SSI and CGI */
    /* -- REE/EDC */
    u_long      eo_position;   /* file position pointer */
-   wi_sess *   eo_sess;       /* session (for pass to code) */
+   wi_handle   eo_sess;       /* session reading it, see em_lookupsess() */
+   /* ++ REE/EDC */
+   const char * eo_pattern;   /* CGI route with {name} parameters, or NULL */
+   char        eo_args[WI_ROUTEARGSIZE];  /* their values, see em_routearg() */
+   /* -- REE/EDC */
 } EOFILE;
 
-extern   EOFILE * em_openlist;
 extern   int         em_verify(EOFILE * fd);
 
 /* ++ REE/EDC - removed requirement for dynamic data buffer by putting data 
@@ -148,6 +158,68 @@ extern   int         em_verify(EOFILE * fd);
    generic type (PSVRFN) */
 /* -- REE/EDC */
 
+/* ++ REE/EDC */
+/* Precompiled SSI pages. The EFS is read only, so the first time a text
+ * file is sent its SSI directives are found and resolved, and it is kept
+ * as a table of segments. wi_readfile() sends later requests by walking
+ * the table, with no parsing.
+ */
+#define  EMS_TEXT       0     /* span of the file's data */
+#define  EMS_FILE       1     /* include of another precompiled page */
+#define  EMS_CODE       2     /* include of a code-generated file */
+#define  EMS_EXEC       3     /* exec directive */
+#define  EMS_SSI        4     /* include left to wi_ssi() */
+
+typedef struct em_seg_s
+{
+   int            es_type;       /* EMS_ value */
+   int            es_len;        /* length of es_text */
+   const char *   es_text;       /* text, exec argument or include directive */
+   struct em_tmpl_s * es_tmpl;   /* EMS_FILE page */
+   PSVRFN         es_function;   /* EMS_CODE routine */
+} em_seg;
+
+typedef struct em_tmpl_s
+{
+   struct em_tmpl_s * et_next;   /* list of precompiled pages */
+   const uint8_t *   et_data;    /* EFS file data, the lookup key */
+   int               et_nsegs;   /* entries in et_segs[] */
+   em_seg *          et_segs;
+} em_tmpl;
+
+extern   em_tmpl *   em_gettmpl(EOFILE * eofile);
+extern   const char * em_etag(EOFILE * eofile, int binary);
+extern   int         em_callfn(wi_sess * sess, PSVRFN function);
+
+/* The route table, see webroute.c. Each path of the EFS images and the
+ * SSI and CGI tables maps to one of these.
+ */
+#define  EM_RT_EFS      1     /* file in an EFS image */
+#define  EM_RT_SSI      2     /* SSI routine */
+#define  EM_RT_CGI      3     /* CGI routine */
+
+typedef struct em_route_s
+{
+   int            er_type;       /* EM_RT_ value */
+   const char *   er_pattern;    /* path, with {name} parameters for CGI */
+   void *         er_efs;        /* EM_RT_EFS image */
+   EFS            er_file;       /* EM_RT_EFS file */
+   PSVRFN         er_function;   /* EM_RT_SSI and EM_RT_CGI routine */
+} em_route;
+
+typedef struct em_routes_s em_routes;
+
+extern   int         em_routeinit(void);
+extern   int         em_routeadd(em_routes * routes, const char * pattern,
+                        int type, PSVRFN function);
+extern   int         em_routefind(const char * path, em_route * route,
+                        char * args, int argsize);
+extern   const char * em_routearg(EOFILE * eofile, const char * name);
+
+extern   int         em_mount(void * image, u_long size);
+extern   int         em_imagebusy(const void * image, u_long size);
+/* -- REE/EDC */
+
 #endif  /* USE_EMFILES */
 
 
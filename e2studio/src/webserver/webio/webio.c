@@ -46,6 +46,7 @@
 #include "webio.h"
 #include "webfs.h"
 #include "webCGI.h"
+#include "strstri.h"
 
 #include "board_cfg.h"
 
@@ -68,7 +69,6 @@
 
 /* The web server "listen" socket */
 socktype wi_listen;
-socktype wi_highsocket;
 
 /* Port number on which to listen. May be changed prior to calling webinit */
 int   httpport = 80;
@@ -79,6 +79,17 @@ char * wi_rootfile = "index.html";  /* File name to substitute for "/" */
 /* Flag to permit connections by the localhost only (security). */
 int   wi_localhost;
 
+/* Flag to permit HTTP/1.1 persistent connections. Clear it to close the
+ * connection after every reply, e.g. to compare load test results.
+ */
+int   wi_persist = TRUE;
+
+/* Flag to permit chunked replies to HTTP/1.1 clients, so dynamic pages
+ * are sent as they are built instead of being buffered whole to get
+ * their Content-Length.
+ */
+int   wi_chunked = TRUE;
+
 #ifdef WI_THREAD
 /* ++ REE/EDC */
 TickType_t   wi_seltmo = portMAX_DELAY; /* on thread, block is OK */
@@ -91,8 +102,84 @@ void wi_set_language( wi_sess * sess );
 void wi_badform(wi_sess * sess, char * errmsg);
 
 uint32_t fi = 1;
-SocketSet_t sel_recv = NULL;
-SocketSet_t sel_send = NULL;
+
+/* The worker tasks. Each worker has a socket set of its sessions'
+ * sockets; worker 0's set also has the listen socket. A session's select
+ * bits are only changed, by wi_selupdate(), when the session needs
+ * something different from its socket.
+ */
+wi_worker   wi_workers[WI_WORKERS];
+
+#if WI_WORKERS > 1
+SemaphoreHandle_t wi_mutex;
+#endif
+
+/* wi_selupdate()
+ *
+ * Set the select bits of a session's socket to bits, changing the socket
+ * set only for the bits that differ from the current ones.
+ */
+
+void
+wi_selupdate(wi_sess * sess, EventBits_t bits)
+{
+   EventBits_t    clr = sess->ws_selbits & ~bits;
+   EventBits_t    set = bits & ~sess->ws_selbits;
+
+   if(clr)
+      FreeRTOS_FD_CLR(sess->ws_socket, sess->ws_worker->ww_sockset, clr);
+   if(set)
+      FreeRTOS_FD_SET(sess->ws_socket, sess->ws_worker->ww_sockset, set);
+   sess->ws_selbits = bits;
+}
+
+/* wi_sockclose()
+ *
+ * Take a session's socket out of the socket set and close it.
+ */
+
+void
+wi_sockclose(wi_sess * sess)
+{
+   wi_selupdate(sess, 0);
+   closesocket(sess->ws_socket);
+   sess->ws_socket = (socktype)INVALID_SOCKET;
+}
+
+/* wi_selbits() - select bits for what a session is waiting for in its
+ * current state. Sessions in other states don't need their socket.
+ */
+
+static EventBits_t
+wi_selbits(wi_sess * sess)
+{
+   if((sess->ws_state == WI_HEADER) || (sess->ws_state == WI_POSTRX))
+      return (eSELECT_READ | eSELECT_EXCEPT);
+   if((sess->ws_state == WI_SENDDATA) &&
+      (sess->ws_txbufs || (sess->ws_flags & WF_BINARY)))
+      return (eSELECT_WRITE | eSELECT_EXCEPT);
+   if(sess->ws_state == WI_WEBSOCK)
+      return (eSELECT_READ | eSELECT_EXCEPT);
+   return eSELECT_EXCEPT;
+}
+
+/* ++ REE/EDC */
+/* wi_readfailed()
+ *
+ * End a session whose reply could not be read or built. If it was for
+ * want of a txbuf or file and none of the reply has gone, the client is
+ * told to try again later; the reply can't be finished, as what was
+ * being built is lost.
+ */
+
+static void
+wi_readfailed(wi_sess * sess, int error)
+{
+   if((error == WIE_MEMORY) && !(sess->ws_flags & WF_HEADERSENT))
+      wi_senderr(sess, 503);
+   sess->ws_state = WI_ENDING;
+}
+/* -- REE/EDC */
 
 /* webinit()
  *
@@ -110,13 +197,53 @@ wi_init()
     struct freertos_sockaddr   wi_sin;
     static const TickType_t xReceiveTimeOut = portMAX_DELAY;
     WinProperties_t xWinProps;
+    wi_worker * worker;
+    int   error;
+
+    /* The lock comes first, everything below may take it */
+#if WI_WORKERS > 1
+    if(wi_mutex == NULL)
+    {
+        wi_mutex = xSemaphoreCreateMutex();
+        if(wi_mutex == NULL)
+           return WIE_MEMORY;
+    }
+#endif
+
+    /* Reserve the fixed size object pools */
+    error = wi_poolinit();
+    if(error)
+       return error;
 
-    if(sel_recv == NULL)
+#ifdef WI_TIMING
+    wi_cycleinit();
+#endif
+
+    for(worker = wi_workers; worker < &wi_workers[WI_WORKERS]; worker++)
     {
-        sel_recv = FreeRTOS_CreateSocketSet();
-        sel_send = FreeRTOS_CreateSocketSet();
+        if(worker->ww_sockset == NULL)
+        {
+            worker->ww_sockset = FreeRTOS_CreateSocketSet();
+            if(worker->ww_sockset == NULL)
+               return WIE_MEMORY;
+        }
+#if WI_WORKERS > 1
+        if((worker != wi_workers) && (worker->ww_newsess == NULL))
+        {
+            worker->ww_newsess = xQueueCreate(WI_MAXSESS, sizeof(wi_sess *));
+            if(worker->ww_newsess == NULL)
+               return WIE_MEMORY;
+        }
+#endif
     }
 
+#ifdef USE_EMFILES
+    /* Route table of the EFS images and the SSI and CGI routines. Without
+     * it, em_fopen() searches them in turn.
+     */
+    em_routeinit();
+#endif
+
     /* Attempt to open the socket. */
     wi_listen = FreeRTOS_socket( FREERTOS_AF_INET,
                                         FREERTOS_SOCK_STREAM,  /* SOCK_STREAM for TCP. */
@@ -160,8 +287,8 @@ wi_init()
     FreeRTOS_setsockopt (wi_listen, 0, FREERTOS_SO_WIN_PROPERTIES, (void*) &xWinProps, sizeof(xWinProps));
 
 
-    /* Set the listening port to 80. */
-    wi_sin.sin_port = ( uint16_t ) 80;
+    /* Set the listening port, 80 unless wsStart() was given another */
+    wi_sin.sin_port = ( uint16_t ) httpport;
     wi_sin.sin_port = FreeRTOS_htons( wi_sin.sin_port );
 
     /* Bind the socket to the port that the client RTOS task will send to. */
@@ -171,6 +298,9 @@ wi_init()
     The maximum number of simultaneous connections is limited to 20. */
     FreeRTOS_listen( wi_listen, 15 );
 
+    /* The listen socket stays in worker 0's socket set for good */
+    FreeRTOS_FD_SET(wi_listen, wi_workers[0].ww_sockset, eSELECT_READ);
+
 //    TURN_GREEN_OFF;
 
     wi_running = TRUE;
@@ -188,79 +318,88 @@ wi_init()
 
 uint32_t trace_io = 0;
 
-static void cleanup( SocketSet_t * p_sel_recv,  SocketSet_t * p_sel_send)
-{
-/*
-    FreeRTOS_DeleteSocketSet(*p_sel_recv);
-    FreeRTOS_DeleteSocketSet(*p_sel_send);
-
-    *p_sel_recv = NULL;
-    *p_sel_send = NULL;
-*/
-}
-
-int wi_poll()
+int wi_poll(wi_worker * worker)
 {
    wi_sess * sess;
    wi_sess * next_sess;
-   BaseType_t   sessions = FREERTOS_INVALID_SOCKET;
+   BaseType_t   sessions = 0;
 
-   int   recvs;
-   int   sends;
    int   error = 0;
    char * data;
+   TickType_t  seltmo = wi_seltmo;
+   TickType_t  tmo;
+   u_long      now = cticks();
+   long        idle;
 
-/* add listen sock to select list */
-   FreeRTOS_FD_SET(wi_listen, sel_recv, eSELECT_READ);
-
-   wi_highsocket = wi_listen;
+   /* Take on the sessions worker 0 has accepted for this worker */
+   if(worker->ww_newsess)
+   {
+      while(xQueueReceive(worker->ww_newsess, &sess, 0) == pdPASS)
+         wi_linksess(worker, sess);
+   }
 
-   /* loop through list of open sessions looking for work */
-   recvs = sends = 0;
-   for(sess = wi_sessions; sess; sess = sess->ws_next)
+   /* Bring the select bits of each session up to date, and see whether
+    * any session can go on without waiting for its socket.
+    */
+   for(sess = worker->ww_sessions; sess; sess = sess->ws_next)
    {
       if(sess->ws_socket == FREERTOS_INVALID_SOCKET)
+      {
+         seltmo = 0;
          continue;
+      }
+      wi_selupdate(sess, wi_selbits(sess));
 
-      /* If socket is reading, load for a select */
-      if(sess->ws_state == WI_HEADER)
+      /* Server push and WebSocket sessions wake up to poll their
+       * push routine.
+       */
+      if(((sess->ws_state == WI_SENDDATA) && (sess->ws_flags & WF_SVRPUSH)) ||
+         (sess->ws_state == WI_WEBSOCK))
       {
-         recvs++;
-         FreeRTOS_FD_SET(sess->ws_socket, sel_recv, eSELECT_READ);
-
-         if(sess->ws_socket > wi_highsocket)
-             wi_highsocket = sess->ws_socket;
+         idle = (long)(sess->ws_pushnext - now);
+         tmo = (idle > 0) ? pdMS_TO_TICKS(((u_long)idle * 1000) / TPS) : 0;
+         if(tmo < seltmo)
+            seltmo = tmo;
       }
 
-      if((sess->ws_txbufs) ||
-         (sess->ws_flags & WF_BINARY))
+      /* Pipelined request left in rxbuf by the last reply on a
+       * persistent connection - don't wait for more input.
+       */
+      if(((sess->ws_state == WI_HEADER) &&
+          (sess->ws_rxsize > sess->ws_hdrscan)) ||
+         (sess->ws_state == WI_CONTENT) ||
+         (sess->ws_state == WI_ENDING))
       {
-         sends++;
-         FreeRTOS_FD_SET(sess->ws_socket, sel_send, eSELECT_WRITE);
-
-         if(sess->ws_socket > wi_highsocket)
-             wi_highsocket = sess->ws_socket;
+         seltmo = 0;
+         continue;
       }
    }
 
-   wi_highsocket++;
+   /* Block no longer than until the first idle timeout is due */
+   idle = wi_nextidle(worker, now);
+   if(idle >= 0)
+   {
+      tmo = pdMS_TO_TICKS(((u_long)idle * 1000) / TPS);
+      if(tmo < seltmo)
+         seltmo = tmo;
+   }
 
-   /* See if any of the sockets have input or ready to send */
-//   sessions = FreeRTOS_select( wi_highsocket->pxSocketSet, wi_seltmo);
-   sessions = FreeRTOS_select( sel_recv, wi_seltmo  );
+   /* Wait for a socket to become readable or writable, or for a timeout */
+   sessions = FreeRTOS_select( worker->ww_sockset, seltmo );
 
-   if(sessions == FREERTOS_INVALID_SOCKET)
+   /* Negative is an error, zero a timeout */
+   if(sessions < 0)
    {
       error = errno;
       /* ++ REE/EDC */
       TRACE(("select error %d\n", error ));
       /* -- REE/EDC */
-      cleanup( &sel_recv, &sel_recv);
       return WIE_SOCKET;
    }
 
    /* see if we have a new connection request */
-   if(FreeRTOS_FD_ISSET(wi_listen, sel_recv))
+   if((worker == wi_workers) &&
+      (FreeRTOS_FD_ISSET(wi_listen, worker->ww_sockset) & eSELECT_READ))
    {
       error = wi_sockaccept();
 
@@ -269,12 +408,11 @@ int wi_poll()
          /* ++ REE/EDC */
          TRACE(("Socket accept error %d\n", error ));
          /* -- REE/EDC */
-         cleanup( &sel_recv, &sel_recv);
          return error;
       }
    }
 
-   sess = wi_sessions;
+   sess = worker->ww_sessions;
 
    while(sess)
    {
@@ -286,16 +424,22 @@ another_state:
       {
       case WI_HEADER:
          /* See if there is data to read */
-         if(FreeRTOS_FD_ISSET(sess->ws_socket, sel_recv))
+         if(FreeRTOS_FD_ISSET(sess->ws_socket, worker->ww_sockset) &
+            (eSELECT_READ | eSELECT_EXCEPT))
          {
+             /* Don't block: the select bits are left over from the last
+              * request if a persistent session has just come back here.
+              * Keep the last byte of the buffer for a null terminator.
+              */
              error = recv(sess->ws_socket,
                sess->ws_rxbuf + sess->ws_rxsize,
-               sizeof(sess->ws_rxbuf) - sess->ws_rxsize, 0);
+               sizeof(sess->ws_rxbuf) - sess->ws_rxsize - 1,
+               FREERTOS_MSG_DONTWAIT);
 
             /* ++ REE/EDC */
             /* Just to irritate engineering, lwIP returns 0 when some
                errors occur. Nice */
-            if(error <= 0)
+            if((error < 0) || ((error == 0) && (sess->ws_reqcount == 0)))
             /* -- REE/EDC */
             {
                //FreeRTOS_FD_CLR(sess->ws_socket, sel_recv, eSELECT_READ);
@@ -303,11 +447,13 @@ another_state:
                error = errno;
                /* ++ REE/EDC */
                TRACE(("sock recv error %d\n", error ));
+               /* -- REE/EDC */
+               /* Clients close idle persistent connections all the
+                * time, so this is not a server error.
+                */
                wi_delsess(sess);
                sess = next_sess;
-               /* -- REE/EDC */
-               cleanup( &sel_recv, &sel_recv);
-               return WIE_SOCKET;
+               continue;
             }
             /* ++ REE/EDC */
             #ifdef _TRACE_REQUEST_
@@ -319,12 +465,17 @@ another_state:
             /* -- REE/EDC */
             sess->ws_rxsize += error;
             /* ++ REE/EDC */
-            sess->ws_last = cticks();
+            wi_touch(sess);
             /* -- REE/EDC */
          }
          if(sess->ws_rxsize)  /* unprocessed input http */
          {
+            WI_TIMESTART(sess);
             error = wi_parseheader( sess );  /* Make a best effort to process input */
+            /* ++ REE/EDC */
+            if(error && (sess->ws_state == WI_CONTENT))
+               wi_readfailed(sess, error);   /* in its first wi_readfile() */
+            /* -- REE/EDC */
             sessions++;
          }
          /* If the logic above pushed session into POSTRX (waiting for POST
@@ -344,13 +495,21 @@ another_state:
          wi_file *   filst = sess->ws_filelist;
          EOFILE * eofile = (EOFILE*)filst->wf_fd;
          _Bool  eo_file_read = false;
+         error = 0;
          /* If there is space in the receive buffer */
          if (sizeof(sess->ws_rxbuf) - sess->ws_rxsize)
          {
-             /* See if there is more to read */
-             error = recv(sess->ws_socket,
-                sess->ws_rxbuf + sess->ws_rxsize,
-                sizeof(sess->ws_rxbuf) - sess->ws_rxsize, 0);
+             /* See if there is more to read. Don't block, all the
+              * body may have come in with the header.
+              */
+             if(FreeRTOS_FD_ISSET(sess->ws_socket, worker->ww_sockset) &
+                (eSELECT_READ | eSELECT_EXCEPT))
+             {
+                error = recv(sess->ws_socket,
+                   sess->ws_rxbuf + sess->ws_rxsize,
+                   sizeof(sess->ws_rxbuf) - sess->ws_rxsize,
+                   FREERTOS_MSG_DONTWAIT);
+             }
          }
          /* If there is an emulated file function */
          else if ((filst) && (eofile->eo_function))
@@ -358,6 +517,10 @@ another_state:
             /* Let the emulated file function deal with the rest of the data */
             error = 0;
             eo_file_read = true;
+            /* The rest of the body is never read into rxbuf, so we
+             * can't find where a following request would start.
+             */
+            sess->ws_flags &= ~WF_PERSIST;
          }
 
          if(error < 0)
@@ -370,13 +533,14 @@ another_state:
                /* ++ REE/EDC */
                TRACE(("sock recv error %d\n", error ));
                /* -- REE/EDC */
-               cleanup( &sel_recv, &sel_recv);
-               return WIE_SOCKET;
+               wi_delsess(sess);
+               sess = next_sess;
+               continue;
             }
          }
          sess->ws_rxsize += error;
          /* ++ REE/EDC */
-         sess->ws_last = cticks();
+         wi_touch(sess);
          /* -- REE/EDC */
 
          /* If we have all the content, parse the name/value pairs.
@@ -406,8 +570,10 @@ another_state:
                }
                sess->ws_state = WI_CONTENT;
                /* ++ REE/EDC */
-               sess->ws_last = cticks();
+               wi_touch(sess);
                /* -- REE/EDC */
+               /* Time waiting for the body counts with the header */
+               WI_TIMEMARK(sess, WI_PH_HEADER);
             }
          }
          if(sess->ws_state != WI_POSTRX)
@@ -420,14 +586,9 @@ another_state:
       case WI_CONTENT:
          error = wi_readfile(sess);
 
-         if(FreeRTOS_FD_ISSET(sess->ws_socket, sel_recv))
-         {
-             FreeRTOS_FD_CLR(sess->ws_socket, sel_recv, eSELECT_READ);
-         }
-
          if(error)
          {
-            sess->ws_state = WI_ENDING;
+            wi_readfailed(sess, error);
          }
          sessions++;
          if(sess->ws_state != WI_CONTENT)
@@ -439,7 +600,8 @@ another_state:
          /* ++ REE/EDC */
          if(sess->ws_txbufs || (sess->ws_flags & WF_BINARY))
          {
-            if(FreeRTOS_FD_ISSET(sess->ws_socket, sel_recv))
+            if(FreeRTOS_FD_ISSET(sess->ws_socket, worker->ww_sockset) &
+               (eSELECT_WRITE | eSELECT_EXCEPT))
             {
                 error = wi_sockwrite(sess);
 
@@ -447,18 +609,43 @@ another_state:
                 {
                    sess->ws_state = WI_ENDING;
                 }
-
-                FreeRTOS_FD_CLR(sess->ws_socket, sel_send, eSELECT_WRITE);
             }
-            sess->ws_last = cticks();
+            wi_touch(sess);
             sessions++;
          }
+         else if(sess->ws_flags & WF_SVRPUSH)
+         {
+            /* Client gone, or time to poll for an update */
+            if(FreeRTOS_FD_ISSET(sess->ws_socket, worker->ww_sockset) &
+               eSELECT_EXCEPT)
+            {
+               sess->ws_state = WI_ENDING;
+            }
+            else if(wi_push(sess))
+               sess->ws_state = WI_ENDING;
+         }
          if(sess->ws_state != WI_SENDDATA)
             goto another_state;
          break;
+      case WI_WEBSOCK:
+         /* Frames from the client, then updates from the endpoint */
+         error = 0;
+         if(FreeRTOS_FD_ISSET(sess->ws_socket, worker->ww_sockset) &
+            (eSELECT_READ | eSELECT_EXCEPT))
+         {
+            error = wi_wsread(sess);
+         }
+         if(!error)
+            error = wi_wspush(sess);
+         if(error)
+            sess->ws_state = WI_ENDING;
+         sessions++;
+         if(sess->ws_state != WI_WEBSOCK)
+            goto another_state;
+         break;
       case WI_ENDING:
          /* Don't delete session and break, else we'll get a fault
-          * in the sess->ws_last test below.
+          * in the idle class test below.
           */
 
          wi_delsess(sess);
@@ -468,42 +655,43 @@ another_state:
          dtrap();
          break;
       }
-      /* kill sessions with no recent activity */
-      if((u_long)(sess->ws_last + (150 * TPS)) < cticks())
-       {
-         wi_delsess(sess);
-      }
+      /* Moving to a state with a different idle timeout restarts the
+       * idle timer under the new one.
+       */
+      if(wi_tmoclass(sess) != sess->ws_tmoclass)
+         wi_touch(sess);
 
       sess = next_sess;
    }
 
-   cleanup( &sel_recv, &sel_recv);
+   /* kill sessions with no recent activity. */
+   wi_expire(worker, cticks());
+
    return sessions;
 }
 
 #ifdef WI_THREAD
 
 /* wi_thread() - entry point for driving webio froma single thread.  It
- * is essentially an infinite loop while drives wi_poll.
+ * is essentially an infinite loop while drives wi_poll. Each worker task
+ * runs one, for its own worker.
  *
  * This should never return unless the web server is shut down.
  *
  * Returns: 0 if normal shutdown, else negative error code.
  */
 
-int   wi_thread()
+int   wi_thread(wi_worker * worker)
 {
    int   sessions = 0;
 
    while(wi_running)
    {
-      sessions = wi_poll();
+      sessions = wi_poll(worker);
       if( sessions < 0 )
       {
          dtrap();    /* restart the server thread?? */
       }
-
-      vTaskDelay(1UL);
    }
 
    return sessions;
@@ -517,8 +705,10 @@ int
 wi_sockaccept()
 {
    struct freertos_sockaddr sa;
-   socktype    newsock = -1;
+   socktype    newsock;
    wi_sess *   newsess;
+   wi_worker * worker;
+   wi_worker * target;
    socklen_t   sasize;
    int         error = 0;
 
@@ -526,7 +716,7 @@ wi_sockaccept()
    newsock = FreeRTOS_accept(wi_listen, &sa, &sasize);
 
    /* ++ REE/EDC */
-   if((int32_t)newsock >= 0)
+   if((newsock != NULL) && (newsock != FREERTOS_INVALID_SOCKET))
    {
    /* -- REE/EDC */
       if(sasize != sizeof(struct freertos_sockaddr))
@@ -587,12 +777,46 @@ wi_sockaccept()
        */
       newsess = wi_newsess();
       if(!newsess)
-         return WIE_MEMORY;
+      {
+         /* Session pool is full - refuse the connection. This is
+          * counted in wi_sesspool.wp_fails, it's not a server error.
+          */
+         closesocket(newsock);
+         return 0;
+      }
 
- //     newsock->pxSocketSet = FreeRTOS_CreateSocketSet();
+      /* Give the session to the worker with the fewest sessions. The
+       * other workers count the sessions they release as this runs.
+       */
+      target = wi_workers;
+      WI_LOCK();
+      for(worker = wi_workers; worker < &wi_workers[WI_WORKERS]; worker++)
+      {
+         if((worker->ww_assigned - worker->ww_released) <
+            (target->ww_assigned - target->ww_released))
+         {
+            target = worker;
+         }
+      }
+      target->ww_assigned++;
+      WI_UNLOCK();
 
       newsess->ws_socket = newsock;
       newsess->ws_client_ip = sa;
+      newsess->ws_worker = target;
+
+      /* Put the socket in the worker's set before the worker can see the
+       * session. FD_SET has the IP task check the set, which wakes the
+       * worker's select once the request arrives.
+       */
+      wi_selupdate(newsess, (eSELECT_READ | eSELECT_EXCEPT));
+      if(target == wi_workers)
+         wi_linksess(target, newsess);
+      else if(xQueueSend(target->ww_newsess, &newsess, 0) != pdPASS)
+      {
+         dtrap();    /* queue holds WI_MAXSESS, can't be full */
+         wi_delsess(newsess);
+      }
       return 0;
    /* ++ REE/EDC */
    }
@@ -657,18 +881,16 @@ void wi_set_language( wi_sess * sess )
         }
            /* TODO: Add any other supported languages in here */
    };
-const char * const pszLangKeyword = "Accept-Language:";
-/* look for the language keyword in the header */
-char *   search = strstr(sess->ws_rxbuf, pszLangKeyword);
+/* look for the language field in the header index */
+char *   search = wi_hdrvalue(sess, "Accept-Language");
     if(search)
    {
       char  languagelist[WI_LANG_BUFFER];
       int   index = 0;
-      search += strlen(pszLangKeyword);
       /* Copy the requested languages into the language list */
       while(index < (WI_LANG_BUFFER - 1))
       {
-         if(search[index] == '\r')
+         if(search[index] == 0)
          {
             languagelist[index] = 0;
             break;
@@ -722,36 +944,52 @@ wi_parseheader( wi_sess * sess )
 {
    char *   cp;
    char *   cl;
-   char *   rxend;
    char *   pairs;
+   char *   ver;
+   char *   conn;
+   char *   fname;
+   char     uri[WI_MAXURLSIZE];
    u_long   cmd;
    int      error;
 
-   /* First find end of HTTP header */
-   /* ++ REE/EDC */
-   rxend = strstr(sess->ws_rxbuf, "\r\n\r\n\0" );
-   /* \0 is required as a string terminator or an additional 0x3A is inserted.
-    * Suspect this is GNU compiler feature due to preceding char being high-ascii,
-    * which /sometimes/ makes strcpy fail.
-    */
-   /* -- REE/EDC */
+   /* Scan whatever arrived since the last call */
+   error = wi_scanheader(sess);
+   if(error < 0)
+   {
+      wi_senderr(sess, 400);  /* Bad request */
+      return error;
+   }
+   if(error == 0)
+   {
+      /* no header yet - wait some more, unless it can't fit */
+      if(sess->ws_rxsize >= (int)(sizeof(sess->ws_rxbuf) - 1))
+      {
+         wi_senderr(sess, 400);  /* Bad request */
+         return WIE_CLIENT;
+      }
+      return 0;
+   }
+   WI_TIMEMARK(sess, WI_PH_HEADER);
 
-   if(!rxend)
-      return 0;   /* no header yet - wait some more */
    /* ++ REE/EDC */
    /* check the request and set the language */
    wi_set_language(sess);
    /* -- REE/EDC */
-   sess->ws_data = rxend + 4;
+   sess->ws_data = &sess->ws_rxbuf[sess->ws_hdrlen];
 
    /* extract the basic http comand */
-   cmd = sess->ws_rxbuf[0];
-   cmd <<= 8;
-   cmd |= sess->ws_rxbuf[1];
-   cmd <<= 8;
-   cmd |= sess->ws_rxbuf[2];
-   cmd <<= 8;
-   cmd |= sess->ws_rxbuf[3];
+   cp = &sess->ws_rxbuf[sess->ws_method.ht_offset];
+   cmd = 0;
+   if(sess->ws_method.ht_len == 3 || sess->ws_method.ht_len == 4)
+   {
+      cmd = (u_char)cp[0];
+      cmd <<= 8;
+      cmd |= (u_char)cp[1];
+      cmd <<= 8;
+      cmd |= (u_char)cp[2];
+      cmd <<= 8;
+      cmd |= (u_char)cp[3];
+   }
 
    switch(cmd)
    {
@@ -773,29 +1011,39 @@ wi_parseheader( wi_sess * sess )
    }
 
 
-   /* Fall to here for GET or POST. Extract the URL */
-   cp = wi_nextarg(&sess->ws_rxbuf[3]);
-   if(!cp)
-   {
-      wi_senderr(sess, 400);  /* Bad request */
-      return WIE_CLIENT;
-   }
+   /* Fall to here for GET or POST. The URL is null terminated by the scan */
+   cp = &sess->ws_rxbuf[sess->ws_urltok.ht_offset];
    if(*cp == '/')
-   {
-      if(*(cp+1) == ' ')
-         sess->ws_uri = wi_rootfile;
-      else
-         sess->ws_uri = cp+1;    /* strip leading slash */
-   }
+      sess->ws_uri = cp+1;    /* strip leading slash */
    else
       sess->ws_uri = cp;
+   ver = &sess->ws_rxbuf[sess->ws_version.ht_offset];
+
+   /* HTTP/1.1 connections persist unless the client asks to close,
+    * HTTP/1.0 ones only if the client asks for keep-alive.
+    */
+   sess->ws_flags &= ~WF_PERSIST;
+   if(wi_persist && (sess->ws_reqcount < (WI_PERSISTMAX - 1)))
+   {
+      conn = wi_hdrvalue(sess, "Connection");
+      if(strcmp(ver, "HTTP/1.1") == 0)
+      {
+         if((conn == NULL) || (strnicmp(conn, "close", 5) != 0))
+            sess->ws_flags |= WF_PERSIST;
+      }
+      else if(conn && (strnicmp(conn, "keep-alive", 10) == 0))
+         sess->ws_flags |= WF_PERSIST;
+   }
+
+   if(wi_chunked && (strcmp(ver, "HTTP/1.1") == 0))
+      sess->ws_flags |= WF_CHUNKOK;
 
    /* Extract other useful fields from header  */
-   sess->ws_auth = wi_getline("Authorization:", cp);
-   sess->ws_referer = wi_getline("Referer:", cp);
-   sess->ws_host = wi_getline("Host:", cp);
+   sess->ws_auth = wi_hdrvalue(sess, "Authorization");
+   sess->ws_referer = wi_hdrvalue(sess, "Referer");
+   sess->ws_host = wi_hdrvalue(sess, "Host");
 
-   cl = wi_getline("Content-Length:", cp);
+   cl = wi_hdrvalue(sess, "Content-Length");
    if(cl)
       sess->ws_contentLength = atoi(cl);
    else
@@ -826,41 +1074,45 @@ wi_parseheader( wi_sess * sess )
       /* fall to header parse logic, get name/values from body later */
    }
 
-   /* insert the null terminators in any strings in the rxbuf */
-   if((sess->ws_uri > sess->ws_rxbuf) && (sess->ws_uri < rxend))
-      wi_argterm(sess->ws_uri);      /* Null terminate the URI */
-   if((sess->ws_auth > sess->ws_rxbuf) && (sess->ws_auth < rxend))
-      wi_argterm(sess->ws_auth);     /* etc */
-   if((sess->ws_referer > sess->ws_rxbuf) && (sess->ws_referer < rxend))
-      wi_argterm(sess->ws_referer);
-   if((sess->ws_uri > sess->ws_host) && (sess->ws_host < rxend))
-      wi_argterm(sess->ws_host);
+   if(*sess->ws_uri == 0)
+      sess->ws_uri = wi_rootfile;
+
+   /* WebSocket handshake? */
+   if(cmd == H_GET)
+   {
+      error = wi_wsupgrade(sess);
+      if(error)
+         return (error > 0) ? 0 : error;
+   }
+
+   WI_TIMEMARK(sess, WI_PH_PARSE);
 
    /* ++ REE/EDC */
    /* Find and open file to return, */
    cgiDecodeString(sess->ws_uri);
+   fname = sess->ws_uri;
    /* Modify the file path if a supported lang ID is found */
    if((sess->ws_language)
    /* Only html files currently have multi-lingual support */
    &&(strstri(sess->ws_uri, ".html")))
    {
-      char uri[WI_MAXURLSIZE];
       /* The html files are expected to only be in the root folder
          of the website. Append the language folder name for the
          supported language */
       strcpy(uri, sess->ws_html_folder);
       strcat(uri, sess->ws_uri);
-      error = wi_fopen(sess, uri, "r");
+      fname = uri;
    }
-   else
-   {
+   error = wi_fopen(sess, fname, "r");
 
-       error = wi_fopen(sess, sess->ws_uri, "r");
-   }
+   /* Assets may be stored only in compressed form */
+   if(error == WIE_NOFILE)
+      error = wi_fopengz(sess, fname);
    /* -- REE/EDC */
    if(error)
    {
-      wi_senderr(sess, 404);  /* File not found */
+      /* File not found, or no descriptor free to open it with */
+      wi_senderr(sess, (error == WIE_MEMORY) ? 503 : 404);
       return error;
    }
 
@@ -905,19 +1157,51 @@ wi_parseheader( wi_sess * sess )
     * requiring server parsing. If not, mark it as binary. This
     * will allow faster sending of images and other large binaries.
     */
+/* ++ REE/EDC */
+#ifdef USE_EMFILES
+   /* A routine routed from a path with no extension, e.g. "api/led/2",
+    * writes its reply as a CGI routine does, so it is text. The routine
+    * may set ws_ftype to its own type.
+    */
+   if(!wi_setftype(sess) && (sess->ws_filelist->wf_routines == &emfs) &&
+      ((EOFILE*)sess->ws_filelist->wf_fd)->eo_function)
+   {
+      sess->ws_flags &= ~WF_BINARY;
+      sess->ws_ftype = "text/html";
+   }
+#else
    wi_setftype(sess);
+#endif
+/* -- REE/EDC */
 
    sess->ws_flags &= ~WF_HEADERSENT;   /* header not sent yet */
 
    if(cmd == H_GET)
    {
+      /* Send the compressed copy of a static file if the client can
+       * take it.
+       */
+      wi_gzvariant(sess, fname);
+
+      /* Static file the client already has? */
+      if(wi_notmodified(sess))
+         return 0;
+
+      /* Only binary files are sent as is, so can be sent in part */
+      if(sess->ws_flags & WF_BINARY)
+         wi_parserange(sess);
+
       /* start loading file to return. */
+      WI_TIMECLASS(sess);
+      WI_TIMEMARK(sess, WI_PH_OPEN);
       sess->ws_state = WI_CONTENT;
       error = wi_readfile(sess);
       return error;
    }
    else  /* POST, wait for data */
    {
+      WI_TIMECLASS(sess);
+      WI_TIMEMARK(sess, WI_PH_OPEN);
       sess->ws_state = WI_POSTRX;
       return 0;
    }
@@ -947,10 +1231,205 @@ void wi_badform(wi_sess * sess, char * errmsg)
 }
 
 
+/* wi_ssifind()
+ *
+ * Find the start of an SSI directive in a block of text: a "<!--#"
+ * marker, or a '<' near the end of the block where the rest of the
+ * marker may be in the next read.
+ *
+ * Returns offset of the marker, or len if there is none.
+ */
+
+static int
+wi_ssifind(const char * text, int len)
+{
+   const char *   cp = text;
+   const char *   end = text + len;
+   size_t         tocmp;
+
+   while((cp = memchr(cp, '<', (size_t)(end - cp))) != NULL)
+   {
+      tocmp = (size_t)(end - cp);
+      if(tocmp > WI_SSIMARKLEN)
+         tocmp = WI_SSIMARKLEN;
+      if(memcmp(cp, WI_SSIMARK, tocmp) == 0)
+         return (int)(cp - text);
+      cp++;
+   }
+   return len;
+}
+
+/* wi_ssiscan()
+ *
+ * Copy the unprocessed text in a file's read buffer to the session's
+ * txbufs, handing any SSI directives in it to wi_ssi() or wi_exec().
+ * Text between directives is copied in whole runs. wf_data must be
+ * null terminated at wf_inbuf.
+ *
+ * If carry is set, a directive that is cut off by the end of the
+ * buffer is left at wf_nextbuf to be completed by the next read.
+ * Otherwise it is sent as plain text.
+ *
+ * Returns: negative WIE_ error code, 1 if an SSI changed the current
+ * file, else 0.
+ */
+
+static int
+wi_ssiscan(wi_sess * sess, wi_file * filst, int carry)
+{
+   char *   text = filst->wf_data;
+   char *   ssi_end;
+   int      pos = filst->wf_nextbuf;
+   int      ssi_len;
+   int      len;
+   int      error;
+   char     save;
+
+   while(pos < filst->wf_inbuf)
+   {
+      /* Copy the text up to the next directive */
+      len = wi_ssifind(&text[pos], filst->wf_inbuf - pos);
+      error = wi_txput(sess, &text[pos], len);
+      if(error)
+         return error;
+      pos += len;
+      if(pos >= filst->wf_inbuf)
+         break;
+
+      /* got complete SSI string? */
+      ssi_end = NULL;
+      if((filst->wf_inbuf - pos) > WI_SSIMARKLEN)
+         ssi_end = strstr(&text[pos + WI_SSIMARKLEN], "-->");
+      if(!ssi_end)
+      {
+         if(carry)
+            break;      /* rest of it should be in the next read */
+
+         /* Unterminated at end of file, or too long for wf_data */
+         error = wi_txput(sess, &text[pos], filst->wf_inbuf - pos);
+         if(error)
+            return error;
+         pos = filst->wf_inbuf;
+         break;
+      }
+      ssi_len = (ssi_end - &text[pos]) + 3;
+
+      /* Null terminate the directive while it is processed, so the
+       * SSI routines can't parse past it.
+       */
+      filst->wf_nextbuf = pos;      /* Set address of SSI text */
+      save = text[pos + ssi_len];
+      text[pos + ssi_len] = 0;
+
+      if(strncmp( &text[pos], "<!--#include", 12) == 0)
+      {
+         /* Call routine to process SSI string in file */
+         wi_ssi(sess);
+      }
+      else if(strncmp( &text[pos], "<!--#exec ", 10) == 0)
+      {
+         /* Call routine to process SSI string in file */
+         wi_exec(sess);
+      }
+      text[pos + ssi_len] = save;
+
+      /* Save location where SSI ends */
+      pos += ssi_len;
+
+      /* return if SSI changed the current file. */
+      if(sess->ws_filelist != filst)
+      {
+         filst->wf_nextbuf = pos;
+         return 1;
+      }
+   }
+
+   filst->wf_nextbuf = pos;
+   return 0;
+}
+
+/* ++ REE/EDC */
+#if USE_EMFILES
+/* wi_tmplsend()
+ *
+ * Copy a precompiled EFS page to the session's txbufs. Included pages
+ * are walked in place, using the stack in the wi_file rather than a
+ * recursive wi_readfile() and another wi_file for each one.
+ *
+ * Returns: negative WIE_ error code, 1 if an SSI changed the current
+ * file, else 0 once the page is done.
+ */
+
+static int
+wi_tmplsend(wi_sess * sess, wi_file * filst)
+{
+   em_tmpl *   tmpl;
+   em_seg *    seg;
+   int         error;
+
+   while(filst->wf_depth > 0)
+   {
+      tmpl = filst->wf_tmpls[filst->wf_depth - 1];
+      if(filst->wf_segs[filst->wf_depth - 1] >= tmpl->et_nsegs)
+      {
+         filst->wf_depth--;      /* end of an included page */
+         continue;
+      }
+      seg = &tmpl->et_segs[filst->wf_segs[filst->wf_depth - 1]++];
+
+      switch(seg->es_type)
+      {
+      case EMS_TEXT:
+         error = wi_txput(sess, seg->es_text, seg->es_len);
+         if(error)
+            return error;
+         break;
+      case EMS_FILE:
+         if(filst->wf_depth < WI_SSIDEPTH)
+         {
+            filst->wf_tmpls[filst->wf_depth] = seg->es_tmpl;
+            filst->wf_segs[filst->wf_depth] = 0;
+            filst->wf_depth++;
+            break;
+         }
+         /* Nested too deep for the stack - take the wi_ssi() path */
+         /* fall through */
+      case EMS_SSI:
+         /* wi_ssi() parses the directive at wf_nextbuf */
+         memcpy(filst->wf_data, seg->es_text, (size_t)seg->es_len);
+         filst->wf_data[seg->es_len] = 0;
+         filst->wf_nextbuf = 0;
+         wi_ssi(sess);
+         if(sess->ws_filelist != filst)
+            return 1;
+         break;
+      case EMS_CODE:
+         em_callfn(sess, seg->es_function);
+         break;
+      case EMS_EXEC:
+         if(wi_execfunc)
+         {
+            memcpy(filst->wf_data, seg->es_text, (size_t)seg->es_len);
+            filst->wf_data[seg->es_len] = 0;
+            (*wi_execfunc)(sess, filst->wf_data);
+         }
+         break;
+      default:
+         dtrap();
+         break;
+      }
+   }
+
+   return 0;
+}
+#endif
+/* -- REE/EDC */
+
 /* wi_readfile()
  *
  * Read file from disk or script into txbufs. Allocate txbufs as we go
- * sess->ws_fd should have an open fd.
+ * sess->ws_fd should have an open fd. SSI directives which straddle two
+ * reads are moved to the front of wf_data and completed by the next.
  *
  * BE VERY CAREFULL if you decide to edit this logic. The core loop is
  * rather convoluted since it's handling file reads & closes,
@@ -995,29 +1474,69 @@ wi_readfile(struct wi_sess_s * sess)
              filst = sess->ws_filelist;    // re-set local variable
       }
    }
+
+   /* Text files in the EFS are sent from their precompiled page */
+   if((filst->wf_routines == &emfs) && ((sess->ws_flags & WF_BINARY) == 0))
+   {
+      if((filst->wf_depth == 0) &&
+         (((EOFILE*)filst->wf_fd)->eo_position == 0))
+      {
+         filst->wf_tmpls[0] = em_gettmpl((EOFILE*)filst->wf_fd);
+         if(filst->wf_tmpls[0])
+         {
+            filst->wf_segs[0] = 0;
+            filst->wf_depth = 1;
+         }
+      }
+      if(filst->wf_depth)
+      {
+         error = wi_tmplsend(sess, filst);
+         if(error < 0)
+            return error;
+         if(error > 0)
+            return 0;      /* SSI changed the current file */
+         goto readeof;
+      }
+   }
 #endif
+   /* Binary files the file system can map are sent from where they are
+    * by wi_movebinary(), reading them into wf_data would skip that part.
+    */
+   if((sess->ws_flags & WF_BINARY) && filst->wf_routines->wfs_fmap)
+      goto readdone;
 /* -- REE/EDC */
 readmore:
-   toread = sizeof(filst->wf_data) - filst->wf_inbuf;
-   /* ++ REE/EDC */
-   len = wi_fread( &filst->wf_data[filst->wf_inbuf], 1, (unsigned int)toread, filst );
-   /* -- REE/EDC */
-   if(len <= 0)
+   /* Move a directive left incomplete by the last read to the front */
+   if(filst->wf_nextbuf > 0)
    {
-      wi_fclose(filst);
+      filst->wf_inbuf -= filst->wf_nextbuf;
+      memmove(filst->wf_data, &filst->wf_data[filst->wf_nextbuf],
+         (size_t)filst->wf_inbuf);
+      filst->wf_nextbuf = 0;
+   }
 
-      /* See if there is another input file "outside" the current one.
-       * This happens if the file we just closed was an SSI
-       */
-      if(sess->ws_filelist)
-         return 0;
-      else
-         goto readdone;
+   toread = sizeof(filst->wf_data) - filst->wf_inbuf;
+   if((sess->ws_flags & WF_BINARY) == 0)
+      toread--;      /* leave room to null terminate text */
+   len = 0;
+   if(toread > 0)
+   {
+      /* ++ REE/EDC */
+      len = wi_fread( &filst->wf_data[filst->wf_inbuf], 1, (unsigned int)toread, filst );
+      /* -- REE/EDC */
+   }
+   if(len > 0)
+   {
+      /* ++ REE/EDC */
+      wi_touch(sess);
+      /* -- REE/EDC */
+      filst->wf_inbuf += len;
+   }
+   else if((toread > 0) &&
+      ((sess->ws_flags & WF_BINARY) || (filst->wf_inbuf == 0)))
+   {
+      goto readeof;
    }
-   /* ++ REE/EDC */
-   sess->ws_last = cticks();
-   /* -- REE/EDC */
-   filst->wf_inbuf += len;
 
    /* fast path for binary files. We've read first buffer from file
     * now - just jump to the sending code.
@@ -1025,74 +1544,32 @@ readmore:
    if(sess->ws_flags & WF_BINARY)
       goto readdone;
 
-   /* Copy the file into a send buffer while searching for SSI strings */
-   for(len = filst->wf_nextbuf; len < filst->wf_inbuf; len++)
-   {
-      if((filst->wf_data[len + 4] == '#') &&
-         (filst->wf_data[len + 1] == '!'))
-      {
-         char * ssi_end;
-
-         /* got complete SSI string? */
-         ssi_end = strstr( &filst->wf_data[len], "-->");
-
-         if(ssi_end)
-         {
-            int ssi_len = (ssi_end - &filst->wf_data[len]) + 3;
-
-            filst->wf_nextbuf = len;      /* Set address of SSI text */
-
-            if(strncmp( &filst->wf_data[len], "<!--#include", 12) == 0)
-            {
-               /* Call routine to process SSI string in file */
-               error = wi_ssi(sess);
-            }
-            else if(strncmp( &filst->wf_data[len], "<!--#exec ", 10) == 0)
-            {
-               /* Call routine to process SSI string in file */
-               error = wi_exec(sess);
-            }
-
-            /* Save location where SSI ends */
-            len += ssi_len;
+   /* Copy the text into send buffers, processing SSI directives. Only
+    * hold back an incomplete directive if more of the file may follow.
+    */
+   filst->wf_data[filst->wf_inbuf] = 0;
+   error = wi_ssiscan(sess, filst, (len > 0));
+   if(error < 0)
+      return error;
+   if(error > 0)
+      return 0;      /* SSI changed the current file */
 
-            /* break if SSI changed the current file. */
-            if(sess->ws_filelist != filst)
-            {
-               filst->wf_nextbuf = len;
-               return 0;
-            }
-            filst->wf_nextbuf = 0;  /* force jump to readmore */
-         }
-         else  /* end not found - SSI text may end in next block */
-         {
-            dtrap();
-         }
-      }
+   if((len > 0) || (toread <= 0))
+      goto readmore;
 
-      /* Make sure we have space for char in txbuf */
-      if((sess->ws_txbufs == NULL) ||
-         (sess->ws_txtail->tb_total >= WI_TXBUFSIZE))
-      {
-         if(wi_txalloc(sess) == NULL)
-         {
-            wsBreakPoint();
-            return WIE_MEMORY;
-         }
-      }
-      sess->ws_txtail->tb_data[sess->ws_txtail->tb_total++] = filst->wf_data[len];
-   }
+readeof:
+   wi_fclose(filst);
 
-   /* See if we need to do more reading */
-   if((filst->wf_nextbuf == 0) && (len > 0))
-   {
-      filst->wf_inbuf = 0;    /* no unread data in read buffer */
-      goto readmore;
-   }
+   /* See if there is another input file "outside" the current one.
+    * This happens if the file we just closed was an SSI
+    */
+   if(sess->ws_filelist)
+      return 0;
 
 readdone:
 
    /* Done with loading data, begin send process */
+   WI_TIMEMARK(sess, WI_PH_EXEC);
    sess->ws_state = WI_SENDDATA;
    error = wi_sockwrite(sess);
 
@@ -1107,8 +1584,6 @@ readdone:
  * Returns: 0 if no error, else negative WIE_ error code.
  */
 
-static char single_send_packet[WI_TXBUFSIZE];
-
 
 int
 wi_sockwrite(wi_sess * sess)
@@ -1119,10 +1594,13 @@ wi_sockwrite(wi_sess * sess)
    int      contentlen = 0;
    int      ctlof = 0;
 
+   /* Time since the last call was spent waiting for the socket */
+   WI_TIMEMARK(sess, WI_PH_QUEUE);
 
    if(sess->ws_flags & WF_BINARY)
    {
       error = wi_movebinary(sess, sess->ws_filelist);
+      WI_TIMEMARK(sess, WI_PH_SEND);
       return error;
    }
 
@@ -1137,6 +1615,17 @@ wi_sockwrite(wi_sess * sess)
          return WIE_SOCKET;
    }
 
+   /* Rest of a chunked reply, followed by the last (empty) chunk */
+   if(sess->ws_flags & WF_CHUNKED)
+   {
+      if(wi_txflush(sess) ||
+         (send(sess->ws_socket, "0\r\n\r\n", 5, 0) != 5))
+      {
+         return WIE_SOCKET;
+      }
+      return wi_txdone(sess);
+   }
+
    while(sess->ws_txbufs)
    {
       txbuf = sess->ws_txbufs;
@@ -1155,18 +1644,17 @@ wi_sockwrite(wi_sess * sess)
          if(error == EWOULDBLOCK)
          {
             txbuf->tb_done = 0;
+            WI_TIMEMARK(sess, WI_PH_SEND);
             return 0;
          }
          dtrap();
          return WIE_SOCKET;
       }
       /* Fall to here if we sent the whole txbuf. Unlink & free it */
-      sess->ws_txbufs = txbuf->tb_next;
-      txbuf->tb_next = NULL;
       wi_txfree(txbuf);
 
       /* ++ REE/EDC */
-      sess->ws_last = cticks();
+      wi_touch(sess);
       /* -- REE/EDC */
    }
 
@@ -1195,7 +1683,7 @@ wi_redirect(wi_sess * sess, char * filename)
    sess->ws_referer = sess->ws_uri;
    sess->ws_uri = filename;
    /* ++ REE/EDC */
-   sess->ws_last = cticks();
+   wi_touch(sess);
    /* -- REE/EDC */
 
    /* unlink the completed form file from the session */
@@ -1220,13 +1708,14 @@ wi_redirect(wi_sess * sess, char * filename)
    error = wi_fopen(sess, filename, "rb");
    if(error)
    {
-      wi_senderr(sess, 404);  /* File not found */
+      /* File not found, or no descriptor free to open it with */
+      wi_senderr(sess, (error == WIE_MEMORY) ? 503 : 404);
       return error;
    }
 
    sess->ws_state = WI_CONTENT;
    sess->ws_cmd = H_GET;
-   sess->ws_last = cticks();
+   wi_touch(sess);
    sess->ws_flags &= ~WF_HEADERSENT;
 
    return 0;   /* OK return */
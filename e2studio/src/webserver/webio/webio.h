@@ -37,6 +37,24 @@ struct wi_sess_s;    /* predecl */
 /* Port number on which to listen. May be changed prior to calling webinit */
 extern   int   httpport;
 
+/* Non-zero to allow persistent (keep-alive) connections */
+extern   int   wi_persist;
+
+/* Non-zero to allow chunked replies to HTTP/1.1 clients */
+extern   int   wi_chunked;
+
+/* Cache-Control policy for static files, by MIME type. The first entry
+ * whose wc_type starts the file's type is used. A negative max-age has
+ * the client check with the server before each use of its copy.
+ */
+typedef struct wi_cachepolicy_s
+{
+   const char *   wc_type;
+   long           wc_maxage;     /* seconds */
+} wi_cachepolicy;
+
+extern   wi_cachepolicy wi_cachepolicies[];
+
 typedef enum httpcmd {
    H_INITIAL = 0,
    H_GET = 0x47455420,
@@ -49,7 +67,8 @@ typedef enum httpcmd {
 /* Data to send is held in a list of txbuf structures */
 typedef struct txbuf_s
 {
-   struct txbuf_s * tb_next;           /* list link */
+   struct txbuf_s * tb_next;           /* list links */
+   struct txbuf_s * tb_prev;
    struct   wi_sess_s * tb_session;    /* backpointer to session */
    int      tb_total;                  /* Size of data in tb_data */
    int      tb_done;                   /* amount of tb_data already sent */
@@ -66,6 +85,7 @@ typedef struct txbuf_s
  */
 
 struct wi_file_s;    /* predecl */
+struct em_open_s;    /* predecl */
 
 typedef long   wi_sec;     /* A number of seconds, for timeouts */
 
@@ -75,8 +95,41 @@ typedef enum wistates {
    WI_POSTRX,        /* waiting for POST name value pairs */
    WI_CONTENT,       /* reading file from disk or script */
    WI_SENDDATA,      /* Sending file/data into socket */
+   WI_WEBSOCK,       /* Exchanging WebSocket frames */
    WI_ENDING         /* Sessions done,cleaning up for deletion */
 } wistate;
+
+/* Idle timeout classes. Every session is on the idle list of its class,
+ * and all sessions of a class share one timeout, so each list is in
+ * order of expiry.
+ */
+typedef enum witmoclasses {
+   WI_TMO_HEADER,    /* waiting for a request header */
+   WI_TMO_PERSIST,   /* persistent connection between requests */
+   WI_TMO_POST,      /* waiting for a POST body */
+   WI_TMO_SEND,      /* building or sending a reply */
+   WI_TMOCLASSES
+} witmoclass;
+/* Phases of a request, timed by WI_TIMING */
+typedef enum wiphases {
+   WI_PH_HEADER,     /* request header and any POST body arriving */
+   WI_PH_PARSE,      /* parsing the header */
+   WI_PH_OPEN,       /* opening the file, authentication, conditionals */
+   WI_PH_EXEC,       /* reading the file, running SSI and CGI routines */
+   WI_PH_QUEUE,      /* reply waiting for the socket to take more */
+   WI_PH_SEND,       /* sending the reply */
+   WI_PH_TOTAL,      /* first byte of the request to last of the reply */
+   WI_PHASES
+} wiphase;
+
+/* Kinds of URL, each has its own phase timings */
+typedef enum witclasses {
+   WI_TC_STATIC,     /* file sent as it is */
+   WI_TC_SSI,        /* text file with server side includes */
+   WI_TC_CGI,        /* CGI routine */
+   WI_TCLASSES
+} witclass;
+
 /* ++ REE/EDC */
 /* The supported languages */
 typedef enum wilangs {
@@ -86,12 +139,42 @@ typedef enum wilangs {
 } wilang;
 /* -- REE/EDC */
 
+/* Position of a text token in ws_rxbuf, set by wi_scanheader() */
+typedef struct wi_hdrtok_s
+{
+   uint16_t ht_offset;              /* offset in ws_rxbuf */
+   uint16_t ht_len;                 /* length, excluding terminator */
+} wi_hdrtok;
+
+/* One "Name: value" header field */
+typedef struct wi_hdrfld_s
+{
+   wi_hdrtok hf_name;
+   wi_hdrtok hf_value;              /* value is null terminated */
+} wi_hdrfld;
+
 typedef struct freertos_sockaddr sockaddr_in;
 typedef struct freertos_sockaddr SOCKADDR_IN, *PSOCKADDR_IN;
 
+struct wi_sess_s;    /* predecl */
+
+/* WebSocket endpoint, see websock.c. wh_message is passed each message
+ * from the client, null terminated; wh_poll (optional) is run every
+ * WI_PUSHPOLL seconds. Text either one queues with wi_printf() is sent
+ * back as a text message, by wh_poll only if it has changed.
+ */
+typedef struct wi_wshandler_s
+{
+   int      (*wh_message)(struct wi_sess_s * sess, int opcode,
+                  char * data, int len);
+   int      (*wh_poll)(struct wi_sess_s * sess);
+} wi_wshandler;
+
 typedef struct wi_sess_s
 {
    struct   wi_sess_s * ws_next;             /* queue link */
+   struct   wi_sess_s * ws_prev;
+   struct   wi_worker_s * ws_worker;         /* worker serving the session */
    socktype ws_socket;
    wistate  ws_state;
 
@@ -100,6 +183,16 @@ typedef struct wi_sess_s
    int      ws_contentLength;       /* size of current sess data */
    char *   ws_data;                /* start of contetnt */
 
+   /* Index of the request header, built as it arrives */
+   int      ws_hdrscan;             /* offset of next byte to scan */
+   int      ws_hdrline;             /* offset of the line being scanned */
+   int      ws_hdrlen;              /* length of header once complete */
+   wi_hdrtok ws_method;             /* request line tokens */
+   wi_hdrtok ws_urltok;
+   wi_hdrtok ws_version;
+   int      ws_hdrcount;            /* number of entries in ws_hdrs[] */
+   wi_hdrfld ws_hdrs[WI_MAXHDRS];
+
    txbuf *  ws_txbufs;              /* list of output buffers ready to send */
    txbuf *  ws_txtail;              /* last entry in ws_txbufs list */
 
@@ -113,13 +206,39 @@ typedef struct wi_sess_s
    char *   ws_html_folder;         /* the folder where the html files for the language reside */
    char *   ws_form_error;          /* set by a form handler routine */
    SOCKADDR_IN  ws_client_ip;       /* The IP address of the client */
+   char *   ws_argnext;             /* strtok_r() state of cgiGetArgument() */
    /* -- REE/EDC */
    struct wi_file_s * ws_filelist;  /* local files associated with session */
 
    httpcmds ws_cmd;                 /* GET, POST, etc. */
    int      ws_flags;
    char *   ws_ftype;               /* Mime type (best guess) */
+   const char * ws_etag;            /* entity tag if a static file */
+   long     ws_rangefirst;          /* Range request, see wi_parserange() */
+   long     ws_rangelast;
+   long     ws_binleft;             /* bytes of binary reply left to send */
+   u_long   ws_pushnext;            /* tick to poll server push routine */
+   u_long   ws_pushsum;             /* checksum of last server push update */
+   int      (*ws_pushfn)(struct wi_sess_s * sess, struct em_open_s * eofile);
+                                    /* server push routine, see wi_push() */
+   wi_wshandler * ws_wshandler;     /* WebSocket endpoint */
+   int      ws_wsmsglen;            /* WebSocket message so far in rxbuf */
+   int      ws_wsopcode;            /* opcode of that message */
    wi_sec   ws_last;                /* timetick of last activity */
+   witmoclass ws_tmoclass;          /* idle list the session is on */
+   struct   wi_sess_s * ws_idlenext;    /* idle list link, oldest first */
+   struct   wi_sess_s * ws_idleprev;
+   int      ws_reqcount;            /* requests served on this connection */
+   u_long   ws_txstart;             /* tick when reply header was sent */
+#ifdef WI_TIMING
+   int      ws_timing;              /* TRUE while a request is timed */
+   witclass ws_tclass;              /* kind of URL requested */
+   u_long   ws_tstart;              /* cycle count at first byte of request */
+   u_long   ws_tstamp;              /* cycle count at end of last phase */
+   u_long   ws_tphase[WI_PH_TOTAL]; /* cycles spent in each phase */
+   int      ws_tmarks;              /* bit mask of phases reached */
+#endif
+   EventBits_t ws_selbits;          /* select bits set for ws_socket */
 } wi_sess;   
 
 
@@ -136,14 +255,90 @@ typedef struct wi_form_s
    wi_pair  pairs[1];   /* Size actually will be paircount */
 } wi_form;
 
-extern   wi_sess * wi_sessions;
+/* Binary file send statistics, for throughput measurement */
+extern   u_long   wi_binfiles;      /* files sent */
+extern   u_long   wi_binbytes;      /* bytes sent */
+extern   u_long   wi_binticks;      /* ticks from header to last byte */
+
+extern   int      wi_pushsess;      /* open server push streams */
+
+#ifdef WI_TIMING
+/* Latency histogram of one phase of one kind of URL. Bucket n counts
+ * times under (1 << n) microseconds, the last bucket everything longer.
+ */
+#define WI_TIMEBUCKETS  20
+
+typedef struct wi_hist_s
+{
+   u_long   wh_count;         /* requests timed */
+   u_long   wh_sum;           /* total microseconds, for the mean */
+   u_long   wh_max;           /* longest, microseconds */
+   u_long   wh_bucket[WI_TIMEBUCKETS];
+} wi_hist;
+
+extern   wi_hist  wi_timing[WI_TCLASSES][WI_PHASES];
+extern   const char * const wi_phasenames[WI_PHASES];
+extern   const char * const wi_tclassnames[WI_TCLASSES];
+
+extern   void     wi_timestart(wi_sess * sess);
+extern   void     wi_timemark(wi_sess * sess, wiphase phase);
+extern   void     wi_timeclass(wi_sess * sess);
+extern   void     wi_timedone(wi_sess * sess);
+extern   void     wi_timereset(void);
+extern   void     wi_timecopy(int tclass, int phase, wi_hist * copy);
+extern   u_long   wi_timepercent(wi_hist * hist, int percent);
+
+#define  WI_TIMESTART(sess)         wi_timestart(sess)
+#define  WI_TIMEMARK(sess, phase)   wi_timemark(sess, phase)
+#define  WI_TIMECLASS(sess)         wi_timeclass(sess)
+#define  WI_TIMEDONE(sess)          wi_timedone(sess)
+#define  WI_TIMECANCEL(sess)        ((sess)->ws_timing = FALSE)
+#else
+#define  WI_TIMESTART(sess)
+#define  WI_TIMEMARK(sess, phase)
+#define  WI_TIMECLASS(sess)
+#define  WI_TIMEDONE(sess)
+#define  WI_TIMECANCEL(sess)
+#endif   /* WI_TIMING */
+
+/* Fixed size pool of objects, see webobjs.c */
+typedef struct wi_pool_s
+{
+   char *   wp_name;
+   int      wp_size;          /* object size, rounded up */
+   int      wp_count;         /* number of objects in pool */
+   char *   wp_blocks;        /* pool memory, taken from heap once */
+   void *   wp_free;          /* list of free blocks */
+   u_long * wp_gens;          /* generation of each block, see wi_poolhandle() */
+   int      wp_inuse;         /* objects allocated now */
+   int      wp_maxuse;        /* high water mark of wp_inuse */
+   u_long   wp_fails;         /* allocations failed, pool empty */
+} wi_pool;
+
+/* Handle of a pool object: the generation of its block in the upper 16
+ * bits and its index + 1 in the lower. A block's generation changes each
+ * time it is freed, so a handle kept after its object went is refused
+ * rather than finding whatever took the block next. 0 is no object.
+ */
+typedef u_long wi_handle;
+
+extern   wi_pool     wi_sesspool;
+extern   wi_pool     wi_txpool;
+extern   wi_pool     wi_filepool;
+extern   wi_pool     wi_eopool;
+extern   wi_pool *   const wi_pools[];
 
 #define WF_READINGCMDS     0x0001      /* Still reading socket for commands from browser */
+#define WF_RANGE           0x0002      /* request is for a byte range */
 #define WF_SSL             0x0004      /* Socket is SSL socket */
 #define WF_HEADERSENT      0x0008      /* Header sent for current write */
 #define WF_BINARY          0x0010      /* current file is binary (no SSIs) */
 #define WF_PERSIST         0x0020      /* connection is persistent */
 #define WF_SVRPUSH         0x0040      /* current file is custom server push */
+#define WF_CHUNKOK         0x0080      /* client can take a chunked reply */
+#define WF_CHUNKED         0x0100      /* reply is being sent in chunks */
+#define WF_GZIP            0x0200      /* current file is a gzip copy */
+#define WF_GZVARY          0x0400      /* current file has a gzip copy */
 
 
 #ifndef FALSE
@@ -192,22 +387,56 @@ extern   wi_sess * wi_sessions;
 
 
 #define HDRBUFSIZE   1000
-extern char hdrbuf[HDRBUFSIZE];   /* For building HTTP headers */
+
+/* Worker task state. Each worker runs wi_poll() for its own sessions,
+ * which are handed to it by worker 0 as it accepts them. The counts are
+ * read by other tasks, so are only changed or read under WI_LOCK().
+ */
+typedef struct wi_worker_s
+{
+   wi_sess *      ww_sessions;      /* sessions served by this worker */
+   SocketSet_t    ww_sockset;       /* sockets of ww_sessions */
+   QueueHandle_t  ww_newsess;       /* sessions accepted for this worker */
+   u_long         ww_assigned;      /* sessions given to it, by worker 0 */
+   u_long         ww_released;      /* sessions it has deleted */
+   u_long         ww_replies;       /* replies sent */
+   wi_sess *      ww_idlehead[WI_TMOCLASSES];   /* next session to expire */
+   wi_sess *      ww_idletail[WI_TMOCLASSES];   /* most recently active */
+   char           ww_hdrbuf[HDRBUFSIZE];  /* For building HTTP headers */
+} wi_worker;
+
+extern   wi_worker   wi_workers[WI_WORKERS];
+
+#define wi_hdrbuf(sess)    ((sess)->ws_worker->ww_hdrbuf)
 
 extern   const char *const wi_servername;
 
 extern   int         wi_init(void);
-extern   int         wi_poll(void);
-extern   int         wi_thread(void);
+extern   int         wi_poll(wi_worker * worker);
+extern   int         wi_thread(wi_worker * worker);
 
 extern   char *      wi_alloc(int bufsize);
 extern   void        wi_free(void *);
+extern   int         wi_poolinit(void);
+extern   void *      wi_poolalloc(wi_pool * pool);
+extern   void *      wi_pooltake(wi_pool * pool);
+extern   void        wi_poolfree(wi_pool * pool, void * obj);
+extern   int         wi_poolindex(wi_pool * pool, void * obj);
+extern   wi_handle   wi_poolhandle(wi_pool * pool, void * obj);
+extern   void *      wi_poolobj(wi_pool * pool, wi_handle handle);
+extern   void *      wi_poolat(wi_pool * pool, int index);
+extern   int         wi_poolempty(wi_pool * pool);
 
 extern   txbuf *     wi_txalloc( wi_sess *);
 extern   void        wi_txfree( txbuf *);
 
 extern   wi_sess *   wi_newsess(void);
+extern   void        wi_linksess(wi_worker * worker, wi_sess * sess);
 extern   void        wi_delsess( wi_sess *);
+extern   void        wi_touch(wi_sess * sess);
+extern   witmoclass  wi_tmoclass(wi_sess * sess);
+extern   long        wi_nextidle(wi_worker * worker, u_long now);
+extern   void        wi_expire(wi_worker * worker, u_long now);
 
 extern   void        wi_printf(wi_sess * sess, const char * fmt, ...);
 extern   int         wi_readfile(struct wi_sess_s * sess);
@@ -217,6 +446,8 @@ extern   int         wi_parseheader( wi_sess * sess );
 extern   int         wi_putfile( wi_sess * sess);
 extern   int         wi_senderr(wi_sess * sess, int htmlcode );
 extern   char *      wi_getline( char * linetype, char * httphdr );
+extern   int         wi_scanheader( wi_sess * sess );
+extern   char *      wi_hdrvalue( wi_sess * sess, char * name );
 extern   char *      wi_nextarg( char * argbuf );
 extern   int         wi_argncpy(char * buf, char * arg, int size);
 extern   int         wi_buildform(wi_sess * sess, char * cp);
@@ -224,7 +455,35 @@ extern   char *      wi_argterm( char * arg );
 extern   int         wi_setftype(wi_sess * sess);
 extern   char *      wi_getdate(wi_sess * sess);
 extern   int         wi_replyhdr(wi_sess * sess, int contentLen);
+extern   int         wi_buildhdr(wi_sess * sess, char * hdr, int contentLen);
+extern   int         wi_buildfilehdr(wi_sess * sess, char * hdr,
+                        const void * key, int contentLen);
+extern   void        wi_flushhdrtmpls(void);
+extern   int         wi_sendhdr(wi_sess * sess, int hdrlen);
+extern   int         wi_notmodified(wi_sess * sess);
+extern   void        wi_parserange(wi_sess * sess);
+extern   int         wi_pushstart(wi_sess * sess);
+extern   int         wi_push(wi_sess * sess);
+extern   u_long      wi_txsum(wi_sess * sess);
+extern   int         wi_wsupgrade(wi_sess * sess);
+extern   int         wi_wsread(wi_sess * sess);
+extern   int         wi_wspush(wi_sess * sess);
+extern   int         wi_wssend(wi_sess * sess, int opcode, const char * data,
+                        int len);
+extern   int         wi_fopengz(wi_sess * sess, char * name);
+extern   void        wi_gzvariant(wi_sess * sess, char * name);
+extern   void        wi_selupdate(wi_sess * sess, EventBits_t bits);
+extern   void        wi_sockclose(wi_sess * sess);
+extern   int         wi_txflush(wi_sess * sess);
+extern   int         wi_sendchunk(wi_sess * sess, char * data, int len);
+extern   int         wi_txput(wi_sess * sess, const char * data, int len);
+extern   void        wi_cork(wi_sess * sess, int cork);
 extern   int         wi_txdone(wi_sess * sess);
+extern   int         wi_nextreq(wi_sess * sess);
+/* Start of an SSI directive in a text file */
+#define  WI_SSIMARK     "<!--#"
+#define  WI_SSIMARKLEN  5
+
 extern   int         wi_ssi(wi_sess * sess);
 extern   int         wi_exec(wi_sess * sess);
 extern   int         wi_putlong(wi_sess * sess, u_long value);
@@ -43,8 +43,6 @@
  * checking.
  */
 
-wi_sess * wi_sessions;     /* Master list of sessions */
-
 u_long   wi_blocks = 0;
 u_long   wi_bytes = 0;
 u_long   wi_maxbytes = 0;
@@ -75,6 +73,8 @@ wi_alloc(int bufsize)
    totalsize = bufsize + sizeof(struct memmarker) + 4;
    /* ++ REE/EDC */
    buffer = WI_MALLOC((size_t)totalsize);
+   if(!buffer)
+      return NULL;
    memset(buffer, 0, (size_t)totalsize);
    /* -- REE/EDC */
 
@@ -119,6 +119,308 @@ wi_free(void * buff)
 }
 
 
+/* Sessions, txbufs, files and EOFILEs each hold a large buffer and come
+ * and go with every request, so they are kept in fixed size pools rather
+ * than allocated from the system heap one at a time. The pool memory is
+ * taken from the heap once by wi_poolinit() and never freed. Each block
+ * in a pool has the same front and back markers as a wi_alloc() block,
+ * except that the front marker is "FREE" while the block is on the free
+ * list. A free block holds the free list link in its first word.
+ *
+ * Because the blocks of a pool are one array, whether a pointer is an
+ * object of the pool in use is found from its offset and front marker,
+ * see wi_poolindex(), and an object's index and the generation count of
+ * its block make a handle that can be checked later, see wi_poolhandle().
+ */
+
+int   wi_freemarker = 0x46524545;   /* FREE */
+
+#define WI_POOLSIZE(type)  ((sizeof(type) + 7) & ~7)
+#define WI_POOLBLOCK(pool) \
+   (sizeof(struct memmarker) + (size_t)(pool)->wp_size + 8)
+
+/* A pool with no memory yet, see wi_poolinit() */
+#define WI_POOL(name, type, count) \
+   { name, WI_POOLSIZE(type), count, NULL, NULL, NULL, 0, 0, 0 }
+
+wi_pool  wi_sesspool = WI_POOL("sess", wi_sess, WI_MAXSESS);
+wi_pool  wi_txpool = WI_POOL("txbuf", txbuf, WI_MAXTXBUFS);
+wi_pool  wi_filepool = WI_POOL("file", wi_file, WI_MAXFILES);
+wi_pool  wi_eopool = WI_POOL("eofile", EOFILE, WI_MAXEOFILES);
+
+wi_pool * const wi_pools[] =
+{
+   &wi_sesspool,
+   &wi_txpool,
+   &wi_filepool,
+   &wi_eopool,
+   NULL
+};
+
+/* wi_poolinit()
+ *
+ * Get the memory for all the pools and put every block on its free list.
+ * Pools that already have their memory are left alone.
+ *
+ * Returns: 0 if OK, else WIE_MEMORY.
+ */
+
+int
+wi_poolinit(void)
+{
+   wi_pool *   pool;
+   struct memmarker * mark;
+   char *      obj;
+   int         i;
+   int         j;
+
+   for(i = 0; wi_pools[i]; i++)
+   {
+      pool = wi_pools[i];
+      if(pool->wp_blocks)
+         continue;
+
+      /* The generations follow the blocks */
+      pool->wp_blocks = WI_MALLOC((WI_POOLBLOCK(pool) + sizeof(u_long)) *
+         (size_t)pool->wp_count);
+      if(!pool->wp_blocks)
+      {
+         TRACE(("wi_poolinit: no memory for %s pool\n", pool->wp_name));
+         return WIE_MEMORY;
+      }
+      pool->wp_gens = (u_long *)(pool->wp_blocks +
+         (WI_POOLBLOCK(pool) * (size_t)pool->wp_count));
+      memset(pool->wp_gens, 0, sizeof(u_long) * (size_t)pool->wp_count);
+
+      /* Build the free list from the last block back */
+      pool->wp_free = NULL;
+      for(j = pool->wp_count - 1; j >= 0; j--)
+      {
+         mark = (struct memmarker *)(pool->wp_blocks + (WI_POOLBLOCK(pool) * (size_t)j));
+         mark->marker = wi_freemarker;
+         mark->msize = pool->wp_size;
+         obj = (char*)(mark + 1);
+         *(int*)(obj + pool->wp_size) = wi_marker;
+         *(void**)obj = pool->wp_free;
+         pool->wp_free = mark;
+      }
+   }
+   return 0;
+}
+
+/* wi_poolget()
+ *
+ * Take an object from the pool, with WI_LOCK() held. It is not zeroed.
+ *
+ * Returns: pointer to object, or NULL if the pool is empty.
+ */
+
+static char *
+wi_poolget(wi_pool * pool)
+{
+   struct memmarker * mark;
+   char *   obj;
+
+   mark = (struct memmarker *)pool->wp_free;
+   if(!mark)
+   {
+      pool->wp_fails++;
+      return NULL;
+   }
+   obj = (char*)(mark + 1);
+   if(mark->marker != wi_freemarker)
+      panic("wi_poolalloc: pre");
+   if(*(int*)(obj + mark->msize) != wi_marker)
+      panic("wi_poolalloc: post");
+
+   pool->wp_free = *(void**)obj;
+   mark->marker = wi_marker;
+
+   if(++pool->wp_inuse > pool->wp_maxuse)
+      pool->wp_maxuse = pool->wp_inuse;
+   return obj;
+}
+
+/* wi_poolalloc()
+ *
+ * Take a zeroed object from the pool.
+ *
+ * Returns: pointer to object, or NULL if the pool is empty.
+ */
+
+void *
+wi_poolalloc(wi_pool * pool)
+{
+   char *   obj;
+
+   WI_LOCK();
+   obj = wi_poolget(pool);
+   WI_UNLOCK();
+
+   if(obj)
+      memset(obj, 0, (size_t)pool->wp_size);
+   return obj;
+}
+
+/* wi_pooltake()
+ *
+ * wi_poolalloc() for a caller that holds WI_LOCK(), so that the object
+ * is filled in before another task can look at the pool.
+ *
+ * Returns: pointer to zeroed object, or NULL if the pool is empty.
+ */
+
+void *
+wi_pooltake(wi_pool * pool)
+{
+   char *   obj = wi_poolget(pool);
+
+   if(obj)
+      memset(obj, 0, (size_t)pool->wp_size);
+   return obj;
+}
+
+/* wi_poolfree()
+ *
+ * Return an object to its pool. A bad front marker means the object
+ * was overwritten or is being freed twice.
+ */
+
+void
+wi_poolfree(wi_pool * pool, void * obj)
+{
+   struct memmarker * mark;
+
+   mark = (struct memmarker *)obj;
+   mark--;
+
+   if(mark->marker != wi_marker)
+      panic("wi_poolfree: pre");
+   if(*(int*)((char*)obj + mark->msize) != wi_marker)
+      panic("wi_poolfree: post");
+
+   WI_LOCK();
+   mark->marker = wi_freemarker;
+   *(void**)obj = pool->wp_free;
+   pool->wp_free = mark;
+   pool->wp_inuse--;
+   /* Handles of the object are no longer valid */
+   pool->wp_gens[((char*)mark - pool->wp_blocks) / WI_POOLBLOCK(pool)]++;
+   WI_UNLOCK();
+}
+
+/* wi_poolindex()
+ *
+ * Check that obj is an object of the pool, in use now, without searching
+ * any list.
+ *
+ * Returns: index of the object's block, or -1 if it is not one.
+ */
+
+int
+wi_poolindex(wi_pool * pool, void * obj)
+{
+   size_t   offset;
+   int      index;
+
+   if(!pool->wp_blocks ||
+      ((char*)obj < pool->wp_blocks + sizeof(struct memmarker)))
+   {
+      return -1;
+   }
+   offset = (size_t)((char*)obj - pool->wp_blocks) - sizeof(struct memmarker);
+   if(offset % WI_POOLBLOCK(pool))
+      return -1;
+   index = (int)(offset / WI_POOLBLOCK(pool));
+   if((index >= pool->wp_count) ||
+      (((struct memmarker *)obj - 1)->marker != wi_marker))
+   {
+      return -1;
+   }
+   return index;
+}
+
+/* wi_poolhandle()
+ *
+ * Returns: handle of an object of the pool in use, or 0 if obj is not
+ * one.
+ */
+
+wi_handle
+wi_poolhandle(wi_pool * pool, void * obj)
+{
+   int      index = wi_poolindex(pool, obj);
+
+   if(index < 0)
+      return 0;
+   return ((pool->wp_gens[index] & 0xFFFF) << 16) | (u_long)(index + 1);
+}
+
+/* wi_poolobj()
+ *
+ * Map a handle from wi_poolhandle() back to its object.
+ *
+ * Returns: the object, or NULL if it has been freed since the handle was
+ * made.
+ */
+
+void *
+wi_poolobj(wi_pool * pool, wi_handle handle)
+{
+   struct memmarker * mark;
+   int      index = (int)(handle & 0xFFFF) - 1;
+   void *   obj = NULL;
+
+   if((index < 0) || (index >= pool->wp_count))
+      return NULL;
+   mark = (struct memmarker *)(pool->wp_blocks +
+      (WI_POOLBLOCK(pool) * (size_t)index));
+   WI_LOCK();
+   if(((pool->wp_gens[index] & 0xFFFF) == (handle >> 16)) &&
+      (mark->marker == wi_marker))
+   {
+      obj = mark + 1;
+   }
+   WI_UNLOCK();
+   return obj;
+}
+
+/* wi_poolat()
+ *
+ * For looking through the objects of a pool, index 0 to wp_count - 1.
+ *
+ * Returns: the object of the block at index if it is in use, else NULL.
+ */
+
+void *
+wi_poolat(wi_pool * pool, int index)
+{
+   struct memmarker * mark;
+
+   if(!pool->wp_blocks || (index < 0) || (index >= pool->wp_count))
+      return NULL;
+   mark = (struct memmarker *)(pool->wp_blocks +
+      (WI_POOLBLOCK(pool) * (size_t)index));
+   return (mark->marker == wi_marker) ? (void*)(mark + 1) : NULL;
+}
+
+/* wi_poolempty()
+ *
+ * Returns: TRUE if every object of the pool is in use.
+ */
+
+int
+wi_poolempty(wi_pool * pool)
+{
+   int      empty;
+
+   WI_LOCK();
+   empty = (pool->wp_free == NULL);
+   WI_UNLOCK();
+   return empty;
+}
+
+
 /* txbuf constructor */
 
 txbuf *
@@ -126,12 +428,13 @@ wi_txalloc(wi_sess * websess)
 {
    txbuf * newtx;
 
-   newtx = (txbuf*)wi_alloc( sizeof(txbuf) );
+   newtx = (txbuf*)wi_poolalloc( &wi_txpool );
    WI_TRACE_ALLOC(newtx);
    if(!newtx)
       return NULL;
 
    /* Install new TX buffer at end of session chain */
+   newtx->tb_prev = websess->ws_txtail;
    if(websess->ws_txtail)
       websess->ws_txtail->tb_next = newtx;   /* add to existing tail */
 
@@ -152,28 +455,21 @@ void
 wi_txfree(txbuf * oldtx)
 {
    wi_sess *   websess;
-   txbuf *     tmptx;
-   txbuf *     last;
 
-   /* This has most likely been unlinked already, but try to find it
-    * in the sesion queue just in case.
+   /* Unlink it from the session chain, which is doubly linked so that
+    * this does not need to search it.
     */
    websess = oldtx->tb_session;
-   last = NULL;
-   for(tmptx = websess->ws_txbufs; tmptx; tmptx = tmptx->tb_next)
-   {
-      if(tmptx == oldtx)
-      {
-         if(last)
-            last->tb_next = oldtx->tb_next;
-         else
-            websess->ws_txbufs = oldtx->tb_next;
-
-         break;
-      }
-   }
-
-   wi_free(oldtx);
+   if(oldtx->tb_prev)
+      oldtx->tb_prev->tb_next = oldtx->tb_next;
+   else
+      websess->ws_txbufs = oldtx->tb_next;
+   if(oldtx->tb_next)
+      oldtx->tb_next->tb_prev = oldtx->tb_prev;
+   else
+      websess->ws_txtail = oldtx->tb_prev;
+
+   wi_poolfree(&wi_txpool, oldtx);
    WI_TRACE_FREE(oldtx);
 
    return;
@@ -187,7 +483,7 @@ wi_newsess(void)
 {
    wi_sess * newsess;
 
-   newsess = (wi_sess *)wi_alloc( sizeof(wi_sess) );
+   newsess = (wi_sess *)wi_poolalloc( &wi_sesspool );
    WI_TRACE_ALLOC(newsess);
    if(!newsess)
    {
@@ -196,51 +492,185 @@ wi_newsess(void)
       /* -- REE/EDC */
       return NULL;
    }
-   newsess->ws_socket = INVALID_SOCKET;
+   newsess->ws_socket = (socktype)INVALID_SOCKET;
    newsess->ws_state = WI_HEADER;
    /* ++ REE/EDC */
    newsess->ws_last = cticks();
    /* -- REE/EDC */
 
-   /* Add new session to master list */
-   newsess->ws_next = wi_sessions;
-   wi_sessions = newsess;
-
    /* All new sessions strt out ready to read their socket */
    newsess->ws_flags |= WF_READINGCMDS;
 
    return newsess;
 }
 
+/* wi_linksess()
+ *
+ * Add a new session to the session list of the worker serving it. Only
+ * called by that worker's task.
+ */
 
-/* wi_sess destructor */
+void
+wi_linksess(wi_worker * worker, wi_sess * sess)
+{
+   sess->ws_prev = NULL;
+   sess->ws_next = worker->ww_sessions;
+   if(sess->ws_next)
+      sess->ws_next->ws_prev = sess;
+   worker->ww_sessions = sess;
+   wi_touch(sess);
+}
+
+/* Idle timeouts of the classes, in ticks */
+
+static const u_long wi_idletmos[WI_TMOCLASSES] =
+{
+   WI_TMOHEADER * TPS,
+   WI_PERSISTTMO * TPS,
+   WI_TMOPOST * TPS,
+   WI_TMOSEND * TPS,
+};
+
+/* wi_tmoclass() - idle timeout class for the current state of a session */
+
+witmoclass
+wi_tmoclass(wi_sess * sess)
+{
+   switch(sess->ws_state)
+   {
+   case WI_HEADER:
+      if((sess->ws_reqcount > 0) && (sess->ws_rxsize == 0))
+         return WI_TMO_PERSIST;
+      return WI_TMO_HEADER;
+   case WI_POSTRX:
+      return WI_TMO_POST;
+   default:
+      return WI_TMO_SEND;
+   }
+}
+
+/* wi_idleunlink() - take a session off its idle list, if it is on one */
+
+static void
+wi_idleunlink(wi_sess * sess)
+{
+   wi_worker * worker = sess->ws_worker;
+   witmoclass  tc = sess->ws_tmoclass;
+
+   if(sess->ws_idleprev)
+      sess->ws_idleprev->ws_idlenext = sess->ws_idlenext;
+   else if(worker->ww_idlehead[tc] == sess)
+      worker->ww_idlehead[tc] = sess->ws_idlenext;
+   else
+      return;     /* not linked */
+
+   if(sess->ws_idlenext)
+      sess->ws_idlenext->ws_idleprev = sess->ws_idleprev;
+   else
+      worker->ww_idletail[tc] = sess->ws_idleprev;
+
+   sess->ws_idlenext = sess->ws_idleprev = NULL;
+}
+
+/* wi_touch()
+ *
+ * Note activity on a session: restart its idle timer and move it to the
+ * tail of the idle list for its current state. Called by the task of the
+ * worker serving the session.
+ */
 
 void
-wi_delsess(wi_sess * oldsess)
+wi_touch(wi_sess * sess)
+{
+   wi_worker * worker = sess->ws_worker;
+   witmoclass  tc;
+
+   wi_idleunlink(sess);
+
+   tc = wi_tmoclass(sess);
+   sess->ws_tmoclass = tc;
+   sess->ws_last = cticks();
+   sess->ws_idleprev = worker->ww_idletail[tc];
+   if(sess->ws_idleprev)
+      sess->ws_idleprev->ws_idlenext = sess;
+   else
+      worker->ww_idlehead[tc] = sess;
+   worker->ww_idletail[tc] = sess;
+}
+
+/* wi_nextidle()
+ *
+ * Returns ticks until the first idle timeout of a worker's sessions is
+ * due, 0 if one is overdue, or -1 if it has no sessions. Only the head
+ * of each idle list needs checking.
+ */
+
+long
+wi_nextidle(wi_worker * worker, u_long now)
 {
-   wi_sess * tmpsess;
-   wi_sess * lastsess;
+   int      tc;
+   long     idle;
+   long     next = -1;
 
-   if(oldsess->ws_socket != INVALID_SOCKET)
+   for(tc = 0; tc < WI_TMOCLASSES; tc++)
    {
-      closesocket(oldsess->ws_socket);
-      oldsess->ws_socket = 0;
+      if(!worker->ww_idlehead[tc])
+         continue;
+      idle = (long)(worker->ww_idlehead[tc]->ws_last + wi_idletmos[tc] - now);
+      if(idle < 0)
+         idle = 0;
+      if((next < 0) || (idle < next))
+         next = idle;
    }
+   return next;
+}
+
+/* wi_expire() - delete the sessions of a worker that have sat idle too long */
 
-   /* Unlink from master session list */
-   lastsess = NULL;
-   for(tmpsess = wi_sessions; tmpsess; tmpsess = tmpsess->ws_next)
+void
+wi_expire(wi_worker * worker, u_long now)
+{
+   int      tc;
+   wi_sess * sess;
+
+   for(tc = 0; tc < WI_TMOCLASSES; tc++)
    {
-      if(tmpsess == oldsess)     /* Found session to unlink? */
+      while((sess = worker->ww_idlehead[tc]) != NULL)
       {
-         if(lastsess)
-            lastsess->ws_next = tmpsess->ws_next;
-         else
-            wi_sessions  = tmpsess->ws_next;
-         break;
+         if((long)(now - (sess->ws_last + wi_idletmos[tc])) <= 0)
+            break;
+         /* ++ REE/EDC */
+         TRACE(("wi_expire: session %p idle in class %d\n", sess, tc));
+         /* -- REE/EDC */
+         wi_delsess(sess);
       }
-      lastsess= tmpsess;
    }
+}
+
+
+/* wi_sess destructor */
+
+void
+wi_delsess(wi_sess * oldsess)
+{
+   wi_worker * worker = oldsess->ws_worker;
+
+   if(oldsess->ws_socket != (socktype)INVALID_SOCKET)
+      wi_sockclose(oldsess);
+
+   /* Unlink from the worker's session list, if it made it on */
+   if(oldsess->ws_prev)
+      oldsess->ws_prev->ws_next = oldsess->ws_next;
+   else if(worker->ww_sessions == oldsess)
+      worker->ww_sessions = oldsess->ws_next;
+   if(oldsess->ws_next)
+      oldsess->ws_next->ws_prev = oldsess->ws_prev;
+   wi_idleunlink(oldsess);
+   WI_LOCK();
+   worker->ww_released++;     /* read by worker 0 to share out sessions */
+   if(oldsess->ws_flags & WF_SVRPUSH)
+      wi_pushsess--;
+   WI_UNLOCK();
 
    /* Make sure there are no dangling resources */
    if(oldsess->ws_txbufs)
@@ -271,7 +701,7 @@ wi_delsess(wi_sess * oldsess)
    }
   /* -- REE/EDC */
 
-   wi_free(oldsess);    /* free the actual memory */
+   wi_poolfree(&wi_sesspool, oldsess);    /* free the actual memory */
    WI_TRACE_FREE(oldsess);
 
    return;
@@ -284,7 +714,7 @@ wi_newfile(wi_filesys * fsys, wi_sess * sess, void * fd)
 {
    wi_file *      newfile;
 
-   newfile = (wi_file *)wi_alloc( sizeof(wi_file));
+   newfile = (wi_file *)wi_poolalloc( &wi_filepool );
    WI_TRACE_ALLOC(newfile);
    if(!newfile)
       return NULL;
@@ -295,6 +725,8 @@ wi_newfile(wi_filesys * fsys, wi_sess * sess, void * fd)
 
    /* Put new file at front of session file list */
    newfile->wf_next = sess->ws_filelist;
+   if(newfile->wf_next)
+      newfile->wf_next->wf_prev = newfile;
    sess->ws_filelist = newfile;
 
    return newfile;
@@ -307,26 +739,17 @@ int
 wi_delfile(wi_file * delfile)
 {
    wi_sess *   sess;
-   wi_file *   tmpfi;
-   wi_file *   last;
 
    /* unlink file from session list */
    sess = delfile->wf_sess;
-   last = NULL;
-   for(tmpfi = sess->ws_filelist; tmpfi; tmpfi = tmpfi->wf_next)
-   {
-      if(tmpfi == delfile)
-      {
-         if(last)
-            last->wf_next = delfile->wf_next;
-         else
-            sess->ws_filelist = delfile->wf_next;
-         break;
-      }
-      last = tmpfi;
-   }
-
-   wi_free(delfile);
+   if(delfile->wf_prev)
+      delfile->wf_prev->wf_next = delfile->wf_next;
+   else
+      sess->ws_filelist = delfile->wf_next;
+   if(delfile->wf_next)
+      delfile->wf_next->wf_prev = delfile->wf_prev;
+
+   wi_poolfree(&wi_filepool, delfile);
    WI_TRACE_FREE(delfile);
 
    return 0;
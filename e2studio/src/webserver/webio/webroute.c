@@ -0,0 +1,511 @@
+/* webroute.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * The route table of the embedded file system. At start up every file
+ * of the EFS images, every SSI routine and every CGI routine is put in a
+ * single radix trie keyed by its path, so em_fopen() finds what serves a
+ * request with one walk down the trie rather than trying each image and
+ * then each table in turn.
+ *
+ * Paths are folded as the EFS searches compare them: the first slash is
+ * dropped, both kinds of slash are the same and case is ignored. A CGI
+ * route may have {name} parameters, each of which matches one segment
+ * of the path, e.g. "api/led/{n}" serves "/api/led/2" with n = "2". A
+ * fixed segment wins over a parameter. Where two sources have the same
+ * path, the first added wins: the loaded image, the linked in images
+ * from the last, then SSI and CGI routines, which is the order
+ * em_fopen() searched them in.
+ *
+ * The trie and the routes are held in blocks from wi_alloc(), freed
+ * together when em_routeinit() replaces the table.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "websys.h"     /* port dependent system files */
+#include "webio.h"
+#include "webfs.h"
+#include "webSSI.h"
+#include "webCGI.h"
+#include "efsWebSites.h"
+
+#ifdef USE_EMFILES
+
+/* A node of the trie. The edge into a node is the run of folded path
+ * characters rn_label, or a {name} parameter. A node's fixed children
+ * all start with different characters and come before its parameter
+ * child, of which it has one at most.
+ */
+typedef struct em_rnode_s
+{
+   struct em_rnode_s * rn_child;    /* first child */
+   struct em_rnode_s * rn_next;     /* next sibling */
+   const char *   rn_label;         /* edge label, not null terminated */
+   int            rn_len;           /* length of rn_label */
+   int            rn_param;         /* TRUE if the edge is a parameter */
+   em_route *     rn_route;         /* route of the path ending here */
+} em_rnode;
+
+#define EM_ROUTEBLOCK   1024        /* size of the allocation blocks */
+
+struct em_routes_s
+{
+   em_rnode       rt_root;
+   char *         rt_blocks;        /* list of blocks, linked by first word */
+   char *         rt_free;          /* free space in the first block */
+   int            rt_left;          /* bytes at rt_free */
+   int            rt_count;         /* routes */
+};
+
+static em_routes *   em_routetable;
+
+/* Fold a path character: letters to lower case and '\\' to '/'. Only
+ * letters, so that no other character turns into a '{' or '/'.
+ */
+#define EM_FOLD(c)   (((c) == '\\') ? '/' : \
+                      (((c) >= 'A') && ((c) <= 'Z')) ? ((c) | 0x20) : (c))
+
+/* em_routemem()
+ *
+ * Get size bytes for the table, from its current block or a new one.
+ *
+ * Returns: pointer to the zeroed memory, or NULL if out of heap.
+ */
+
+static void *
+em_routemem(em_routes * routes, int size)
+{
+   char *   block;
+   void *   mem;
+
+   size = (size + (int)sizeof(void *) - 1) & ~((int)sizeof(void *) - 1);
+   if(size > routes->rt_left)
+   {
+      if(size > (EM_ROUTEBLOCK - (int)sizeof(void *)))
+         return NULL;
+      block = wi_alloc(EM_ROUTEBLOCK);
+      if(!block)
+         return NULL;
+      *(char **)block = routes->rt_blocks;
+      routes->rt_blocks = block;
+      routes->rt_free = block + sizeof(void *);
+      routes->rt_left = EM_ROUTEBLOCK - (int)sizeof(void *);
+   }
+   mem = routes->rt_free;
+   routes->rt_free += size;
+   routes->rt_left -= size;
+   memset(mem, 0, (size_t)size);
+   return mem;
+}
+
+static void
+em_routefree(em_routes * routes)
+{
+   char *   block;
+
+   while(routes->rt_blocks)
+   {
+      block = routes->rt_blocks;
+      routes->rt_blocks = *(char **)block;
+      wi_free(block);
+   }
+   wi_free(routes);
+}
+
+/* em_routeinsert()
+ *
+ * Add the route to the trie under its pattern.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code. A path that already
+ * has a route keeps it, which is not an error.
+ */
+
+static int
+em_routeinsert(em_routes * routes, em_route * route)
+{
+   em_rnode *     node = &routes->rt_root;
+   em_rnode *     child;
+   em_rnode *     prev;
+   em_rnode *     mid;
+   char *         key;
+   const char *   end;
+   int            len;
+   int            common;
+   int            nargs = 0;
+   int            params = (route->er_type == EM_RT_CGI);
+   int            i;
+
+   /* Labels point into the folded copy of the pattern */
+   key = em_routemem(routes, (int)strlen(route->er_pattern) + 1);
+   if(!key)
+      return WIE_MEMORY;
+   for(i = 0; route->er_pattern[i]; i++)
+      key[i] = (char)EM_FOLD(route->er_pattern[i]);
+   if(*key == '/')
+      key++;
+
+   /* Only CGI routes have {name} parameters, a '{' in a file name is
+    * just a character.
+    */
+   while(*key)
+   {
+      if(params && (*key == '{'))
+      {
+         end = strchr(key, '}');
+         if(!end || (end == key + 1) || (++nargs > WI_ROUTEARGS))
+         {
+            return WIE_BADPARM;
+         }
+         /* The parameter child is the last */
+         prev = NULL;
+         for(child = node->rn_child; child; child = child->rn_next)
+         {
+            if(child->rn_param)
+               break;
+            prev = child;
+         }
+         if(!child)
+         {
+            child = em_routemem(routes, sizeof(em_rnode));
+            if(!child)
+               return WIE_MEMORY;
+            child->rn_param = TRUE;
+            if(prev)
+               prev->rn_next = child;
+            else
+               node->rn_child = child;
+         }
+         node = child;
+         key = (char *)end + 1;
+         continue;
+      }
+
+      /* A fixed run, up to the next parameter */
+      end = params ? strchr(key, '{') : NULL;
+      len = end ? (int)(end - key) : (int)strlen(key);
+      prev = NULL;
+      for(child = node->rn_child; child; child = child->rn_next)
+      {
+         if(!child->rn_param && (child->rn_label[0] == *key))
+            break;
+         prev = child;
+      }
+      if(!child)
+      {
+         /* New leaf, at the front to stay before the parameter */
+         child = em_routemem(routes, sizeof(em_rnode));
+         if(!child)
+            return WIE_MEMORY;
+         child->rn_label = key;
+         child->rn_len = len;
+         child->rn_next = node->rn_child;
+         node->rn_child = child;
+         node = child;
+         key += len;
+         continue;
+      }
+
+      for(common = 1; (common < len) && (common < child->rn_len); common++)
+      {
+         if(child->rn_label[common] != key[common])
+            break;
+      }
+      if(common < child->rn_len)
+      {
+         /* Split the edge where the paths part */
+         mid = em_routemem(routes, sizeof(em_rnode));
+         if(!mid)
+            return WIE_MEMORY;
+         mid->rn_label = child->rn_label;
+         mid->rn_len = common;
+         mid->rn_child = child;
+         mid->rn_next = child->rn_next;
+         child->rn_label += common;
+         child->rn_len -= common;
+         child->rn_next = NULL;
+         if(prev)
+            prev->rn_next = mid;
+         else
+            node->rn_child = mid;
+         child = mid;
+      }
+      node = child;
+      key += common;
+   }
+
+   if(!node->rn_route)
+   {
+      node->rn_route = route;
+      routes->rt_count++;
+   }
+   return 0;
+}
+
+/* em_routeadd()
+ *
+ * Add an SSI or CGI routine to the table being built by em_routeinit(),
+ * for the SSI and CGI modules to add their tables with. A CGI pattern may
+ * have {name} parameters.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+em_routeadd(em_routes * routes, const char * pattern, int type,
+   PSVRFN function)
+{
+   em_route *  route;
+
+   route = em_routemem(routes, sizeof(em_route));
+   if(!route)
+      return WIE_MEMORY;
+   route->er_type = type;
+   route->er_pattern = pattern;
+   route->er_function = function;
+   return em_routeinsert(routes, route);
+}
+
+/* Context of em_routeefs() */
+typedef struct em_efsadd_s
+{
+   em_routes * ea_routes;
+   void *      ea_efs;
+   int         ea_error;
+} em_efsadd;
+
+/* em_routeefs()
+ *
+ * efsEnumFiles() callback to add a file of an EFS image.
+ */
+
+static void
+em_routeefs(void * context, const int8_t * path, const int8_t * name)
+{
+   em_efsadd * add = (em_efsadd *)context;
+   em_route *  route;
+   char *      pattern;
+   int         dirlen;
+
+   if(add->ea_error)
+      return;
+   /* "\dir" and "name" make "dir/name", the root's files are "name" */
+   if((*path == '\\') || (*path == '/'))
+      path++;
+   dirlen = (int)strlen((const char *)path);
+   route = em_routemem(add->ea_routes, sizeof(em_route));
+   pattern = em_routemem(add->ea_routes,
+      dirlen + (int)strlen((const char *)name) + 2);
+   if(!route || !pattern)
+   {
+      add->ea_error = WIE_MEMORY;
+      return;
+   }
+   sprintf(pattern, "%s%s%s", (const char *)path, dirlen ? "/" : "",
+      (const char *)name);
+   if(efsFindFile(add->ea_efs, (int8_t *)pattern, &route->er_file) != EFS_OK)
+   {
+      add->ea_error = WIE_BADFILE;
+      return;
+   }
+   route->er_type = EM_RT_EFS;
+   route->er_pattern = pattern;
+   route->er_efs = add->ea_efs;
+   add->ea_error = em_routeinsert(add->ea_routes, route);
+}
+
+static int
+em_routeimage(em_routes * routes, void * efs)
+{
+   em_efsadd   add;
+
+   add.ea_routes = routes;
+   add.ea_efs = efs;
+   add.ea_error = 0;
+   if(efsEnumFiles(efs, em_routeefs, &add) != EFS_OK)
+      return WIE_BADFILE;
+   return add.ea_error;
+}
+
+/* em_routeinit()
+ *
+ * Build the route table from the EFS images and the SSI and CGI tables,
+ * and put it in place of the current one. Call it again whenever
+ * wi_pvEfs is changed, as em_mount() does. If it fails the old table is
+ * dropped too, as it may hold files of an image no longer mounted, and
+ * em_fopen() searches as it did without one.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+em_routeinit(void)
+{
+   em_routes * routes;
+   em_routes * old;
+   size_t      st_number = gEFSL.stNumberOfElements;
+   int         error = 0;
+
+   routes = (em_routes *)wi_alloc(sizeof(em_routes));
+   if(routes)
+      memset(routes, 0, sizeof(em_routes));
+   else
+      error = WIE_MEMORY;
+
+   if(!error && wi_pvEfs)
+      error = em_routeimage(routes, wi_pvEfs);
+   while(!error && st_number--)
+      error = em_routeimage(routes, gEFSL.ppvEfs[st_number]);
+   if(!error)
+      error = ssiAddRoutes(routes);
+   if(!error)
+      error = cgiAddRoutes(routes);
+   if(error && routes)
+   {
+      /* ++ REE/EDC */
+      TRACE(("em_routeinit: no route table, error %d\n", error));
+      /* -- REE/EDC */
+      em_routefree(routes);
+      routes = NULL;
+   }
+
+   WI_LOCK();
+   old = em_routetable;
+   em_routetable = routes;
+   WI_UNLOCK();
+   /* The workers copy what they find under the lock */
+   if(old)
+      em_routefree(old);
+   return error;
+}
+
+/* Captured parameters of a match */
+typedef struct em_rmatch_s
+{
+   const char *   rm_arg[WI_ROUTEARGS];
+   int            rm_len[WI_ROUTEARGS];
+   int            rm_nargs;
+} em_rmatch;
+
+/* em_routewalk()
+ *
+ * Match path, the rest of the request path, below node. Fixed edges are
+ * tried before the parameter, which is only taken if they fail.
+ *
+ * Returns: the route, or NULL if nothing below node matches.
+ */
+
+static em_route *
+em_routewalk(em_rnode * node, const char * path, em_rmatch * match,
+   int nargs)
+{
+   em_rnode *  child;
+   em_route *  route;
+   int         i;
+
+   if(*path == 0)
+   {
+      match->rm_nargs = nargs;
+      return node->rn_route;
+   }
+   for(child = node->rn_child; child; child = child->rn_next)
+   {
+      if(child->rn_param)
+      {
+         for(i = 0; path[i] && (path[i] != '/') && (path[i] != '\\'); i++)
+            ;
+         if((i == 0) || (nargs >= WI_ROUTEARGS))
+            return NULL;
+         match->rm_arg[nargs] = path;
+         match->rm_len[nargs] = i;
+         return em_routewalk(child, path + i, match, nargs + 1);
+      }
+      if(child->rn_label[0] != EM_FOLD(*path))
+         continue;
+      for(i = 1; i < child->rn_len; i++)
+      {
+         if(child->rn_label[i] != EM_FOLD(path[i]))
+            break;
+      }
+      if(i == child->rn_len)
+      {
+         route = em_routewalk(child, path + i, match, nargs);
+         if(route)
+            return route;
+      }
+      /* Only the parameter can match now */
+      while(child->rn_next && !child->rn_next->rn_param)
+         child = child->rn_next;
+   }
+   return NULL;
+}
+
+/* em_routefind()
+ *
+ * Find the route of a request path. The route is copied to route, and
+ * the values of its parameters to args, null terminated one after the
+ * other, as em_routearg() reads them. Called with WI_LOCK() held, as a
+ * file route points into an image that may be unmounted once the lock
+ * is given up.
+ *
+ * Returns: 0 if found, WIE_NOFILE if not, or WIE_BADPARM if there is no
+ * route table or the parameters do not fit.
+ */
+
+int
+em_routefind(const char * path, em_route * route, char * args, int argsize)
+{
+   em_route *  found;
+   em_rmatch   match;
+   int         i;
+
+   if((*path == '/') || (*path == '\\'))
+      path++;
+   if(!em_routetable)
+      return WIE_BADPARM;
+   found = em_routewalk(&em_routetable->rt_root, path, &match, 0);
+   if(found)
+      *route = *found;
+   if(!found)
+      return WIE_NOFILE;
+
+   for(i = 0; i < match.rm_nargs; i++)
+   {
+      if(match.rm_len[i] >= argsize)
+         return WIE_BADPARM;
+      memcpy(args, match.rm_arg[i], (size_t)match.rm_len[i]);
+      args[match.rm_len[i]] = 0;
+      args += match.rm_len[i] + 1;
+      argsize -= match.rm_len[i] + 1;
+   }
+   return 0;
+}
+
+/* em_routearg()
+ *
+ * Get a {name} parameter of the route a CGI routine was called by.
+ *
+ * Returns: the value, or NULL if the route has no such parameter.
+ */
+
+const char *
+em_routearg(EOFILE * eofile, const char * name)
+{
+   const char *   cp = eofile->eo_pattern;
+   const char *   value = eofile->eo_args;
+   size_t         len = strlen(name);
+
+   if(!cp)
+      return NULL;
+   while((cp = strchr(cp, '{')) != NULL)
+   {
+      cp++;
+      if((strncmp(cp, name, len) == 0) && (cp[len] == '}'))
+         return value;
+      value += strlen(value) + 1;
+   }
+   return NULL;
+}
+
+#endif  /* USE_EMFILES */
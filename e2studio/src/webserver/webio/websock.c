@@ -0,0 +1,625 @@
+/* websock.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * RFC 6455 WebSocket connections. A GET with "Upgrade: websocket" for a
+ * URI that has a wi_wshandler is answered with "101 Switching
+ * Protocols", after which the session stays in WI_WEBSOCK. Frames from
+ * the client are unmasked and reassembled in ws_rxbuf and passed to the
+ * handler a message at a time; whatever the handler queues with
+ * wi_printf() goes back as one text message. The handler's poll routine
+ * is run like a server push routine, and its output is only sent when
+ * it changes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bsp_api.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_IP_Private.h"
+#include "FreeRTOS_Sockets.h"
+#include "queue.h"
+
+#include "websys.h"     /* port dependent system files */
+#include "webio.h"
+#include "webfs.h"
+#include "webCGI.h"
+#include "strstri.h"
+
+#include "board_cfg.h"
+#include "common_utils.h"
+#include "portable.h"
+
+/* Frame opcodes */
+#define WS_CONT      0x0
+#define WS_TEXT      0x1
+#define WS_BINARY    0x2
+#define WS_CLOSE     0x8
+#define WS_PING      0x9
+#define WS_PONG      0xA
+
+/* Close status codes */
+#define WS_NORMAL    1000
+#define WS_PROTOCOL  1002
+#define WS_TOOBIG    1009
+
+static const char wi_wsguid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static int wi_wsframes(wi_sess * sess);
+
+/* wi_sha1()
+ *
+ * SHA-1 digest of a block of data, for the handshake only.
+ */
+
+#define SHA1_ROL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+wi_sha1(const u_char * data, int len, u_char * digest)
+{
+   uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                     0xC3D2E1F0 };
+   uint32_t w[80];
+   uint32_t a, b, c, d, e, f, k, t;
+   u_char   block[64];
+   uint64_t bits = (uint64_t)len * 8;
+   int      done = 0;
+   int      padded = 0;
+   int      i;
+
+   while(!padded)
+   {
+      /* Next block of the message, with the padding and length */
+      if(len - done >= 64)
+      {
+         memcpy(block, data + done, 64);
+         done += 64;
+      }
+      else
+      {
+         i = len - done;
+         memset(block, 0, sizeof(block));
+         if(i >= 0)
+         {
+            memcpy(block, data + done, (size_t)i);
+            block[i] = 0x80;
+            done = len + 1;
+         }
+         else
+            i = 0;      /* length only block */
+         if(i < 56)
+         {
+            for(t = 0; t < 8; t++)
+               block[63 - t] = (u_char)(bits >> (t * 8));
+            padded = 1;
+         }
+      }
+
+      for(i = 0; i < 16; i++)
+      {
+         w[i] = ((uint32_t)block[i * 4] << 24) |
+                ((uint32_t)block[i * 4 + 1] << 16) |
+                ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+      }
+      for(i = 16; i < 80; i++)
+         w[i] = SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+      a = h[0];
+      b = h[1];
+      c = h[2];
+      d = h[3];
+      e = h[4];
+      for(i = 0; i < 80; i++)
+      {
+         if(i < 20)
+         {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+         }
+         else if(i < 40)
+         {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+         }
+         else if(i < 60)
+         {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+         }
+         else
+         {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+         }
+         t = SHA1_ROL(a, 5) + f + e + k + w[i];
+         e = d;
+         d = c;
+         c = SHA1_ROL(b, 30);
+         b = a;
+         a = t;
+      }
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+   }
+
+   for(i = 0; i < 20; i++)
+      digest[i] = (u_char)(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+/* wi_base64()
+ *
+ * Base64 encode len bytes into out, which is null terminated.
+ *
+ * Returns: length of the encoded text.
+ */
+
+static int
+wi_base64(const u_char * in, int len, char * out)
+{
+   static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   char *   cp = out;
+   uint32_t v;
+   int      i;
+
+   for(i = 0; i < len; i += 3)
+   {
+      v = (uint32_t)in[i] << 16;
+      if(i + 1 < len)
+         v |= (uint32_t)in[i + 1] << 8;
+      if(i + 2 < len)
+         v |= in[i + 2];
+      *cp++ = digits[(v >> 18) & 0x3F];
+      *cp++ = digits[(v >> 12) & 0x3F];
+      *cp++ = (i + 1 < len) ? digits[(v >> 6) & 0x3F] : '=';
+      *cp++ = (i + 2 < len) ? digits[v & 0x3F] : '=';
+   }
+   *cp = 0;
+   return (int)(cp - out);
+}
+
+/* wi_wssend()
+ *
+ * Send one unfragmented frame. Frames from a server are not masked.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_wssend(wi_sess * sess, int opcode, const char * data, int len)
+{
+   u_char   hdr[4];
+   int      hdrlen = 2;
+
+   hdr[0] = (u_char)(0x80 | opcode);
+   if(len < 126)
+      hdr[1] = (u_char)len;
+   else
+   {
+      hdr[1] = 126;
+      hdr[2] = (u_char)(len >> 8);
+      hdr[3] = (u_char)len;
+      hdrlen = 4;
+   }
+   if((send(sess->ws_socket, hdr, (size_t)hdrlen, 0) != hdrlen) ||
+      (len && (send(sess->ws_socket, data, (size_t)len, 0) != len)))
+   {
+      return WIE_SOCKET;
+   }
+   wi_touch(sess);
+
+   return 0;
+}
+
+/* wi_wsflush()
+ *
+ * Send the text the handler has queued in txbufs as one text message.
+ * If changed is set the text is dropped when it is the same as the last
+ * text sent.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+static int
+wi_wsflush(wi_sess * sess, int changed)
+{
+   txbuf *  tx;
+   u_long   sum = wi_txsum(sess);
+   u_char   hdr[4];
+   int      hdrlen = 2;
+   int      len = 0;
+   int      error = 0;
+
+   if(!sess->ws_txbufs || (changed && (sum == sess->ws_pushsum)))
+   {
+      while(sess->ws_txbufs)
+         wi_txfree(sess->ws_txbufs);
+      return 0;
+   }
+   sess->ws_pushsum = sum;
+
+   for(tx = sess->ws_txbufs; tx; tx = tx->tb_next)
+      len += tx->tb_total;
+   hdr[0] = 0x80 | WS_TEXT;
+   if(len < 126)
+      hdr[1] = (u_char)len;
+   else
+   {
+      hdr[1] = 126;
+      hdr[2] = (u_char)(len >> 8);
+      hdr[3] = (u_char)len;
+      hdrlen = 4;
+   }
+
+   wi_cork(sess, TRUE);
+   if(send(sess->ws_socket, hdr, (size_t)hdrlen, 0) != hdrlen)
+      error = WIE_SOCKET;
+   while(sess->ws_txbufs)
+   {
+      tx = sess->ws_txbufs;
+      if(!error &&
+         (send(sess->ws_socket, tx->tb_data, (size_t)tx->tb_total, 0) !=
+            tx->tb_total))
+      {
+         error = WIE_SOCKET;
+      }
+      wi_txfree(tx);
+   }
+   wi_cork(sess, FALSE);
+   wi_touch(sess);
+
+   return error;
+}
+
+/* wi_wsclose()
+ *
+ * Send a close frame with a status code and end the session.
+ *
+ * Returns: 0
+ */
+
+static int
+wi_wsclose(wi_sess * sess, int status)
+{
+   char     code[2];
+
+   code[0] = (char)(status >> 8);
+   code[1] = (char)status;
+   wi_wssend(sess, WS_CLOSE, code, 2);
+   sess->ws_state = WI_ENDING;
+
+   return 0;
+}
+
+/* wi_wssameorigin()
+ *
+ * A browser sends the page's origin with every WebSocket handshake, and
+ * does not stop a page from another site opening one. Only a page this
+ * server sent, whose origin is "http://" plus the Host field, may
+ * connect. A request without an Origin field is not from a browser.
+ *
+ * Returns: TRUE if the request may be upgraded
+ */
+
+static int
+wi_wssameorigin(wi_sess * sess)
+{
+   char *   origin;
+   char *   host;
+
+   origin = wi_hdrvalue(sess, "Origin");
+   if(!origin)
+      return TRUE;
+   host = wi_hdrvalue(sess, "Host");
+   if(!host || (strnicmp(origin, "http://", 7) != 0))
+      return FALSE;
+   return (stricmp(origin + 7, host) == 0);
+}
+
+/* wi_wsupgrade()
+ *
+ * Called for each GET request once the URI is known. Does the WebSocket
+ * handshake if the request asks for one.
+ *
+ * Returns: 0 if the request is not a WebSocket request, 1 if the
+ * connection is now a WebSocket, else negative WIE_ error code (an
+ * error reply has been sent, or the socket failed).
+ */
+
+int
+wi_wsupgrade(wi_sess * sess)
+{
+   wi_wshandler * handler;
+   char *         upgrade;
+   char *         conn;
+   char *         key;
+   char *         ver;
+   char *         cp;
+   char           accept[64];
+   u_char         digest[20];
+   int            keylen;
+   int            len;
+
+   upgrade = wi_hdrvalue(sess, "Upgrade");
+   if(!upgrade || (stricmp(upgrade, "websocket") != 0))
+      return 0;
+
+   conn = wi_hdrvalue(sess, "Connection");
+   key = wi_hdrvalue(sess, "Sec-WebSocket-Key");
+   ver = wi_hdrvalue(sess, "Sec-WebSocket-Version");
+   keylen = key ? (int)strlen(key) : 0;
+   if(!conn || !strstri(conn, "upgrade") || (keylen == 0) ||
+      (keylen + sizeof(wi_wsguid) > sizeof(accept)) ||
+      !ver || (atoi(ver) != 13))
+   {
+      wi_senderr(sess, 400);  /* Bad request */
+      return WIE_CLIENT;
+   }
+
+   if(!wi_wssameorigin(sess))
+   {
+      wi_senderr(sess, 403);  /* Forbidden */
+      return WIE_CLIENT;
+   }
+
+   handler = cgiGetWsHandler((int8_t *)sess->ws_uri);
+   if(!handler)
+   {
+      wi_senderr(sess, 404);  /* File not found */
+      return WIE_NOFILE;
+   }
+
+   /* Sec-WebSocket-Accept is base64(SHA-1(key + GUID)) */
+   memcpy(accept, key, (size_t)keylen);
+   memcpy(accept + keylen, wi_wsguid, sizeof(wi_wsguid));
+   wi_sha1((u_char *)accept, keylen + (int)sizeof(wi_wsguid) - 1, digest);
+   wi_base64(digest, sizeof(digest), accept);
+
+   cp = wi_hdrbuf(sess);
+   len = sprintf(cp, "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+   if(wi_sendhdr(sess, len))
+      return WIE_SOCKET;
+   wi_cork(sess, FALSE);
+
+   /* Anything after the request header is already frames */
+   len = sess->ws_rxsize - sess->ws_hdrlen;
+   if(len > 0)
+      memmove(sess->ws_rxbuf, &sess->ws_rxbuf[sess->ws_hdrlen], (size_t)len);
+   else
+      len = 0;
+   sess->ws_rxsize = len;
+   sess->ws_data = NULL;
+   sess->ws_hdrcount = 0;
+
+   sess->ws_flags &= ~(WF_PERSIST | WF_CHUNKOK | WF_READINGCMDS);
+   sess->ws_wshandler = handler;
+   sess->ws_wsmsglen = 0;
+   sess->ws_wsopcode = 0;
+   sess->ws_pushnext = cticks();
+   sess->ws_pushsum = 0;
+   sess->ws_state = WI_WEBSOCK;
+   WI_LOCK();
+   sess->ws_worker->ww_replies++;
+   WI_UNLOCK();
+   WI_TIMECANCEL(sess);
+
+   /* select() won't report frames that were read with the header */
+   if(sess->ws_rxsize)
+   {
+      int   error = wi_wsframes(sess);
+      if(error)
+         return error;
+   }
+
+   return 1;
+}
+
+/* wi_wsframes()
+ *
+ * Process the complete frames in ws_rxbuf. Data frames are unmasked
+ * into the message being built at the front of ws_rxbuf, which is
+ * handed to the handler when its last frame arrives. Control frames are
+ * answered and dropped.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+static int
+wi_wsframes(wi_sess * sess)
+{
+   u_char * buf = (u_char *)sess->ws_rxbuf;
+   u_char * fp;
+   u_char * mask;
+   u_char * payload;
+   u_long   plen;
+   int      hlen;
+   int      avail;
+   int      opcode;
+   int      fin;
+   int      error;
+   u_long   i;
+   char     save;
+
+   while(sess->ws_state == WI_WEBSOCK)
+   {
+      fp = buf + sess->ws_wsmsglen;
+      avail = sess->ws_rxsize - sess->ws_wsmsglen;
+      if(avail < 2)
+         return 0;
+
+      fin = fp[0] & 0x80;
+      opcode = fp[0] & 0x0F;
+      /* No extensions are agreed, and client frames must be masked */
+      if((fp[0] & 0x70) || !(fp[1] & 0x80))
+         return wi_wsclose(sess, WS_PROTOCOL);
+
+      plen = fp[1] & 0x7F;
+      hlen = 2;
+      if(plen == 126)
+      {
+         if(avail < 4)
+            return 0;
+         plen = ((u_long)fp[2] << 8) | fp[3];
+         hlen = 4;
+      }
+      else if(plen == 127)
+      {
+         if(avail < 10)
+            return 0;
+         /* Nothing that big fits in ws_rxbuf */
+         return wi_wsclose(sess, WS_TOOBIG);
+      }
+      hlen += 4;
+      if((sess->ws_wsmsglen + hlen + plen) >= sizeof(sess->ws_rxbuf))
+         return wi_wsclose(sess, WS_TOOBIG);
+      if((u_long)avail < (hlen + plen))
+         return 0;
+
+      mask = fp + hlen - 4;
+      payload = fp + hlen;
+      for(i = 0; i < plen; i++)
+         payload[i] ^= mask[i & 3];
+
+      if(opcode & 0x08)    /* control frame */
+      {
+         if(!fin || (plen > 125))
+            return wi_wsclose(sess, WS_PROTOCOL);
+         switch(opcode)
+         {
+         case WS_CLOSE:
+            /* Echo the status and end the connection */
+            wi_wssend(sess, WS_CLOSE, (char *)payload, (plen >= 2) ? 2 : 0);
+            sess->ws_state = WI_ENDING;
+            return 0;
+         case WS_PING:
+            error = wi_wssend(sess, WS_PONG, (char *)payload, (int)plen);
+            if(error)
+               return error;
+            break;
+         case WS_PONG:
+            break;
+         default:
+            return wi_wsclose(sess, WS_PROTOCOL);
+         }
+         avail -= hlen + (int)plen;
+         memmove(fp, fp + hlen + plen, (size_t)avail);
+         sess->ws_rxsize -= hlen + (int)plen;
+         continue;
+      }
+
+      /* Data frame: a new message, or the next part of one */
+      if(opcode == WS_CONT)
+      {
+         if(!sess->ws_wsopcode)
+            return wi_wsclose(sess, WS_PROTOCOL);
+      }
+      else if(sess->ws_wsopcode ||
+         ((opcode != WS_TEXT) && (opcode != WS_BINARY)))
+      {
+         return wi_wsclose(sess, WS_PROTOCOL);
+      }
+      else
+         sess->ws_wsopcode = opcode;
+
+      memmove(fp, payload, (size_t)(avail - hlen));
+      sess->ws_rxsize -= hlen;
+      sess->ws_wsmsglen += (int)plen;
+      if(!fin)
+         continue;
+
+      /* Whole message - null terminate it for the handler */
+      save = sess->ws_rxbuf[sess->ws_wsmsglen];
+      sess->ws_rxbuf[sess->ws_wsmsglen] = 0;
+      error = sess->ws_wshandler->wh_message(sess, sess->ws_wsopcode,
+         sess->ws_rxbuf, sess->ws_wsmsglen);
+      sess->ws_rxbuf[sess->ws_wsmsglen] = save;
+      if(!error)
+         error = wi_wsflush(sess, FALSE);
+      if(error)
+         return error;
+
+      sess->ws_rxsize -= sess->ws_wsmsglen;
+      memmove(buf, buf + sess->ws_wsmsglen, (size_t)sess->ws_rxsize);
+      sess->ws_wsmsglen = 0;
+      sess->ws_wsopcode = 0;
+   }
+   return 0;
+}
+
+/* wi_wsread()
+ *
+ * Called when a WebSocket session's socket is readable. Reads what has
+ * arrived and processes any complete frames.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_wsread(wi_sess * sess)
+{
+   int   len;
+
+   len = recv(sess->ws_socket, sess->ws_rxbuf + sess->ws_rxsize,
+      sizeof(sess->ws_rxbuf) - (size_t)sess->ws_rxsize - 1,
+      FREERTOS_MSG_DONTWAIT);
+   if(len < 0)
+   {
+      if(errno == EWOULDBLOCK)
+         return 0;
+      return WIE_SOCKET;
+   }
+   if(len == 0)
+      return 0;
+   sess->ws_rxsize += len;
+   wi_touch(sess);
+
+   return wi_wsframes(sess);
+}
+
+/* wi_wspush()
+ *
+ * Called for each WebSocket session on each pass of wi_poll(). Once
+ * every WI_PUSHPOLL seconds runs the handler's poll routine and sends
+ * what it queues if that has changed. Pings the client if nothing has
+ * been sent for WI_PUSHKEEP seconds.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_wspush(wi_sess * sess)
+{
+   u_long   now = cticks();
+   int      error;
+
+   if((sess->ws_state != WI_WEBSOCK) ||
+      ((long)(now - sess->ws_pushnext) < 0))
+   {
+      return 0;
+   }
+   sess->ws_pushnext = now + (WI_PUSHPOLL * TPS);
+
+   if(sess->ws_wshandler->wh_poll)
+   {
+      error = sess->ws_wshandler->wh_poll(sess);
+      if(!error)
+         error = wi_wsflush(sess, TRUE);
+      if(error)
+         return error;
+   }
+   if((long)(now - (sess->ws_last + (WI_PUSHKEEP * TPS))) >= 0)
+      return wi_wssend(sess, WS_PING, NULL, 0);
+
+   return 0;
+}
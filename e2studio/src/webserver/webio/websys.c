@@ -48,6 +48,7 @@
  * strnicmp - case insensitive string compare with length parameter
  * stricmp - case insensitive string compare
  * cticks - Function to return the tick count
+ * wi_cycles - Function to return the CPU cycle count
  */
 
 static char gpszDate[64] = "00";
@@ -130,9 +131,9 @@ Description:   Function to get the current system "tick"
 Arguments:     none
 Return value:  The number of mS since the timer was opened
 *****************************************************************************/
-uint32_t cticks(void)
+u_long cticks(void)
 {
-    uint32_t    ulClockTicks = 0UL;
+    u_long      ulClockTicks = 0UL;
     int         iClockTicks = 0;
 
 
@@ -140,7 +141,7 @@ uint32_t cticks(void)
 
     if (iClockTicks >= 0 )
     {
-    	ulClockTicks = (uint32_t)iClockTicks;
+    	ulClockTicks = (u_long)iClockTicks;
     }
 
     return ulClockTicks;
@@ -149,3 +150,47 @@ uint32_t cticks(void)
 End of function  cticks
 ******************************************************************************/
 
+/*****************************************************************************
+Function Name: wi_cycleinit
+Description:   Function to start the DWT cycle counter
+Arguments:     none
+Return value:  none
+*****************************************************************************/
+void wi_cycleinit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+/*****************************************************************************
+End of function  wi_cycleinit
+******************************************************************************/
+
+/*****************************************************************************
+Function Name: wi_cycles
+Description:   Function to get the CPU cycle count. It wraps, so only the
+               difference between two counts is of use
+Arguments:     none
+Return value:  The number of CPU cycles since the counter was started
+*****************************************************************************/
+u_long wi_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+/*****************************************************************************
+End of function  wi_cycles
+******************************************************************************/
+
+/*****************************************************************************
+Function Name: wi_cyclesperus
+Description:   Function to get the rate of the cycle counter
+Arguments:     none
+Return value:  The number of CPU cycles in a microsecond
+*****************************************************************************/
+u_long wi_cyclesperus(void)
+{
+    return SystemCoreClock / 1000000;
+}
+/*****************************************************************************
+End of function  wi_cyclesperus
+******************************************************************************/
+
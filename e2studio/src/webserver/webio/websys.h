@@ -33,6 +33,7 @@
 #define WI_STDFILES  1     /* Use system "fopen" files */
 #define WI_EMBFILES  1     /* Use embedded FS */
 #define WI_THREAD    1     /* Drive webio with a thread rather than polling */
+#define WI_TIMING    1     /* Time the phases of each request, see webtime.c */
 
 #if 0  // DEFAULTS
 
@@ -41,8 +42,30 @@
 #define WI_TXBUFSIZE    1400  /* txbuf[] section size */
 #define WI_MAXURLSIZE   512   /* URL buffer size  */
 #define WI_FSBUFSIZE    (1024 * 4) /* file read buffer size */
+#define WI_MAPCHUNK     (1024 * 32) /* large in-memory file send per poll */
 #define WI_PERSISTTMO   300   /* persistent connection timeout */
+#define WI_TMOHEADER    300   /* request header wait timeout */
+#define WI_TMOPOST      300   /* POST body wait timeout */
+#define WI_TMOSEND      300   /* reply send timeout */
+#define WI_PERSISTMAX   100   /* requests per persistent connection */
+#define WI_MAXHDRS      24    /* header fields indexed per request */
+#define WI_HDRTMPLS     16    /* embedded file header templates kept */
+#define WI_HDRTMPLSIZE  256   /* max size of a header template */
+#define WI_SSIDEPTH     4     /* nesting of precompiled SSI includes */
+#define WI_ROUTEARGS    4     /* {name} parameters in a CGI route */
+#define WI_ROUTEARGSIZE 32    /* bytes of parameter values per request */
+#define WI_MAXAGE_IMAGE  86400   /* Cache-Control max-age of images (seconds) */
+#define WI_MAXAGE_STATIC 3600    /* max-age of other static files (seconds) */
+#define WI_PUSHPOLL     1     /* server push routine poll interval (seconds) */
+#define WI_PUSHKEEP     15    /* server push keep-alive interval (seconds) */
 #define WI_LANG_BUFFER  64    /* Buffer for language string in get request */
+#define WI_MAXSESS      8     /* session pool size (max connections) */
+#define WI_MAXTEXTBUFS  20    /* txbufs of the largest unchunked text reply */
+#define WI_MAXTXBUFS    ((WI_MAXSESS * 2) + WI_MAXTEXTBUFS) /* txbuf pool size */
+#define WI_MAXFILES     (WI_MAXSESS + WI_SSIDEPTH) /* wi_file pool size */
+#define WI_MAXEOFILES   (WI_MAXFILES + WI_SSIDEPTH) /* EOFILE pool size */
+#define WI_MAXPUSH      (WI_MAXSESS / 2) /* open server push streams */
+#define WI_WORKERS      1     /* worker tasks serving the sessions */
 
 
 #endif
@@ -53,9 +76,56 @@
 #define WI_TXBUFSIZE    1400  /* txbuf[] section size */
 #define WI_MAXURLSIZE   512   /* URL buffer size  */
 #define WI_FSBUFSIZE    (1024 * 4) /* file read buffer size */
-#define WI_PERSISTTMO   300   /* persistent connection timeout */
+#define WI_MAPCHUNK     (1024 * 32) /* large in-memory file send per poll */
+#define WI_PERSISTTMO   15    /* idle persistent connection timeout (seconds) */
+#define WI_TMOHEADER    30    /* request header wait timeout (seconds) */
+#define WI_TMOPOST      60    /* POST body wait timeout (seconds) */
+#define WI_TMOSEND      150   /* reply send timeout (seconds) */
+#define WI_PERSISTMAX   100   /* requests per persistent connection */
+#define WI_MAXHDRS      24    /* header fields indexed per request */
+#define WI_HDRTMPLS     16    /* embedded file header templates kept */
+#define WI_HDRTMPLSIZE  256   /* max size of a header template */
+#define WI_SSIDEPTH     4     /* nesting of precompiled SSI includes */
+#define WI_ROUTEARGS    4     /* {name} parameters in a CGI route */
+#define WI_ROUTEARGSIZE 32    /* bytes of parameter values per request */
+#define WI_MAXAGE_IMAGE  86400   /* Cache-Control max-age of images (seconds) */
+#define WI_MAXAGE_STATIC 3600    /* max-age of other static files (seconds) */
+#define WI_PUSHPOLL     1     /* server push routine poll interval (seconds) */
+#define WI_PUSHKEEP     15    /* server push keep-alive interval (seconds) */
 #define WI_LANG_BUFFER  64    /* Buffer for language string in get request */
 
+/* Object pool sizes, from the number of sessions. A chunked text reply
+ * needs no more than two txbufs at a time, but an unchunked one (to an
+ * HTTP/1.0 client) is held in txbufs until it is all built, so there is
+ * room for one of the largest text file besides (module.css is 19).
+ * Each session sends one file, plus an SSI include at each level of
+ * nesting, and pages being compiled open their includes for a moment.
+ * A request that finds a pool empty gets 503 rather than 404.
+ */
+#ifndef WI_MAXSESS
+#define WI_MAXSESS      8     /* session pool size (max connections) */
+#endif
+#define WI_MAXTEXTBUFS  20    /* txbufs of the largest unchunked text reply */
+#define WI_MAXTXBUFS    ((WI_MAXSESS * 2) + WI_MAXTEXTBUFS) /* txbuf pool size */
+#define WI_MAXFILES     (WI_MAXSESS + WI_SSIDEPTH) /* wi_file pool size */
+#define WI_MAXEOFILES   (WI_MAXFILES + WI_SSIDEPTH) /* EOFILE pool size */
+
+/* A server push stream holds its session for as long as the client
+ * keeps it open, so only half the sessions may be streams, the rest
+ * are kept for other requests.
+ */
+#define WI_MAXPUSH      (WI_MAXSESS / 2) /* open server push streams */
+
+/* Number of worker tasks. Each worker serves its own share of the
+ * sessions, so a slow CGI handler or a large file only holds up the
+ * clients of one worker. Every worker has its own stack and header
+ * buffer, and CGI handlers must be reentrant when this is above 1.
+ * Both can be set from the build, as the host build does.
+ */
+#ifndef WI_WORKERS
+#define WI_WORKERS      1
+#endif
+
 /*********** OS portability ***************/
 
 #include <stdio.h>
@@ -78,6 +148,11 @@ typedef unsigned long u_long;
 /* Variable cticks replaced with function call */
 extern u_long cticks(void);
 
+/* Free running CPU cycle counter, for request timing */
+extern void   wi_cycleinit(void);
+extern u_long wi_cycles(void);
+extern u_long wi_cyclesperus(void);
+
 /* Define TPS (Ticks Per Second). If this is contained an another project with 
  * TPS defined (eg Buster) then use the external definition.
  */
@@ -95,6 +170,18 @@ extern u_long cticks(void);
 #include "semphr.h"
 #include "queue.h"
 
+/* Lock for the data the worker tasks share: the object pools, the
+ * header templates and the statistics.
+ */
+#if WI_WORKERS > 1
+extern SemaphoreHandle_t wi_mutex;
+#define WI_LOCK()       xSemaphoreTake(wi_mutex, portMAX_DELAY)
+#define WI_UNLOCK()     xSemaphoreGive(wi_mutex)
+#else
+#define WI_LOCK()
+#define WI_UNLOCK()
+#endif
+
 typedef Socket_t socktype;
 
 /* Map Webio socket routines to system's */
@@ -113,6 +200,7 @@ typedef Socket_t socktype;
 #define select(a,b)             FreeRTOS_select(a,b)
 
 #define ioctlsocket(a,b,c)      FreeRTOS_ioctl(a,b,c)
+#define setsockopt(a,b,c,d,e)   FreeRTOS_setsockopt(a,b,c,d,e)
 
 /*********** File system mapping ***************/
 
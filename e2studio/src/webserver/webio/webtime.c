@@ -0,0 +1,215 @@
+/* webtime.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * Request phase timing. Each request is stamped with the CPU cycle
+ * counter as it moves from one phase to the next (see wiphase in
+ * webio.h), and when the reply is done the time of each phase is added
+ * to a latency histogram for the kind of URL requested. Build without
+ * WI_TIMING in websys.h and the stamps compile away.
+ *
+ * The cycle count wraps after 2^32 cycles (21 seconds at 200 MHz), so a
+ * phase longer than that is timed short. The only phases that can be
+ * are waits on the client, which the session timeouts limit anyway.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_IP_Private.h"
+#include "FreeRTOS_Sockets.h"
+#include "queue.h"
+
+#include "websys.h"     /* port dependent system files */
+#include "webio.h"
+#include "webfs.h"
+
+#ifdef WI_TIMING
+
+wi_hist  wi_timing[WI_TCLASSES][WI_PHASES];
+
+const char * const wi_phasenames[WI_PHASES] =
+   { "header", "parse", "open", "exec", "queue", "send", "total" };
+
+const char * const wi_tclassnames[WI_TCLASSES] =
+   { "static", "ssi", "cgi" };
+
+/* wi_timestart()
+ *
+ * Called when the first bytes of a request are in ws_rxbuf. Does
+ * nothing if the request is already being timed.
+ */
+
+void
+wi_timestart(wi_sess * sess)
+{
+   if(sess->ws_timing)
+      return;
+
+   sess->ws_timing = TRUE;
+   sess->ws_tclass = WI_TC_STATIC;
+   sess->ws_tstart = sess->ws_tstamp = wi_cycles();
+   memset(sess->ws_tphase, 0, sizeof(sess->ws_tphase));
+   sess->ws_tmarks = 0;
+}
+
+/* wi_timemark()
+ *
+ * Called at the end of a phase of the request. The time since the end
+ * of the last phase is added to this one, so a phase may be passed
+ * through more than once.
+ */
+
+void
+wi_timemark(wi_sess * sess, wiphase phase)
+{
+   u_long   now;
+
+   if(!sess->ws_timing)
+      return;
+
+   now = wi_cycles();
+   /* The DWT cycle counter is 32 bits, wider u_longs don't wrap with it */
+   sess->ws_tphase[phase] += (uint32_t)(now - sess->ws_tstamp);
+   sess->ws_tstamp = now;
+   sess->ws_tmarks |= (1 << phase);
+}
+
+/* wi_timeclass()
+ *
+ * Called once the requested file is open to set the kind of URL.
+ */
+
+void
+wi_timeclass(wi_sess * sess)
+{
+   wi_file *   fi = sess->ws_filelist;
+
+   if(!sess->ws_timing || !fi)
+      return;
+
+#ifdef USE_EMFILES
+   if((fi->wf_routines == &emfs) && ((EOFILE*)fi->wf_fd)->eo_function)
+   {
+      sess->ws_tclass = WI_TC_CGI;
+      return;
+   }
+#endif
+   /* Binary files and text files without SSIs have an entity tag */
+   if((sess->ws_flags & WF_BINARY) || sess->ws_etag)
+      sess->ws_tclass = WI_TC_STATIC;
+   else
+      sess->ws_tclass = WI_TC_SSI;
+}
+
+/* wi_timeadd()
+ *
+ * Add a time to a histogram.
+ */
+
+static void
+wi_timeadd(wi_hist * hist, u_long us)
+{
+   int   bucket = 0;
+
+   while((bucket < (WI_TIMEBUCKETS - 1)) && (us >= (1UL << bucket)))
+      bucket++;
+   hist->wh_bucket[bucket]++;
+   hist->wh_count++;
+   hist->wh_sum += us;
+   if(us > hist->wh_max)
+      hist->wh_max = us;
+}
+
+/* wi_timedone()
+ *
+ * Called when the whole reply has been sent. Adds the times of the
+ * phases the request went through to the histograms.
+ */
+
+void
+wi_timedone(wi_sess * sess)
+{
+   wi_hist *   hists;
+   u_long      perus;
+   int         phase;
+
+   if(!sess->ws_timing)
+      return;
+   sess->ws_timing = FALSE;
+
+   perus = wi_cyclesperus();
+   if(perus == 0)
+      perus = 1;
+   hists = wi_timing[sess->ws_tclass];
+
+   WI_LOCK();
+   for(phase = 0; phase < WI_PH_TOTAL; phase++)
+   {
+      if(sess->ws_tmarks & (1 << phase))
+         wi_timeadd(&hists[phase], sess->ws_tphase[phase] / perus);
+   }
+   wi_timeadd(&hists[WI_PH_TOTAL],
+      (uint32_t)(wi_cycles() - sess->ws_tstart) / perus);
+   WI_UNLOCK();
+}
+
+/* wi_timereset()
+ *
+ * Clear all of the histograms.
+ */
+
+void
+wi_timereset(void)
+{
+   WI_LOCK();
+   memset(wi_timing, 0, sizeof(wi_timing));
+   WI_UNLOCK();
+}
+
+/* wi_timecopy()
+ *
+ * Copy one histogram while the workers may be adding to it, so that its
+ * count, sum and buckets agree.
+ */
+
+void
+wi_timecopy(int tclass, int phase, wi_hist * copy)
+{
+   WI_LOCK();
+   *copy = wi_timing[tclass][phase];
+   WI_UNLOCK();
+}
+
+/* wi_timepercent()
+ *
+ * Returns: the upper limit in microseconds of the bucket holding the
+ * given percentile, or the longest time if that is in the last bucket.
+ */
+
+u_long
+wi_timepercent(wi_hist * hist, int percent)
+{
+   u_long   want;
+   u_long   seen = 0;
+   int      bucket;
+
+   if(hist->wh_count == 0)
+      return 0;
+
+   want = (hist->wh_count * (u_long)percent + 99) / 100;
+   for(bucket = 0; bucket < (WI_TIMEBUCKETS - 1); bucket++)
+   {
+      seen += hist->wh_bucket[bucket];
+      if(seen >= want)
+         return ((1UL << bucket) < hist->wh_max) ? (1UL << bucket) : hist->wh_max;
+   }
+   return hist->wh_max;
+}
+
+#endif   /* WI_TIMING */
@@ -40,13 +40,13 @@
 #include "websys.h"     /* port dependent system files */
 #include "webio.h"
 #include "webfs.h"
+#include "strstri.h"
 
 #include "board_cfg.h"
 #include "common_utils.h"
 #include "portable.h"
 
 
-char hdrbuf[HDRBUFSIZE];   /* For building HTTP headers */
 #define BYTE unsigned char
 
 int   (*wi_execfunc)(wi_sess * sess, char * args) = NULL;
@@ -60,6 +60,14 @@ unsigned atocode(char * cp);
 /* ++ REE/EDC */
 const char * const wi_servername = "Renesas WebEngine V1.0";
 
+/* Binary file send statistics, for throughput measurement */
+u_long   wi_binfiles;
+u_long   wi_binbytes;
+u_long   wi_binticks;
+
+/* Server push streams open, no more than WI_MAXPUSH */
+int      wi_pushsess;
+
 const struct httperror {
 /* -- REE/EDC */
    int      errcode;
@@ -75,17 +83,154 @@ const struct httperror {
    {
        402,  "Payment required",
    },
+   {
+       403,  "Forbidden",
+   },
    {
        404,  "File not found",
    },
    {
        501,  "Server error",
+   },
+   {
+       503,  "Service unavailable",
    }
 };
 
+#define WI_STRX(x)   #x
+#define WI_STR(x)    WI_STRX(x)
+
+static const char wi_connclose[] = "Connection: close\r\n";
+static const char wi_connkeep[] = "Connection: keep-alive\r\n"
+   "Keep-Alive: timeout=" WI_STR(WI_PERSISTTMO) "\r\n";
+
+/* wi_connhdr()
+ *
+ * Print the "Connection:" header field at cp, plus a "Keep-Alive:" field
+ * if the connection is to stay open after this reply.
+ *
+ * Returns: pointer to end of the printed text.
+ */
+
+static char *
+wi_connhdr(char * cp, int persist)
+{
+   const char *   conn = persist ? wi_connkeep : wi_connclose;
+   size_t         len = strlen(conn);
+
+   memcpy(cp, conn, len + 1);
+   return cp + len;
+}
+
+/* Cache-Control of static files */
+wi_cachepolicy wi_cachepolicies[] =
+{
+   { "text/html",    -1 },
+   { "image/",       WI_MAXAGE_IMAGE },
+   { "",             WI_MAXAGE_STATIC },
+};
+
+/* wi_findpolicy()
+ *
+ * Returns: the Cache-Control policy of the reply, or NULL if it is not
+ * a static file.
+ */
+
+static wi_cachepolicy *
+wi_findpolicy(wi_sess * sess)
+{
+   wi_cachepolicy *  policy;
+
+   if(!sess->ws_etag)
+      return NULL;
+   for(policy = wi_cachepolicies; *policy->wc_type; policy++)
+   {
+      if(strncmp(sess->ws_ftype, policy->wc_type, strlen(policy->wc_type)) == 0)
+         break;
+   }
+   return policy;
+}
+
+/* wi_cachehdr()
+ *
+ * Print the "ETag:" and "Cache-Control:" header fields at cp if the
+ * reply is a static file.
+ *
+ * Returns: pointer to end of the printed text.
+ */
+
+static char *
+wi_cachehdr(wi_sess * sess, char * cp)
+{
+   wi_cachepolicy *  policy = wi_findpolicy(sess);
+
+   if(!policy)
+      return cp;
+   if(policy->wc_maxage < 0)
+      cp += sprintf(cp, "ETag: %s\r\nCache-Control: no-cache\r\n", sess->ws_etag);
+   else
+   {
+      cp += sprintf(cp, "ETag: %s\r\nCache-Control: max-age=%ld\r\n",
+         sess->ws_etag, policy->wc_maxage);
+   }
+   return cp;
+}
+
+/* Extra header field of a reply sent from a file's gzip copy */
+static const char wi_gziphdr[] = "Content-Encoding: gzip\r\n";
+
+/* Either copy of a file with a gzip copy may be sent, so caches must
+ * keep the reply by Accept-Encoding.
+ */
+static const char wi_varyhdr[] = "Vary: Accept-Encoding\r\n";
+
+/* Binary files are sent by wi_movebinary(), which takes Range requests */
+static const char wi_rangeshdr[] = "Accept-Ranges: bytes\r\n";
+
+/* wi_bodyread()
+ *
+ * Called before a request is answered early, to see whether its body
+ * can be skipped to find the next request. A body is only skipped if
+ * it has a Content-Length and is all in rxbuf already; ws_contentLength
+ * is set so that wi_nextreq() skips it.
+ *
+ * Returns: TRUE if the request has no body, or all of it is in rxbuf.
+ */
+
+static int
+wi_bodyread(wi_sess * sess)
+{
+   char *   cl;
+   char *   end;
+   long     len = 0;
+
+   if(wi_hdrvalue(sess, "Transfer-Encoding"))
+      return FALSE;
+   cl = wi_hdrvalue(sess, "Content-Length");
+   if(cl)
+   {
+      len = strtol(cl, &end, 10);
+      if((end == cl) || *end || (len < 0) || (len > WI_RXBUFSIZE))
+         return FALSE;
+   }
+   if(len == 0)
+      return TRUE;
+   if(!sess->ws_data ||
+      ((sess->ws_data - sess->ws_rxbuf) + len > sess->ws_rxsize))
+   {
+      return FALSE;
+   }
+   sess->ws_contentLength = (int)len;
+   return TRUE;
+}
+
 /* wi_senderr()
  *
  * This is called when a session needs to send an error to the client..
+ * A "File not found" found while parsing the header of a request on a
+ * persistent connection leaves it open for the next request, if any
+ * body of the request is all in rxbuf to be skipped. All other errors
+ * close the connection.
  *
  * Returns: 0 if a;ll went OK, else negative WIE_ error code.
  */
@@ -94,8 +239,11 @@ int
 wi_senderr(wi_sess * sess, int httpcode )
 {
    int      i;
+   int      persist;
    char *   cp;
    char *   errortext = "Unknown HTTP Error";
+   char     body[200 + WI_MAXURLSIZE];
+   char *   hdrbuf = wi_hdrbuf(sess);
 
    for(i = 0; i < (sizeof(httperrors)/sizeof(struct httperror)); i++)
    {
@@ -120,58 +268,250 @@ wi_senderr(wi_sess * sess, int httpcode )
    }
    sprintf(cp, "Server: %s\r\n", wi_servername );
    cp += strlen(cp);
-   sprintf(cp, "Connection: close\r\n\r\n");
-   cp += strlen(cp);
+
+   persist = ((sess->ws_flags & WF_PERSIST) &&
+              (sess->ws_state == WI_HEADER) &&
+              (httpcode == 404) && wi_bodyread(sess));
+   cp = wi_connhdr(cp, persist);
 
    /* Add some text for browser to display */
-   sprintf(cp, "<html><head><title>Error %d</title></head>\r\n", httpcode);
-   cp += strlen(cp);
-   sprintf(cp, "<body><h2>Error %d: %s<br></h2>\r\n",
+   i = sprintf(body, "<html><head><title>Error %d</title></head>\r\n", httpcode);
+   i += sprintf(body + i, "<body><h2>Error %d: %s<br></h2>\r\n",
       httpcode, errortext);
-   cp += strlen(cp);
    if(sess->ws_uri)
    {
-      sprintf(cp, "File: %s<br>\r\n", sess->ws_uri);
-      cp += strlen(cp);
+      i += sprintf(body + i, "File: %.*s<br>\r\n",
+         WI_MAXURLSIZE, sess->ws_uri);
    }
+   i += sprintf(body + i, "</body></html>\r\n");
 
-   sprintf(cp, "</body></html>\r\n");
+   sprintf(cp, "Content-Length: %d\r\n\r\n", i);
    cp += strlen(cp);
+   snprintf(cp, HDRBUFSIZE - (size_t)(cp - hdrbuf), "%s", body);
 
    send(sess->ws_socket, hdrbuf, strlen(hdrbuf), 0);
 
+   if(persist)
+      return wi_nextreq(sess);
+
    /* Close socket and mark session for deletion */
-   closesocket(sess->ws_socket);
-   sess->ws_socket = (socktype)INVALID_SOCKET;
+   wi_sockclose(sess);
    sess->ws_state = WI_ENDING;
 
    return 0;      /* OK Return */
 }
 
 
-int
-wi_replyhdr(wi_sess * sess, int contentlen)
+/* wi_cork()
+ *
+ * While a socket is corked the TCP stack only sends full sized (MSS)
+ * segments, so the reply header and the body queued after it are packed
+ * together instead of going out as a short header segment followed by
+ * segments split at txbuf boundaries. Uncorking sends whatever is left.
+ */
+
+void
+wi_cork(wi_sess * sess, int cork)
 {
-   char *   cp;
-   int      hdrlen;
-   volatile int      error;
+   BaseType_t  fullsize = cork ? pdTRUE : pdFALSE;
 
-   sprintf(hdrbuf, "HTTP/1.1 200 OK\r\n");
-   cp = hdrbuf + strlen(hdrbuf);
+   setsockopt(sess->ws_socket, 0, FREERTOS_SO_SET_FULL_SIZE,
+      &fullsize, sizeof(fullsize));
+}
+
+/* wi_hdrfields()
+ *
+ * Print the header fields of a reply which come between the status line
+ * and the length of the body at cp.
+ *
+ * Returns: pointer to end of the printed text.
+ */
+
+static char *
+wi_hdrfields(wi_sess * sess, char * cp)
+{
    sprintf(cp, "Date: %s GMT\r\n", wi_getdate(sess) );
    cp += strlen(cp);
    sprintf(cp, "Server: %s\r\n", wi_servername );
    cp += strlen(cp);
-   sprintf(cp, "Connection: close\r\n");
-   cp += strlen(cp);
+   cp = wi_connhdr(cp, sess->ws_flags & WF_PERSIST);
    sprintf(cp, "Content-Type: %s\r\n", sess->ws_ftype );
    cp += strlen(cp);
-   sprintf(cp, "Content-Length: %d\r\n\r\n", contentlen );
+   cp = wi_cachehdr(sess, cp);
+   if(sess->ws_flags & WF_GZIP)
+      cp += sprintf(cp, "%s", wi_gziphdr);
+   if(sess->ws_flags & WF_GZVARY)
+      cp += sprintf(cp, "%s", wi_varyhdr);
+   if(sess->ws_flags & WF_BINARY)
+      cp += sprintf(cp, "%s", wi_rangeshdr);
+   return cp;
+}
+
+/* wi_buildhdr()
+ *
+ * Build the "200 OK" header for a reply of contentlen bytes, or for a
+ * chunked reply if contentlen is negative, in hdr,
+ * which must hold HDRBUFSIZE bytes.
+ *
+ * Returns: length of the header.
+ */
+
+int
+wi_buildhdr(wi_sess * sess, char * hdr, int contentlen)
+{
+   char *   cp;
+
+   sprintf(hdr, "HTTP/1.1 200 OK\r\n");
+   cp = wi_hdrfields(sess, hdr + strlen(hdr));
+   if(contentlen < 0)
+      sprintf(cp, "Transfer-Encoding: chunked\r\n\r\n");
+   else
+      sprintf(cp, "Content-Length: %d\r\n\r\n", contentlen );
    cp += strlen(cp);
 
-   hdrlen = (int) strlen(hdrbuf);
+   return (int)(cp - hdr);
+}
+
+/* Header templates for embedded files. Apart from the date and the
+ * connection fields, the "200 OK" header for a file in the EFS image
+ * only depends on the file, so it is formatted the first time the file
+ * is sent and kept here, keyed by the address of the file data. The
+ * same data may be sent with other fields (a gzip copy asked for by
+ * its own name, say), so the template also records what its fields
+ * were made from.
+ */
 
-   error = send(sess->ws_socket, hdrbuf, (size_t)hdrlen, 0);
+typedef struct wi_hdrtmpl_s
+{
+   const void *   ht_key;           /* file data in the EFS image */
+   int            ht_clen;          /* Content-Length in ht_text */
+   int            ht_flags;         /* WF_GZIP and WF_GZVARY of the reply */
+   const char *   ht_ftype;         /* Content-Type */
+   const char *   ht_etag;          /* ETag, or NULL */
+   wi_cachepolicy * ht_policy;      /* Cache-Control, or NULL */
+   int            ht_len;           /* length of ht_text */
+   char           ht_text[WI_HDRTMPLSIZE];
+} wi_hdrtmpl;
+
+static wi_hdrtmpl wi_hdrtmpls[WI_HDRTMPLS];
+static int        wi_hdrtmplnext;   /* next slot to reuse */
+
+/* wi_buildfilehdr()
+ *
+ * Build the "200 OK" header for an embedded file in hdr from its
+ * template, making the template on the first call for the file. Only
+ * the date and connection fields are added each time, without any
+ * formatting. If the file's template was made with other fields, the
+ * header is built without one.
+ *
+ * Returns: length of the header.
+ */
+
+int
+wi_buildfilehdr(wi_sess * sess, char * hdr, const void * key, int contentlen)
+{
+   wi_hdrtmpl *   tmpl = NULL;
+   wi_cachepolicy * policy = wi_findpolicy(sess);
+   int            flags = sess->ws_flags & (WF_GZIP | WF_GZVARY);
+   char *         cp;
+   char *         date;
+   char           cache[80];
+   size_t         len;
+   int            i;
+
+   WI_LOCK();
+   for(i = 0; i < WI_HDRTMPLS; i++)
+   {
+      if((wi_hdrtmpls[i].ht_key == key) &&
+         (wi_hdrtmpls[i].ht_clen == contentlen))
+      {
+         tmpl = &wi_hdrtmpls[i];
+         break;
+      }
+   }
+   if(tmpl &&
+      ((tmpl->ht_flags != flags) || (tmpl->ht_ftype != sess->ws_ftype) ||
+       (tmpl->ht_etag != sess->ws_etag) || (tmpl->ht_policy != policy)))
+   {
+      WI_UNLOCK();
+      return wi_buildhdr(sess, hdr, contentlen);
+   }
+   if(!tmpl)
+   {
+      tmpl = &wi_hdrtmpls[wi_hdrtmplnext];
+      *wi_cachehdr(sess, cache) = 0;
+      i = snprintf(tmpl->ht_text, sizeof(tmpl->ht_text),
+         "HTTP/1.1 200 OK\r\nServer: %s\r\nContent-Type: %s\r\n%s%s%s%s"
+         "Content-Length: %d\r\n", wi_servername, sess->ws_ftype, cache,
+         (flags & WF_GZIP) ? wi_gziphdr : "",
+         (flags & WF_GZVARY) ? wi_varyhdr : "", wi_rangeshdr, contentlen);
+      if((i < 0) || (i >= (int)sizeof(tmpl->ht_text)))
+      {
+         tmpl->ht_key = NULL;
+         WI_UNLOCK();
+         return wi_buildhdr(sess, hdr, contentlen);  /* too big to keep */
+      }
+      tmpl->ht_key = key;
+      tmpl->ht_clen = contentlen;
+      tmpl->ht_flags = flags;
+      tmpl->ht_ftype = sess->ws_ftype;
+      tmpl->ht_etag = sess->ws_etag;
+      tmpl->ht_policy = policy;
+      tmpl->ht_len = i;
+      wi_hdrtmplnext = (wi_hdrtmplnext + 1) % WI_HDRTMPLS;
+   }
+
+   memcpy(hdr, tmpl->ht_text, (size_t)tmpl->ht_len);
+   cp = hdr + tmpl->ht_len;
+   WI_UNLOCK();
+   memcpy(cp, "Date: ", 6);
+   cp += 6;
+   date = wi_getdate(sess);
+   len = strlen(date);
+   memcpy(cp, date, len);
+   cp += len;
+   memcpy(cp, " GMT\r\n", 6);
+   cp += 6;
+   cp = wi_connhdr(cp, sess->ws_flags & WF_PERSIST);
+   memcpy(cp, "\r\n", 3);
+   cp += 2;
+
+   return (int)(cp - hdr);
+}
+
+/* wi_flushhdrtmpls()
+ *
+ * Forget the header templates, whose keys are only file data addresses,
+ * when an EFS image is mounted where another one was.
+ */
+
+void
+wi_flushhdrtmpls(void)
+{
+   int      i;
+
+   WI_LOCK();
+   for(i = 0; i < WI_HDRTMPLS; i++)
+      wi_hdrtmpls[i].ht_key = NULL;
+   WI_UNLOCK();
+}
+
+/* wi_sendhdr()
+ *
+ * Send the hdrlen bytes of header in the worker's wi_hdrbuf(). The
+ * socket is corked until wi_txdone() so the body shares segments with
+ * the header.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_sendhdr(wi_sess * sess, int hdrlen)
+{
+   volatile int      error;
+
+   wi_cork(sess, TRUE);
+   error = send(sess->ws_socket, wi_hdrbuf(sess), (size_t)hdrlen, 0);
 
    if(error < hdrlen)
    {
@@ -184,6 +524,407 @@ wi_replyhdr(wi_sess * sess, int contentlen)
    return 0;
 }
 
+/* wi_notmodified()
+ *
+ * Called with the file for a GET request open. Sets the entity tag of
+ * the reply if the file is static, and if the client already has a copy
+ * with that tag answers with a body-less "304 Not Modified" in place of
+ * the file.
+ *
+ * Returns: TRUE if the 304 reply was sent, else FALSE.
+ */
+
+int
+wi_notmodified(wi_sess * sess)
+{
+   wi_file *   fi = sess->ws_filelist;
+   char *      match;
+   char *      cp;
+
+   sess->ws_etag = NULL;
+#ifdef USE_EMFILES
+   if(fi->wf_routines == &emfs)
+   {
+      sess->ws_etag = em_etag((EOFILE*)fi->wf_fd,
+         sess->ws_flags & WF_BINARY);
+   }
+#endif
+   if(!sess->ws_etag)
+      return FALSE;
+
+   match = wi_hdrvalue(sess, "If-None-Match");
+   if(!match ||
+      ((strcmp(match, "*") != 0) && (strstr(match, sess->ws_etag) == NULL)))
+   {
+      return FALSE;
+   }
+
+   cp = wi_hdrbuf(sess);
+   cp += sprintf(cp, "HTTP/1.1 304 Not Modified\r\nDate: %s GMT\r\n"
+      "Server: %s\r\n", wi_getdate(sess), wi_servername);
+   cp = wi_cachehdr(sess, cp);
+   if(sess->ws_flags & WF_GZVARY)
+      cp += sprintf(cp, "%s", wi_varyhdr);
+   cp = wi_connhdr(cp, sess->ws_flags & WF_PERSIST);
+   memcpy(cp, "\r\n", 3);
+   cp += 2;
+
+   wi_fclose(fi);
+   if(wi_sendhdr(sess, (int)(cp - wi_hdrbuf(sess))))
+   {
+      wi_sockclose(sess);
+      sess->ws_state = WI_ENDING;
+      return TRUE;
+   }
+   wi_txdone(sess);
+   return TRUE;
+}
+
+/* wi_acceptgzip()
+ *
+ * Returns: TRUE if the Accept-Encoding field of the request lists gzip
+ * with a non-zero quality, else FALSE.
+ */
+
+static int
+wi_acceptgzip(wi_sess * sess)
+{
+   const char *   cp;
+
+   cp = wi_hdrvalue(sess, "Accept-Encoding");
+   if(!cp || ((cp = strstri(cp, "gzip")) == NULL))
+      return FALSE;
+   cp += 4;
+   while(*cp == ' ')
+      cp++;
+   if(*cp != ';')
+      return TRUE;
+   do
+      cp++;
+   while(*cp == ' ');
+   if(((*cp != 'q') && (*cp != 'Q')) || (cp[1] != '='))
+      return TRUE;
+   cp += 2;
+   /* "q=0", "q=0.0" and so on turn it off */
+   if(*cp++ != '0')
+      return TRUE;
+   if(*cp == '.')
+   {
+      do
+         cp++;
+      while(*cp == '0');
+   }
+   return ((*cp >= '1') && (*cp <= '9'));
+}
+
+/* wi_fopengz()
+ *
+ * Open the gzip copy ("name.gz") of a file for a client that takes
+ * gzip content. The copy is sent as is, so it is marked binary.
+ *
+ * Returns: 0 if OK else negative WIE_ error code.
+ */
+
+int
+wi_fopengz(wi_sess * sess, char * name)
+{
+   char     gzname[WI_MAXURLSIZE + 4];
+   size_t   len = strlen(name);
+   int      error;
+
+   if((len >= WI_MAXURLSIZE) || !wi_acceptgzip(sess))
+      return WIE_NOFILE;
+   memcpy(gzname, name, len);
+   memcpy(gzname + len, ".gz", 4);
+   error = wi_fopen(sess, gzname, "r");
+   if(!error)
+      sess->ws_flags |= (WF_GZIP | WF_GZVARY | WF_BINARY);
+   return error;
+}
+
+/* wi_gzvariant()
+ *
+ * Called with the file for a GET request open and its type set. If the
+ * file is static and there is a gzip copy of it the client can take,
+ * replace the open file with the copy. A client that cannot take the
+ * copy still gets the Vary field, as the reply depends on it.
+ */
+
+void
+wi_gzvariant(wi_sess * sess, char * name)
+{
+   wi_file *   raw = sess->ws_filelist;
+#ifdef USE_EMFILES
+   char        gzname[WI_MAXURLSIZE + 4];
+   size_t      len = strlen(name);
+   WI_FILE *   gz;
+#endif
+
+   if(sess->ws_flags & WF_GZIP)
+      return;
+#ifdef USE_EMFILES
+   /* Only files whose reply never changes; pages with SSI are made
+    * from the uncompressed file.
+    */
+   if((raw->wf_routines != &emfs) ||
+      !em_etag((EOFILE*)raw->wf_fd, sess->ws_flags & WF_BINARY))
+   {
+      return;
+   }
+   if(wi_acceptgzip(sess))
+   {
+      if(wi_fopengz(sess, name) == 0)
+         wi_fclose(raw);
+      return;
+   }
+   if(len >= WI_MAXURLSIZE)
+      return;
+   memcpy(gzname, name, len);
+   memcpy(gzname + len, ".gz", 4);
+   gz = emfs.wfs_fopen(gzname, "r");
+   if(gz)
+   {
+      emfs.wfs_fclose(gz);
+      sess->ws_flags |= WF_GZVARY;
+   }
+#else
+   USE_ARG(raw);
+   USE_ARG(name);
+#endif
+}
+
+/* wi_parserange()
+ *
+ * Called with a binary file for a GET request open, after its entity
+ * tag is set. If the request asks for a single byte range of the file
+ * (and the file is unchanged, if it has an If-Range field), note the
+ * range for wi_movebinary(). Ranges which cannot be parsed, and lists
+ * of ranges, are ignored so the whole file is sent.
+ */
+
+void
+wi_parserange(wi_sess * sess)
+{
+   char *   cp;
+   char *   end;
+   long     first = -1;
+   long     last = -1;
+
+   cp = wi_hdrvalue(sess, "Range");
+   if(!cp || (strnicmp(cp, "bytes=", 6) != 0) || strchr(cp, ','))
+      return;
+   cp += 6;
+   while(*cp == ' ')
+      cp++;
+   if(isdigit((unsigned char)*cp))
+   {
+      first = strtol(cp, &end, 10);
+      cp = end;
+   }
+   if(*cp++ != '-')
+      return;
+   if(isdigit((unsigned char)*cp))
+   {
+      last = strtol(cp, &end, 10);
+      cp = end;
+   }
+   while(*cp == ' ')
+      cp++;
+   if(*cp || ((first < 0) && (last < 0)) ||
+      ((first >= 0) && (last >= 0) && (first > last)))
+   {
+      return;
+   }
+
+   cp = wi_hdrvalue(sess, "If-Range");
+   if(cp && (!sess->ws_etag || (strcmp(cp, sess->ws_etag) != 0)))
+      return;
+
+   /* A suffix range ("bytes=-N") is kept as first -1, last N */
+   sess->ws_rangefirst = first;
+   sess->ws_rangelast = last;
+   sess->ws_flags |= WF_RANGE;
+}
+
+/* wi_rangehdr()
+ *
+ * Fit the range noted by wi_parserange() to the file, position the file
+ * at the start of it and send the "206 Partial Content" header, or a
+ * "416 Range Not Satisfiable" header with no body if none of the range
+ * is in the file. Sets the number of bytes to send.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+static int
+wi_rangehdr(wi_sess * sess, wi_file * fi, long filelen)
+{
+   long     first = sess->ws_rangefirst;
+   long     last = sess->ws_rangelast;
+   char *   hdr = wi_hdrbuf(sess);
+   char *   cp;
+
+   if(first < 0)        /* last N bytes */
+   {
+      first = (last < filelen) ? (filelen - last) : 0;
+      last = filelen - 1;
+   }
+   else if((last < 0) || (last >= filelen))
+      last = filelen - 1;
+
+   /* Drop the block wi_readfile() read from the start of the file */
+   fi->wf_inbuf = 0;
+
+   if((first >= filelen) || (last < first))
+   {
+      sess->ws_binleft = 0;
+      cp = hdr + sprintf(hdr, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+         "Date: %s GMT\r\nServer: %s\r\nContent-Range: bytes */%ld\r\n",
+         wi_getdate(sess), wi_servername, filelen);
+      cp = wi_connhdr(cp, sess->ws_flags & WF_PERSIST);
+      cp += sprintf(cp, "Content-Length: 0\r\n\r\n");
+      return wi_sendhdr(sess, (int)(cp - hdr));
+   }
+
+   if(wi_fseek(fi, first, SEEK_SET) != 0)
+      return WIE_BADFILE;
+   sess->ws_binleft = last - first + 1;
+
+   sprintf(hdr, "HTTP/1.1 206 Partial Content\r\n");
+   cp = wi_hdrfields(sess, hdr + strlen(hdr));
+   cp += sprintf(cp, "Content-Range: bytes %ld-%ld/%ld\r\n"
+      "Content-Length: %ld\r\n\r\n", first, last, filelen, sess->ws_binleft);
+   return wi_sendhdr(sess, (int)(cp - hdr));
+}
+
+/* wi_pushstart()
+ *
+ * Called by a server push file's function the first time it runs, to
+ * turn the reply into an event stream. Sends the header, after which
+ * the connection stays open and the function is polled by wi_push()
+ * for updates. Only the function is kept, the file is closed once the
+ * header is sent. If WI_MAXPUSH streams are open already the client
+ * gets 503 instead.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_pushstart(wi_sess * sess)
+{
+   char *   hdr = wi_hdrbuf(sess);
+   char *   cp;
+   wi_file * fi = sess->ws_filelist;
+   int      full;
+
+   if(!fi || (fi->wf_routines != &emfs) || !((EOFILE*)fi->wf_fd)->eo_function)
+      return WIE_BADFILE;
+
+   WI_LOCK();
+   full = (wi_pushsess >= WI_MAXPUSH);
+   if(!full)
+      wi_pushsess++;
+   WI_UNLOCK();
+   if(full)
+   {
+      /* The reply is sent, end the request here */
+      while(sess->ws_filelist)
+         wi_fclose(sess->ws_filelist);
+      return wi_senderr(sess, 503);
+   }
+   sess->ws_pushfn = ((EOFILE*)fi->wf_fd)->eo_function;
+
+   /* The stream ends when the connection does */
+   sess->ws_flags &= ~(WF_PERSIST | WF_CHUNKOK);
+   sess->ws_flags |= WF_SVRPUSH;
+   sess->ws_ftype = "text/event-stream";
+   sess->ws_etag = NULL;
+   sess->ws_pushnext = cticks();
+   sess->ws_pushsum = 0;
+
+   sprintf(hdr, "HTTP/1.1 200 OK\r\n");
+   cp = wi_hdrfields(sess, hdr + strlen(hdr));
+   cp += sprintf(cp, "Cache-Control: no-cache\r\n\r\n");
+   return wi_sendhdr(sess, (int)(cp - hdr));
+}
+
+/* wi_txsum() - checksum of the text queued in a session's txbufs */
+
+u_long
+wi_txsum(wi_sess * sess)
+{
+   txbuf *  tx;
+   u_long   sum = 0;
+   int      i;
+
+   for(tx = sess->ws_txbufs; tx; tx = tx->tb_next)
+   {
+      for(i = 0; i < tx->tb_total; i++)
+         sum = (sum * 31) + (u_char)tx->tb_data[i];
+   }
+   return sum;
+}
+
+/* wi_push()
+ *
+ * Called for a server push session waiting in WI_SENDDATA. Once every
+ * WI_PUSHPOLL seconds runs the push function, with a file of its own
+ * for the call, and it queues an update. The update is only sent if it
+ * differs from the last one; if nothing has been sent for WI_PUSHKEEP
+ * seconds an SSE comment is sent instead, so dead clients are found.
+ * A poll that finds no file free is skipped.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_push(wi_sess * sess)
+{
+   u_long      now = cticks();
+   u_long      sum;
+   int         error;
+
+   if((long)(now - sess->ws_pushnext) < 0)
+      return 0;
+   sess->ws_pushnext = now + (WI_PUSHPOLL * TPS);
+
+   if(!sess->ws_pushfn)
+      return WIE_BADFILE;
+   error = em_callfn(sess, sess->ws_pushfn);
+   if(error == WIE_MEMORY)
+      return 0;
+   if(error)
+      return error;
+
+   sum = wi_txsum(sess);
+   if(sum == sess->ws_pushsum)
+   {
+      while(sess->ws_txbufs)
+         wi_txfree(sess->ws_txbufs);
+      if((long)(now - (sess->ws_last + (WI_PUSHKEEP * TPS))) < 0)
+         return 0;
+      wi_printf(sess, ":\n\n");
+   }
+   else
+      sess->ws_pushsum = sum;
+
+   return wi_sockwrite(sess);
+}
+
+/* wi_replyhdr()
+ *
+ * Send the "200 OK" header for a reply of contentlen bytes, or for a
+ * chunked reply if contentlen is negative.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_replyhdr(wi_sess * sess, int contentlen)
+{
+   return wi_sendhdr(sess, wi_buildhdr(sess, wi_hdrbuf(sess), contentlen));
+}
+
 /* wi_movebinary()
  *
  * This is called, often iterativly, to send a binary file to a socket.
@@ -199,6 +940,7 @@ int
 wi_movebinary(wi_sess * sess, wi_file * fi)
 {
    int   filelen;
+   int   toread;
    int   error;
 /* ++ REE/EDC */
    /* lwIP never returns EWOULDBLOCK from the send function. This means
@@ -242,23 +984,102 @@ wi_movebinary(wi_sess * sess, wi_file * fi)
           send_count = -1;
       }
 /* -- REE/EDC */
-      wi_replyhdr(sess, filelen);
+      sess->ws_binleft = filelen;
+      if(sess->ws_flags & WF_RANGE)
+      {
+         error = wi_rangehdr(sess, fi, filelen);
+         if(error)
+            return error;
+      }
+      /* Embedded files get their header from a template */
+      else if(fi->wf_routines->wfs_fmap)
+      {
+         const char *   key;
+         int            left;
+
+         key = fi->wf_routines->wfs_fmap(fi->wf_fd, &left);
+         if(key)
+            error = wi_sendhdr(sess,
+               wi_buildfilehdr(sess, wi_hdrbuf(sess), key, filelen));
+         else
+            error = wi_replyhdr(sess, filelen);
+         if(error)
+            return WIE_SOCKET;
+      }
+      else if(wi_replyhdr(sess, filelen))
+         return WIE_SOCKET;
+      sess->ws_txstart = cticks();
+   }
+
+/* ++ REE/EDC */
+   /* Files which are already in memory (the EFS image) are passed to the
+      TCP stack straight from there, without the copy to wf_data. Small
+      files go in a single send(), big ones WI_MAPCHUNK per call so the
+      other sessions still get serviced. */
+   if(fi->wf_routines->wfs_fmap)
+   {
+      const char *   data;
+      int   left;
+      int   tosend;
+
+      while(sess->ws_state == WI_SENDDATA)
+      {
+         data = fi->wf_routines->wfs_fmap(fi->wf_fd, &left);
+         if(data == NULL)
+            return WIE_BADFILE;
+         if(left > sess->ws_binleft)
+            left = (int)sess->ws_binleft;
+
+         if(left > 0)
+         {
+            tosend = left;
+            if((send_count > 0) && (tosend > WI_MAPCHUNK))
+               tosend = WI_MAPCHUNK;
+            error = send(sess->ws_socket, data, (size_t)tosend, 0);
+            if(error < 0)
+               return WIE_SOCKET;
+            if(error == 0)
+               return 0;      /* try again later */
+            wi_fseek(fi, error, SEEK_CUR);
+            WI_LOCK();
+            wi_binbytes += (u_long)error;
+            WI_UNLOCK();
+            sess->ws_binleft -= error;
+            left -= error;
+         }
+         if(left <= 0)     /* end of file? */
+         {
+            WI_LOCK();
+            wi_binfiles++;
+            wi_binticks += cticks() - sess->ws_txstart;
+            WI_UNLOCK();
+            wi_fclose(fi);
+            wi_txdone(sess);     /* will cause break from while() loop */
+         }
+         else if(send_count > 0)
+            return 0;
+      }
+      return 0;
    }
+/* -- REE/EDC */
 
    while(sess->ws_state == WI_SENDDATA)
    {
       /* see if we need to get another block from the file */
-      if(fi->wf_inbuf == 0)
+      if((fi->wf_inbuf == 0) && (sess->ws_binleft > 0))
       {
+         toread = sizeof(fi->wf_data);
+         if(toread > sess->ws_binleft)
+            toread = (int)sess->ws_binleft;
 /* ++ REE/EDC */
 #ifdef _ANSI_IO_
-         fi->wf_inbuf = wi_fread(fi->wf_data, 1, sizeof(fi->wf_data), fi );
+         fi->wf_inbuf = wi_fread(fi->wf_data, 1, (unsigned)toread, fi );
          if(fi->wf_inbuf < 0)
             return WIE_BADFILE;
 #else
          if(fi->wf_routines == &emfs)
          {
-            fi->wf_inbuf = wi_fread(fi->wf_data, 1, sizeof(fi->wf_data), fi );
+            fi->wf_inbuf = wi_fread(fi->wf_data, 1, (unsigned)toread, fi );
             if(fi->wf_inbuf < 0)
                return WIE_BADFILE;
          }
@@ -269,14 +1090,20 @@ wi_movebinary(wi_sess * sess, wi_file * fi)
                blocks are always transferred by FIFO. Here we get better performance
                by dropping to the low level interfaces */
             int iFile = filePointerToDescriptor(fi->wf_fd);
-            fi->wf_inbuf = read(iFile, (uint8_t*)fi->wf_data, sizeof(fi->wf_data));
+            fi->wf_inbuf = read(iFile, (uint8_t*)fi->wf_data, (size_t)toread);
             if(fi->wf_inbuf < 0)
                return WIE_BADFILE;
          }
 #endif
 /* -- REE/EDC */
+         /* File shorter than it said it was? */
+         if(fi->wf_inbuf == 0)
+            sess->ws_binleft = 0;
       }
-      error = send(sess->ws_socket, fi->wf_data, fi->wf_inbuf, 0);
+      if(fi->wf_inbuf == 0)
+         error = 0;
+      else
+         error = send(sess->ws_socket, fi->wf_data, fi->wf_inbuf, 0);
       if(error < 0)
       {
          error = errno;
@@ -290,8 +1117,16 @@ wi_movebinary(wi_sess * sess, wi_file * fi)
 		 else
             return WIE_SOCKET;
       }
-      if(fi->wf_inbuf < sizeof(fi->wf_data))  /* end of file? */
+      WI_LOCK();
+      wi_binbytes += (u_long)error;
+      WI_UNLOCK();
+      sess->ws_binleft -= fi->wf_inbuf;
+      if(sess->ws_binleft <= 0)  /* end of file or range? */
       {
+         WI_LOCK();
+         wi_binfiles++;
+         wi_binticks += cticks() - sess->ws_txstart;
+         WI_UNLOCK();
          wi_fclose(fi);
          wi_txdone(sess);     /* will cause break from while() loop */
       }
@@ -319,43 +1154,220 @@ wi_movebinary(wi_sess * sess, wi_file * fi)
    return 0;   /* OK return */
 }
 
+/* wi_sendchunk()
+ *
+ * Send len bytes of data as one chunk of a chunked reply.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_sendchunk(wi_sess * sess, char * data, int len)
+{
+   char     size[12];
+   int      sizelen;
+
+   sizelen = sprintf(size, "%x\r\n", len);
+   if((send(sess->ws_socket, size, (size_t)sizelen, 0) != sizelen) ||
+      (send(sess->ws_socket, data, (size_t)len, 0) != len) ||
+      (send(sess->ws_socket, "\r\n", 2, 0) != 2))
+   {
+      return WIE_SOCKET;
+   }
+   wi_touch(sess);
+
+   return 0;
+}
+
+/* wi_txflush()
+ *
+ * Called while a text (SSI or CGI) reply is being built, when the
+ * last txbuf is full. If the client can take a chunked reply the
+ * header is sent on the first call and the buffered txbufs go out as
+ * chunks and are freed, so a page of any size needs only one txbuf.
+ * Otherwise the txbufs are kept until the whole reply is built, as its
+ * length is needed for the header.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_txflush(wi_sess * sess)
+{
+   txbuf *  txbuf;
+   int      error;
+
+   if((sess->ws_flags & WF_CHUNKED) == 0)
+   {
+      if(((sess->ws_flags & WF_CHUNKOK) == 0) ||
+         (sess->ws_flags & (WF_HEADERSENT | WF_BINARY)))
+      {
+         return 0;
+      }
+      error = wi_replyhdr(sess, -1);
+      if(error)
+         return error;
+      sess->ws_flags |= WF_CHUNKED;
+   }
+
+   while(sess->ws_txbufs)
+   {
+      txbuf = sess->ws_txbufs;
+      if(txbuf->tb_total)
+      {
+         error = wi_sendchunk(sess, txbuf->tb_data, txbuf->tb_total);
+         if(error)
+            return error;
+      }
+      wi_txfree(txbuf);
+   }
+
+   return 0;
+}
+
+/* wi_txput()
+ *
+ * Append len bytes of text to the session's txbufs, filling the last
+ * one before another is allocated.
+ *
+ * Returns: 0 if OK, else negative WIE_ error code.
+ */
+
+int
+wi_txput(wi_sess * sess, const char * data, int len)
+{
+   int      tocopy;
+   int      error;
+
+   while(len > 0)
+   {
+      if((sess->ws_txtail == NULL) ||
+         (sess->ws_txtail->tb_total >= WI_TXBUFSIZE))
+      {
+         /* Send what we have so far if the reply can be chunked */
+         if(sess->ws_txtail)
+         {
+            error = wi_txflush(sess);
+            if(error)
+               return error;
+         }
+         if(wi_txalloc(sess) == NULL)
+         {
+            /* txbuf pool is empty, counted in wi_txpool.wp_fails */
+            return WIE_MEMORY;
+         }
+      }
+      tocopy = WI_TXBUFSIZE - sess->ws_txtail->tb_total;
+      if(tocopy > len)
+         tocopy = len;
+      memcpy(&sess->ws_txtail->tb_data[sess->ws_txtail->tb_total], data,
+         (size_t)tocopy);
+      sess->ws_txtail->tb_total += tocopy;
+      data += tocopy;
+      len -= tocopy;
+   }
+   return 0;
+}
+
 int
 wi_txdone(wi_sess * sess)
 {
+   /* All of the reply is queued, flush the last partial segment */
+   wi_cork(sess, FALSE);
+   WI_LOCK();
+   sess->ws_worker->ww_replies++;
+   WI_UNLOCK();
+   WI_TIMEMARK(sess, WI_PH_SEND);
+   WI_TIMEDONE(sess);
 
     /* If connection is persistent change the state to read the next file  */
    if(sess->ws_flags & WF_PERSIST)
    {
-      dtrap();
-      sess->ws_state = WI_HEADER;
-      return 0;
+      return wi_nextreq(sess);
    }
    else if(sess->ws_flags & WF_SVRPUSH)
    {
-      int   error;
-      WI_FILE * fi;
-
-      dtrap();
-
-      /* poll server push routine */
-      fi = sess->ws_filelist;
-      if(fi->wf_routines->wfs_push == NULL)
-          return WIE_BADFILE;
-      error = fi->wf_routines->wfs_push(fi->wf_fd, sess);
-      return error;
+      /* Stay in WI_SENDDATA, wi_push() sends the next update */
+      return 0;
    }
    else
    {
        /* done with normaal connection - close the socket and mark
        * session for deletion; */
 
-      closesocket(sess->ws_socket);
-      sess->ws_socket = INVALID_SOCKET;
+      wi_sockclose(sess);
       sess->ws_state = WI_ENDING;
    }
    return 0;
 }
 
+/* wi_nextreq()
+ *
+ * Called when the reply to a request on a persistent connection is
+ * complete. Frees anything left over from the request, drops the request
+ * from the front of ws_rxbuf (keeping any pipelined request after it)
+ * and sets the session back to reading a header.
+ *
+ * Returns: 0 if no error, else negative WIE_ error code.
+ */
+
+int
+wi_nextreq(wi_sess * sess)
+{
+   int   used = 0;
+   int   left = 0;
+
+   while(sess->ws_txbufs)
+      wi_txfree(sess->ws_txbufs);
+   while(sess->ws_filelist)
+      wi_fclose(sess->ws_filelist);
+   while(sess->ws_formlist)
+   {
+      wi_form *next = sess->ws_formlist->next;
+      wi_free(sess->ws_formlist);
+      sess->ws_formlist = next;
+   }
+
+   /* ws_data is the start of any body, which is ws_contentLength long */
+   if(sess->ws_data)
+   {
+      used = (int)(sess->ws_data - sess->ws_rxbuf) + sess->ws_contentLength;
+      left = sess->ws_rxsize - used;
+   }
+   if((used <= 0) || (left <= 0))
+      left = 0;
+   else
+      memmove(sess->ws_rxbuf, &sess->ws_rxbuf[used], (size_t)left);
+   memset(&sess->ws_rxbuf[left], 0, sizeof(sess->ws_rxbuf) - (size_t)left);
+   sess->ws_rxsize = left;
+
+   sess->ws_data = NULL;
+   sess->ws_contentLength = 0;
+   sess->ws_hdrscan = 0;
+   sess->ws_hdrline = 0;
+   sess->ws_hdrlen = 0;
+   sess->ws_hdrcount = 0;
+   memset(&sess->ws_method, 0, sizeof(sess->ws_method));
+   memset(&sess->ws_urltok, 0, sizeof(sess->ws_urltok));
+   memset(&sess->ws_version, 0, sizeof(sess->ws_version));
+   sess->ws_uri = NULL;
+   sess->ws_referer = NULL;
+   sess->ws_auth = NULL;
+   sess->ws_host = NULL;
+   sess->ws_form_error = NULL;
+   sess->ws_etag = NULL;
+   sess->ws_cmd = H_INITIAL;
+   sess->ws_flags &= ~(WF_HEADERSENT | WF_BINARY | WF_PERSIST |
+      WF_CHUNKOK | WF_CHUNKED | WF_GZIP | WF_GZVARY | WF_RANGE);
+   sess->ws_flags |= WF_READINGCMDS;
+   sess->ws_reqcount++;
+   sess->ws_state = WI_HEADER;
+   WI_TIMECANCEL(sess);      /* error replies aren't timed */
+   wi_touch(sess);
+
+   return 0;
+}
+
 
 /* wi_nextarg()
  *
@@ -468,6 +1480,137 @@ wi_getline( char * linetype, char * httphdr )
    return NULL;
 }
 
+/* wi_scanheader()
+ *
+ * Incremental HTTP header scanner. This is called each time more of a
+ * request arrives in sess->ws_rxbuf. It carries on from where the last
+ * call stopped, so each byte is looked at once however slowly the client
+ * sends. Complete lines are tokenized into the session header index:
+ * ws_method, ws_urltok and ws_version for the request line and ws_hdrs[]
+ * for the header fields. The URI, version and field values are null
+ * terminated in place. Fields past WI_MAXHDRS are ignored.
+ *
+ * Returns: 1 if the header is complete, 0 if more data is needed, else
+ * negative WIE_ error code.
+ */
+
+int
+wi_scanheader( wi_sess * sess )
+{
+   char *   buf = sess->ws_rxbuf;
+   char *   eol;
+   int      line;
+   int      end;
+   int      pos;
+   wi_hdrfld * fld;
+
+   if(sess->ws_hdrlen)
+      return 1;      /* already complete */
+
+   while(sess->ws_hdrscan < sess->ws_rxsize)
+   {
+      eol = memchr(&buf[sess->ws_hdrscan], '\n',
+         (size_t)(sess->ws_rxsize - sess->ws_hdrscan));
+      if(!eol)
+      {
+         sess->ws_hdrscan = sess->ws_rxsize;
+         return 0;   /* partial line - wait some more */
+      }
+
+      /* Got a complete line, from line to end (excluding CR LF) */
+      line = sess->ws_hdrline;
+      end = (int)(eol - buf);
+      sess->ws_hdrscan = sess->ws_hdrline = end + 1;
+      if((end > line) && (buf[end - 1] == '\r'))
+         end--;
+
+      if(sess->ws_urltok.ht_offset == 0)     /* request line */
+      {
+         if(end == line)
+            continue;   /* skip CR LF left behind by a previous request */
+
+         /* Method, URI and version are separated by spaces */
+         sess->ws_method.ht_offset = (uint16_t)line;
+         for(pos = line; (pos < end) && (buf[pos] != ' '); pos++)
+            ;
+         sess->ws_method.ht_len = (uint16_t)(pos - line);
+         while((pos < end) && (buf[pos] == ' '))
+            pos++;
+         if(pos >= end)
+            return WIE_CLIENT;   /* no URI */
+         sess->ws_urltok.ht_offset = (uint16_t)pos;
+         while((pos < end) && (buf[pos] != ' '))
+            pos++;
+         sess->ws_urltok.ht_len = (uint16_t)(pos - sess->ws_urltok.ht_offset);
+         buf[pos] = 0;
+         if(pos < end)
+            pos++;
+         while((pos < end) && (buf[pos] == ' '))
+            pos++;
+         sess->ws_version.ht_offset = (uint16_t)pos;
+         sess->ws_version.ht_len = (uint16_t)(end - pos);
+         buf[end] = 0;
+         continue;
+      }
+
+      if(end == line)   /* blank line ends the header */
+      {
+         sess->ws_hdrlen = sess->ws_hdrscan;
+         return 1;
+      }
+
+      if(sess->ws_hdrcount >= WI_MAXHDRS)
+         continue;
+
+      /* Split "Name: value" and trim the white space around value */
+      for(pos = line; (pos < end) && (buf[pos] != ':'); pos++)
+         ;
+      if(pos >= end)
+         continue;      /* not a header field */
+      fld = &sess->ws_hdrs[sess->ws_hdrcount++];
+      fld->hf_name.ht_offset = (uint16_t)line;
+      fld->hf_name.ht_len = (uint16_t)(pos - line);
+      for(pos++; (pos < end) && ((buf[pos] == ' ') || (buf[pos] == '\t')); pos++)
+         ;
+      while((end > pos) && ((buf[end - 1] == ' ') || (buf[end - 1] == '\t')))
+         end--;
+      fld->hf_value.ht_offset = (uint16_t)pos;
+      fld->hf_value.ht_len = (uint16_t)(end - pos);
+      buf[end] = 0;
+   }
+
+   return 0;
+}
+
+/* wi_hdrvalue()
+ *
+ * Look up a field in the header index built by wi_scanheader(). The
+ * name is passed without the colon and is not case sensitive.
+ *
+ * Returns: pointer to the null terminated value, or NULL if the request
+ * has no such field.
+ */
+
+char *
+wi_hdrvalue( wi_sess * sess, char * name )
+{
+   int         i;
+   size_t      namelen;
+   wi_hdrfld * fld;
+
+   namelen = strlen(name);
+   for(i = 0; i < sess->ws_hdrcount; i++)
+   {
+      fld = &sess->ws_hdrs[i];
+      if((fld->hf_name.ht_len == namelen) &&
+         (strnicmp(&sess->ws_rxbuf[fld->hf_name.ht_offset], name, namelen) == 0))
+      {
+         return &sess->ws_rxbuf[fld->hf_value.ht_offset];
+      }
+   }
+   return NULL;
+}
+
 /* wi_argterm()
  *
  * Terminates the passed string, which is assumed to be in an HTML
@@ -658,16 +1801,26 @@ const struct wi_ftype {
        0x43535300, "text/css", FT_BINARY, /* CSS */
    },
    #else
-   //{
        #include "mime.inc"
-   //}
    #endif
 };
 
+#define WI_NFTYPES   (sizeof(wi_ftypes) / sizeof(struct wi_ftype))
+
+/* wi_setftype()
+ *
+ * Set the MIME type of the reply, and WF_BINARY unless it is text, from
+ * the extension of the requested file.
+ *
+ * Returns: TRUE if the extension is a known type, else FALSE.
+ */
+
 int
 wi_setftype(wi_sess * sess)
 {
    int      i;
+   int      low;
+   int      high;
    char *   lastdot;
    u_long   type;
 
@@ -696,14 +1849,21 @@ wi_setftype(wi_sess * sess)
          lastdot++;
    }
 
-   /* see if the file is one of the binary types */
-   for(i = 0;i < sizeof(wi_ftypes)/sizeof(struct wi_ftype); i++)
+   /* Binary search of the table, which mime.inc keeps sorted */
+   low = 0;
+   high = (int)WI_NFTYPES - 1;
+   while(low <= high)
    {
-      if(wi_ftypes[i].ext == type)
+      i = (low + high) / 2;
+      if(wi_ftypes[i].ext < type)
+         low = i + 1;
+      else if(wi_ftypes[i].ext > type)
+         high = i - 1;
+      else
       {
          if(wi_ftypes[i].flags & FT_BINARY)
             sess->ws_flags |= WF_BINARY;
-         sess->ws_ftype = wi_ftypes[i].mimetype;;
+         sess->ws_ftype = wi_ftypes[i].mimetype;
          return TRUE;
       }
    }
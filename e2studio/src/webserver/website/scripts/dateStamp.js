@@ -4,6 +4,10 @@ var	gDateStampUpdateTimerStarted = 0;
 var	gDateStampRequestCount	= 0;
 var	gDateStampTimeOut;
 var	gDateStampHttpRequest;
+var	gDateStampEventsFileName = "status_events.cgi";
+var	gDateStampEvents;
+var	gDateStampSocketFileName = "board.ws";
+var	gDateStampSocket;
 function DateStampCreateHttpRequest()
 {
 	var xmlhttp = false;
@@ -110,11 +114,69 @@ function dateStampUpdateTimer()
 		gDateStampTimeOut = setTimeout("dateStampUpdateTimer()", dateStampRefreshInterval);
 	}
 }
+function DateStampFormat(status)
+{
+	return "</div><div id=\"realTimeClock\"><p class=\"boxTitle pb01\">Device ID</p>"
+		+ "<p style=\"margin-left: 44px;\">20057b48 - 57303132<br> 99ed4e36 - 4e4b277d</right></p>"
+		+ "<br><p class=\"boxTitle pb01\">MCU Temperature (F): " + status.tf + "</p><p class=\"boxTitle pb01\">"
+		+ "MCU Temperature (C): " + status.tc + "</p><p class=\"boxTitle pb02\">Blue LED Attributes "
+		+ "</p><p class=\"boxTitle pb02\">Frequency (Hz): " + status.hz
+		+ "</p><p class=\"boxTitle pb03\">Intensity (%): " + status.dc + "</p><br>";
+}
+function DateStampEventUpdate(event)
+{
+	document.getElementById(gDateStampElementID).innerHTML = DateStampFormat(JSON.parse(event.data));
+}
+function DateStampEventsStart()
+{
+	if (window.EventSource)
+	{
+		gDateStampEvents = new EventSource(gDateStampEventsFileName);
+		gDateStampEvents.onmessage = DateStampEventUpdate;
+	}
+	else
+	{
+		dateStampUpdateTimer();
+	}
+}
+function DateStampSocketClose()
+{
+	/* Fall back to the event stream if the socket never opened */
+	if (gDateStampSocket && !gDateStampSocket.opened)
+	{
+		DateStampEventsStart();
+	}
+	gDateStampSocket = null;
+}
+function DateStampCommand(command)
+{
+	/* Send a command over the board socket. Returns false if there is no
+	   socket, so the caller can use the CGI instead */
+	if (gDateStampSocket && (gDateStampSocket.readyState == 1))
+	{
+		gDateStampSocket.send(command);
+		return true;
+	}
+	return false;
+}
 function DateStampScreenUpdate()
 {
 	if (!gDateStampUpdateTimerStarted)
 	{
 		gDateStampUpdateTimerStarted = 1;
-		dateStampUpdateTimer();
+		/* The server pushes the status when it changes, so there is
+		   nothing to poll for. The board socket also carries the button
+		   commands. Older browsers use the event stream, or poll */
+		if (window.WebSocket)
+		{
+			gDateStampSocket = new WebSocket("ws://" + location.host + "/" + gDateStampSocketFileName);
+			gDateStampSocket.onopen = function() { this.opened = true; };
+			gDateStampSocket.onmessage = DateStampEventUpdate;
+			gDateStampSocket.onclose = DateStampSocketClose;
+		}
+		else
+		{
+			DateStampEventsStart();
+		}
 	}
 }
@@ -1,3 +1,12 @@
 echo Creating  ..\src\webserver\website.bin
-..\util\EmbedFS -l -g -x -i "..\src\webserver\website\*" -o "..\src\webserver" -f "fswebsite.bin"
+rem The image is made from a copy of the website with a gzip copy of each
+rem compressible file, served to clients that send "Accept-Encoding: gzip".
+rem Every file keeps its raw copy as well (gzip -k), for SSI, the language
+rem folders and clients without gzip.
+set EFS_STAGE=%TEMP%\efs_website
+if exist "%EFS_STAGE%" rmdir /s /q "%EFS_STAGE%"
+xcopy /e /i /q "..\src\webserver\website" "%EFS_STAGE%"
+for /r "%EFS_STAGE%" %%f in (*.html *.htm *.css *.js) do gzip -9 -n -k "%%f"
+..\util\EmbedFS -l -g -x -i "%EFS_STAGE%\*" -o "..\src\webserver" -f "fswebsite.bin"
+rmdir /s /q "%EFS_STAGE%"
 echo Script complete
@@ -0,0 +1,372 @@
+/* efsverify.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * Checks an EFS image with the efsFile.c the server uses. Every file in
+ * the chain is looked up with efsFindFile() by its path, with both kinds
+ * of slash and in upper case, and must come back with its own data. With
+ * a folder, the data must also be the same as the file in the folder,
+ * and every file in the folder must be in the image. A version 2 image
+ * must give the same answers from its hash table as from the chain, and
+ * its entity tags must be those em_etag() makes. Then the lookups are
+ * timed, through efsFindFile() and through the chain alone.
+ *
+ * Usage: efsverify [-n loops] image [folder]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "efsFile.h"
+
+#define EFS_ENDIANTAG   0x87654321UL
+
+typedef struct efs_path
+{
+   char *            ep_path;    /* "/dir/name" */
+   PEFILE            ep_file;
+} efs_path;
+
+static uint8_t *  image;
+static size_t     imagelen;
+static PEFILE     root;          /* start of the chain */
+static PEFSINDEX  pindex;        /* hash table header, version 2 */
+
+static efs_path * paths;
+static int        npaths;
+static int        errors;
+
+static void
+error(const char * path, const char * msg)
+{
+   printf("**Error: %s: %s\n", path, msg);
+   errors++;
+}
+
+static void
+load(const char * name)
+{
+   FILE *      fp;
+   struct stat st;
+   PVERSION    pver;
+
+   fp = fopen(name, "rb");
+   if(!fp || fstat(fileno(fp), &st))
+   {
+      perror(name);
+      exit(1);
+   }
+   imagelen = (size_t)st.st_size;
+   /* The image must be 4 byte aligned, as it is in flash, which
+    * malloc() memory is
+    */
+   image = malloc(imagelen);
+   if(!image || (fread(image, 1, imagelen, fp) != imagelen))
+   {
+      perror(name);
+      exit(1);
+   }
+   fclose(fp);
+
+   pver = (PVERSION)image;
+   if((imagelen < sizeof(VERSION) + sizeof(EFILE)) ||
+      (pver->ulEndianTag != EFS_ENDIANTAG))
+   {
+      printf("%s: not an EFS image of this endian\n", name);
+      exit(1);
+   }
+   root = (PEFILE)(image + sizeof(VERSION));
+   if(pver->ulVersion >= EFS_VERSION_INDEXED)
+   {
+      pindex = (PEFSINDEX)root;
+      root = (PEFILE)(image + pindex->ulRootOffset);
+   }
+}
+
+/* List the files of every directory of the chain */
+static void
+walk(void)
+{
+   PEFILE      dir;
+   PEFILE      file;
+   PEFILE      end;
+   const char *   dirname;
+
+   for(dir = root; dir->fileHeader.ulNextOffset;
+      dir = (PEFILE)((uint8_t *)dir + dir->fileHeader.ulDataLength))
+   {
+      if(dir->fileHeader.ulDataOffset != 0)
+      {
+         error((char *)&dir->szName, "directory entry with data");
+         return;
+      }
+      dirname = (const char *)&dir->szName;
+      end = (PEFILE)((uint8_t *)dir + dir->fileHeader.ulDataLength);
+      for(file = (PEFILE)((uint8_t *)dir + dir->fileHeader.ulNextOffset);
+         file < end;
+         file = (PEFILE)((uint8_t *)file + file->fileHeader.ulNextOffset))
+      {
+         paths = realloc(paths, sizeof(efs_path) * (size_t)(npaths + 1));
+         paths[npaths].ep_path = malloc(strlen(dirname) +
+            strlen((char *)&file->szName) + 2);
+         sprintf(paths[npaths].ep_path, "%s%s%s", dirname,
+            dirname[1] ? "\\" : "", (char *)&file->szName);
+         paths[npaths].ep_file = file;
+         npaths++;
+         if(((uintptr_t)file + file->fileHeader.ulDataOffset) & 3)
+            error(paths[npaths - 1].ep_path, "data not 4 byte aligned");
+      }
+   }
+}
+
+/* Look path up with efsFindFile(), and by the chain alone when a version
+ * 2 image has a table, and check both find file.
+ */
+static void
+lookup(const char * path, PEFILE file)
+{
+   EFS      efs;
+   EFS      chain;
+   char     find[1024];
+   EFSERR   err;
+   const uint8_t * data = (const uint8_t *)file + file->fileHeader.ulDataOffset;
+
+   snprintf(find, sizeof(find), "%s", path);
+   err = efsFindFile(image, (int8_t *)find, &efs);
+   if(err != EFS_OK)
+   {
+      printf("**Error: %s: efsFindFile error %d\n", path, (int)err);
+      errors++;
+      return;
+   }
+   if((efs.pbyFileData != data) ||
+      (efs.ulFileLength != file->fileHeader.ulDataLength))
+   {
+      error(path, "efsFindFile found another file");
+   }
+   if(pindex)
+   {
+      err = efsSearch(root, (int8_t *)find, &chain);
+      if((err != EFS_OK) || (chain.pbyFileData != efs.pbyFileData) ||
+         (strcmp((char *)chain.pszFilePath, (char *)efs.pszFilePath) != 0))
+      {
+         error(path, "hash table and chain differ");
+      }
+   }
+}
+
+static void
+check_etag(const char * path, PEFILE file)
+{
+   EFS      efs;
+   char     tag[24];
+   uint32_t hash = 0x811c9dc5UL;
+   uint32_t i;
+   const uint8_t * data = (const uint8_t *)file + file->fileHeader.ulDataOffset;
+
+   if(efsFindFile(image, (int8_t *)path, &efs) != EFS_OK)
+      return;
+   if(!efs.pszETag)
+   {
+      if(pindex->ulHeaderSize >= sizeof(EFSINDEX) && pindex->ulETagOffset)
+         error(path, "no entity tag");
+      return;
+   }
+   for(i = 0; i < file->fileHeader.ulDataLength; i++)
+      hash = (hash ^ data[i]) * 0x01000193UL;
+   sprintf(tag, "\"%08lx-%lx\"", (unsigned long)hash,
+      (unsigned long)file->fileHeader.ulDataLength);
+   if(strcmp(tag, efs.pszETag) != 0)
+      error(path, "wrong entity tag");
+}
+
+/* Compare a file with the folder it was built from */
+static void
+compare(const char * folder, const char * path, PEFILE file)
+{
+   char        name[1024];
+   char *      cp;
+   FILE *      fp;
+   uint8_t *   buf;
+   size_t      len = file->fileHeader.ulDataLength;
+
+   snprintf(name, sizeof(name), "%s/%s", folder, path + 1);
+   for(cp = name; *cp; cp++)
+   {
+      if(*cp == '\\')
+         *cp = '/';
+   }
+   fp = fopen(name, "rb");
+   if(!fp)
+   {
+      error(path, "not in the folder");
+      return;
+   }
+   buf = malloc(len + 1);
+   if((fread(buf, 1, len + 1, fp) != len) ||
+      memcmp(buf, (uint8_t *)file + file->fileHeader.ulDataOffset, len))
+   {
+      error(path, "data differs from the folder");
+   }
+   free(buf);
+   fclose(fp);
+}
+
+/* Count the files of a folder and its sub folders */
+static int
+count_files(const char * folder)
+{
+   DIR *             dp;
+   struct dirent *   de;
+   struct stat       st;
+   char              path[1024];
+   int               count = 0;
+
+   dp = opendir(folder);
+   if(!dp)
+   {
+      perror(folder);
+      exit(1);
+   }
+   while((de = readdir(dp)) != NULL)
+   {
+      if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", folder, de->d_name);
+      if(stat(path, &st) == 0)
+         count += S_ISDIR(st.st_mode) ? count_files(path) : 1;
+   }
+   closedir(dp);
+   return count;
+}
+
+static double
+now_ns(void)
+{
+   struct timespec   ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+/* Time loops lookups of every path. Returns ns per lookup */
+static double
+time_lookups(char ** finds, int loops, int chain)
+{
+   EFS      efs;
+   double   start;
+   int      loop;
+   int      i;
+   int      found = 0;
+
+   start = now_ns();
+   for(loop = 0; loop < loops; loop++)
+   {
+      for(i = 0; i < npaths; i++)
+      {
+         if(chain)
+            found += (efsSearch(root, (int8_t *)finds[i], &efs) == EFS_OK);
+         else
+            found += (efsFindFile(image, (int8_t *)finds[i], &efs) == EFS_OK);
+      }
+   }
+   if(found != loops * npaths)
+      error("timing", "lookup failed");
+   return (now_ns() - start) / ((double)loops * npaths);
+}
+
+int
+main(int argc, char * argv[])
+{
+   const char *   folder = NULL;
+   char **        finds;
+   char           find[1024];
+   char *         cp;
+   EFS            efs;
+   int            loops = 10000;
+   int            opt;
+   int            i;
+
+   while((opt = getopt(argc, argv, "n:")) != -1)
+   {
+      switch(opt)
+      {
+      case 'n':
+         loops = atoi(optarg);
+         break;
+      default:
+         goto usage;
+      }
+   }
+   if((argc - optind < 1) || (argc - optind > 2))
+   {
+usage:
+      fprintf(stderr, "usage: efsverify [-n loops] image [folder]\n");
+      return 2;
+   }
+   load(argv[optind]);
+   if(argc - optind > 1)
+      folder = argv[optind + 1];
+
+   walk();
+   finds = malloc(sizeof(char *) * (size_t)(npaths + 1));
+   for(i = 0; i < npaths; i++)
+   {
+      /* As the server asks: "/dir/name" */
+      finds[i] = strdup(paths[i].ep_path);
+      for(cp = finds[i]; *cp; cp++)
+      {
+         if(*cp == '\\')
+            *cp = '/';
+      }
+      lookup(paths[i].ep_path, paths[i].ep_file);
+      lookup(finds[i], paths[i].ep_file);
+      lookup(finds[i] + 1, paths[i].ep_file);
+      snprintf(find, sizeof(find), "%s", finds[i]);
+      for(cp = find; *cp; cp++)
+         *cp = (char)toupper((unsigned char)*cp);
+      lookup(find, paths[i].ep_file);
+      if(pindex)
+         check_etag(finds[i], paths[i].ep_file);
+      if(folder)
+         compare(folder, paths[i].ep_path, paths[i].ep_file);
+   }
+   snprintf(find, sizeof(find), "/no-such-file.html");
+   if(efsFindFile(image, (int8_t *)find, &efs) == EFS_OK)
+      error(find, "found");
+   if(folder && (count_files(folder) != npaths))
+   {
+      printf("**Error: %d files in %s, %d in the image\n",
+         count_files(folder), folder, npaths);
+      errors++;
+   }
+
+   printf("%s: version %lu, %lu bytes, %d files", argv[optind],
+      (unsigned long)((PVERSION)image)->ulVersion, (unsigned long)imagelen,
+      npaths);
+   if(pindex)
+   {
+      printf(", %lu slots%s", (unsigned long)pindex->ulSlotCount,
+         ((pindex->ulHeaderSize >= sizeof(EFSINDEX)) &&
+         pindex->ulETagOffset) ? ", entity tags" : "");
+   }
+   printf("\n%d errors\n", errors);
+
+   if(!errors && (loops > 0) && npaths)
+   {
+      printf("efsFindFile: %.0f ns per lookup\n",
+         time_lookups(finds, loops, 0));
+      if(pindex)
+      {
+         printf("chain only:  %.0f ns per lookup\n",
+            time_lookups(finds, loops, 1));
+      }
+   }
+   return errors ? 1 : 0;
+}
@@ -0,0 +1,455 @@
+/* embedfs.c
+ *
+ * Part of the Webio Open Source lightweight web server.
+ *
+ * Builds an EFS image, the binary efsFindFile() serves files from, out of
+ * a folder. It is a portable stand in for the EmbedFS.exe Windows utility:
+ * by default the image is a version 1 binary byte for byte the same as
+ * EmbedFS.exe makes from the same folder. Options add the extras of a
+ * version 2 binary. See efsFile.h for the format.
+ *
+ * Usage: embedfs [-l | -b] [-2] [-e] [-v] -i folder [-o folder] [-f file]
+ *    -l         little endian target, the default
+ *    -b         big endian target
+ *    -2         version 2 binary with the hash table of the files
+ *    -e         version 2 binary with the hash table and an entity tag
+ *               for each file, so the server need not hash the files
+ *    -v         list the files as they are added
+ *    -i folder  folder to make the image of. A trailing "\" or "/" and
+ *               "*", as the EmbedFS.exe command lines have, is ignored
+ *    -o folder  folder to write the image to, default the current one
+ *    -f file    name of the image, default fsdata.bin
+ *
+ * The layout is that of EmbedFS.exe: the files of the input folder come
+ * under a "\" directory entry, then each sub folder, depth first, under
+ * a "\name\name" entry. Files and folders are in case insensitive order,
+ * as a Windows directory lists them. Names and data are padded to 4
+ * bytes with zeros, so all file data is 4 byte aligned. The chain ends
+ * with an empty entry repeating the name of the last directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "efsFile.h"
+
+#define EFS_ENDIANTAG   0x87654321UL
+#define EFS_HDRSIZE     12             /* sizeof(EFHDR) */
+#define EFS_ALIGN(n)    (((n) + 3UL) & ~3UL)
+
+/* EFSINDEX with and without the entity tag table */
+#define EFS_INDEXSIZE   16
+#define EFS_INDEXETAGS  20
+
+/* A file added to the image, for the hash table */
+typedef struct efs_file
+{
+   char *      ef_path;          /* "dir/name", the efsHashPath() key */
+   uint32_t    ef_offset;        /* file entry, from the start of the chain */
+   uint32_t    ef_diroffset;     /* its directory entry */
+   uint32_t    ef_dataoffset;    /* its data */
+   uint32_t    ef_length;
+} efs_file;
+
+static uint8_t *  image;         /* the EFILE chain as it is built */
+static size_t     imagelen;
+static size_t     imagesize;
+
+static efs_file * files;
+static int        nfiles;
+static int        ndirs;
+
+static int        bigendian;
+static int        verbose;
+
+static const char *  lastdir;    /* name of the last directory entry */
+
+static void
+fail(const char * fmt, const char * arg)
+{
+   fprintf(stderr, "embedfs: ");
+   fprintf(stderr, fmt, arg);
+   if(errno)
+      fprintf(stderr, ": %s", strerror(errno));
+   fprintf(stderr, "\n");
+   exit(1);
+}
+
+static void *
+xalloc(void * mem, size_t size)
+{
+   mem = realloc(mem, size);
+   if(!mem)
+      fail("out of memory%s", "");
+   return mem;
+}
+
+/* Make room for len more bytes of zeros at the end of the image and
+ * return its offset.
+ */
+static size_t
+img_grow(uint8_t ** buf, size_t * buflen, size_t * bufsize, size_t len)
+{
+   size_t   offset = *buflen;
+
+   if(offset + len > *bufsize)
+   {
+      while(offset + len > *bufsize)
+         *bufsize = *bufsize ? (*bufsize * 2) : 65536;
+      *buf = xalloc(*buf, *bufsize);
+   }
+   memset(*buf + offset, 0, len);
+   *buflen += len;
+   return offset;
+}
+
+static void
+put32(uint8_t * buf, size_t offset, uint32_t value)
+{
+   int   i;
+
+   for(i = 0; i < 4; i++)
+   {
+      if(bigendian)
+         buf[offset + (size_t)i] = (uint8_t)(value >> (24 - (8 * i)));
+      else
+         buf[offset + (size_t)i] = (uint8_t)(value >> (8 * i));
+   }
+}
+
+/* Add an EFILE entry with its name and room for datalen bytes of data.
+ * Returns the offset of the entry.
+ */
+static size_t
+add_entry(const char * name, size_t datalen, int isdir)
+{
+   size_t   hdrlen = EFS_ALIGN(EFS_HDRSIZE + strlen(name) + 1);
+   size_t   entlen = hdrlen + EFS_ALIGN(datalen);
+   size_t   offset;
+
+   offset = img_grow(&image, &imagelen, &imagesize, entlen);
+   memcpy(image + offset + EFS_HDRSIZE, name, strlen(name));
+   if(isdir)
+   {
+      /* The directory length is filled in when its files are added */
+      put32(image, offset, (uint32_t)hdrlen);
+      put32(image, offset + 4, 0);
+   }
+   else
+   {
+      put32(image, offset, (uint32_t)entlen);
+      put32(image, offset + 4, (uint32_t)hdrlen);
+      put32(image, offset + 8, (uint32_t)datalen);
+   }
+   return offset;
+}
+
+/* Windows lists a directory in the order of the names in upper case */
+static int
+name_cmp(const void * p1, const void * p2)
+{
+   const unsigned char *   s1 = *(const unsigned char * const *)p1;
+   const unsigned char *   s2 = *(const unsigned char * const *)p2;
+
+   while(*s1 && (toupper(*s1) == toupper(*s2)))
+   {
+      s1++;
+      s2++;
+   }
+   return toupper(*s1) - toupper(*s2);
+}
+
+static void
+add_file(const char * path, const char * name, const char * efsdir,
+   size_t diroffset)
+{
+   struct stat st;
+   size_t      offset;
+   efs_file *  file;
+   FILE *      fp;
+   const char *   dir = efsdir + 1;    /* without the first slash */
+
+   if(stat(path, &st) != 0)
+      fail("can't stat \"%s\"", path);
+   if(st.st_size == 0)
+   {
+      errno = 0;
+      fail("file \"%s\" is empty", path);
+   }
+   if((uint64_t)st.st_size > 0x7fffffffUL)
+   {
+      errno = 0;
+      fail("file \"%s\" is too big", path);
+   }
+
+   offset = add_entry(name, (size_t)st.st_size, 0);
+   fp = fopen(path, "rb");
+   if(!fp)
+      fail("can't open \"%s\"", path);
+   if(fread(image + offset + EFS_ALIGN(EFS_HDRSIZE + strlen(name) + 1),
+      1, (size_t)st.st_size, fp) != (size_t)st.st_size)
+   {
+      fail("can't read \"%s\"", path);
+   }
+   fclose(fp);
+
+   files = xalloc(files, sizeof(efs_file) * (size_t)(nfiles + 1));
+   file = &files[nfiles++];
+   file->ef_path = xalloc(NULL, strlen(dir) + strlen(name) + 2);
+   sprintf(file->ef_path, "%s%s%s", dir, *dir ? "/" : "", name);
+   file->ef_offset = (uint32_t)offset;
+   file->ef_diroffset = (uint32_t)diroffset;
+   file->ef_dataoffset = (uint32_t)(offset +
+      EFS_ALIGN(EFS_HDRSIZE + strlen(name) + 1));
+   file->ef_length = (uint32_t)st.st_size;
+   if(verbose)
+      printf("Added \"%s\"\n", path);
+}
+
+/* Add the directory entry of folder, named efsdir, with its files, then
+ * each sub folder after it.
+ */
+static void
+add_dir(const char * folder, const char * efsdir)
+{
+   DIR *             dp;
+   struct dirent *   de;
+   struct stat       st;
+   char **           names = NULL;
+   int *             isdir = NULL;
+   int               nnames = 0;
+   int               i;
+   char *            path;
+   char *            subdir;
+   size_t            diroffset;
+
+   dp = opendir(folder);
+   if(!dp)
+      fail("can't open the input folder \"%s\"", folder);
+   while((de = readdir(dp)) != NULL)
+   {
+      if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+         continue;
+      names = xalloc(names, sizeof(char *) * (size_t)(nnames + 1));
+      names[nnames++] = strdup(de->d_name);
+   }
+   closedir(dp);
+   qsort(names, (size_t)nnames, sizeof(char *), name_cmp);
+
+   isdir = xalloc(NULL, sizeof(int) * (size_t)(nnames + 1));
+   for(i = 0; i < nnames; i++)
+   {
+      path = xalloc(NULL, strlen(folder) + strlen(names[i]) + 2);
+      sprintf(path, "%s/%s", folder, names[i]);
+      if(stat(path, &st) != 0)
+         fail("can't stat \"%s\"", path);
+      isdir[i] = S_ISDIR(st.st_mode);
+      free(path);
+   }
+
+   diroffset = add_entry(efsdir, 0, 1);
+   lastdir = efsdir;
+   ndirs++;
+   for(i = 0; i < nnames; i++)
+   {
+      if(isdir[i])
+         continue;
+      path = xalloc(NULL, strlen(folder) + strlen(names[i]) + 2);
+      sprintf(path, "%s/%s", folder, names[i]);
+      add_file(path, names[i], efsdir, diroffset);
+      free(path);
+   }
+   put32(image, diroffset + 8, (uint32_t)(imagelen - diroffset));
+   if(verbose)
+      printf("Added directory \"%s\"\n", efsdir);
+
+   for(i = 0; i < nnames; i++)
+   {
+      if(!isdir[i])
+         continue;
+      path = xalloc(NULL, strlen(folder) + strlen(names[i]) + 2);
+      sprintf(path, "%s/%s", folder, names[i]);
+      subdir = xalloc(NULL, strlen(efsdir) + strlen(names[i]) + 2);
+      sprintf(subdir, "%s%s%s", efsdir, efsdir[1] ? "\\" : "", names[i]);
+      add_dir(path, subdir);
+      free(path);
+   }
+   free(isdir);
+   /* The names are kept, lastdir may be one */
+}
+
+/* Append the hash table, and the entity tags if etags, to the image,
+ * whose chain starts at root.
+ */
+static void
+add_index(uint8_t ** out, size_t * outlen, size_t * outsize, size_t root,
+   int etags)
+{
+   uint32_t    nslots = 1;
+   uint32_t *  slots;            /* file of each slot plus one, 0 if empty */
+   size_t      slotoffset;
+   size_t      tagoffset = 0;
+   size_t      stroffset;
+   uint32_t    hash;
+   uint32_t    slot;
+   uint32_t    i;
+   efs_file *  file;
+   char        tag[24];
+
+   /* Never more than half full */
+   while(nslots < (uint32_t)(2 * nfiles))
+      nslots *= 2;
+   slots = xalloc(NULL, sizeof(uint32_t) * nslots);
+   memset(slots, 0, sizeof(uint32_t) * nslots);
+   for(i = 0; i < (uint32_t)nfiles; i++)
+   {
+      hash = efsHashPath((const int8_t *)files[i].ef_path);
+      slot = hash & (nslots - 1);
+      while(slots[slot])
+         slot = (slot + 1) & (nslots - 1);
+      slots[slot] = i + 1;
+   }
+
+   slotoffset = img_grow(out, outlen, outsize,
+      sizeof(EFSSLOT) * nslots);
+   if(etags)
+      tagoffset = img_grow(out, outlen, outsize, sizeof(uint32_t) * nslots);
+   for(slot = 0; slot < nslots; slot++)
+   {
+      if(!slots[slot])
+         continue;
+      file = &files[slots[slot] - 1];
+      put32(*out, slotoffset + (sizeof(EFSSLOT) * slot),
+         efsHashPath((const int8_t *)file->ef_path));
+      put32(*out, slotoffset + (sizeof(EFSSLOT) * slot) + 4,
+         (uint32_t)(root + file->ef_offset));
+      put32(*out, slotoffset + (sizeof(EFSSLOT) * slot) + 8,
+         (uint32_t)(root + file->ef_diroffset));
+      if(etags)
+      {
+         /* The same tag as em_etag() makes from the data */
+         hash = 0x811c9dc5UL;
+         for(i = 0; i < file->ef_length; i++)
+            hash = (hash ^ image[file->ef_dataoffset + i]) * 0x01000193UL;
+         sprintf(tag, "\"%08lx-%lx\"", (unsigned long)hash,
+            (unsigned long)file->ef_length);
+         stroffset = img_grow(out, outlen, outsize, strlen(tag) + 1);
+         memcpy(*out + stroffset, tag, strlen(tag));
+         put32(*out, tagoffset + (sizeof(uint32_t) * slot),
+            (uint32_t)stroffset);
+      }
+   }
+   img_grow(out, outlen, outsize, EFS_ALIGN(*outlen) - *outlen);
+
+   put32(*out, sizeof(VERSION), etags ? EFS_INDEXETAGS : EFS_INDEXSIZE);
+   put32(*out, sizeof(VERSION) + 4, (uint32_t)root);
+   put32(*out, sizeof(VERSION) + 8, (uint32_t)slotoffset);
+   put32(*out, sizeof(VERSION) + 12, nslots);
+   if(etags)
+      put32(*out, sizeof(VERSION) + 16, (uint32_t)tagoffset);
+   free(slots);
+}
+
+static void
+usage(void)
+{
+   fprintf(stderr, "usage: embedfs [-l | -b] [-2] [-e] [-v] -i folder "
+      "[-o folder] [-f file]\n");
+   exit(2);
+}
+
+int
+main(int argc, char * argv[])
+{
+   char *      infolder = NULL;
+   const char *   outfolder = ".";
+   const char *   outname = "fsdata.bin";
+   char *      outpath;
+   char *      cp;
+   int         version = 1;
+   int         etags = 0;
+   int         opt;
+   uint8_t *   out = NULL;
+   size_t      outlen = 0;
+   size_t      outsize = 0;
+   size_t      root;
+   FILE *      fp;
+
+   while((opt = getopt(argc, argv, "lb2evi:o:f:")) != -1)
+   {
+      switch(opt)
+      {
+      case 'l':
+         bigendian = 0;
+         break;
+      case 'b':
+         bigendian = 1;
+         break;
+      case '2':
+         version = 2;
+         break;
+      case 'e':
+         version = 2;
+         etags = 1;
+         break;
+      case 'v':
+         verbose = 1;
+         break;
+      case 'i':
+         infolder = strdup(optarg);
+         break;
+      case 'o':
+         outfolder = optarg;
+         break;
+      case 'f':
+         outname = optarg;
+         break;
+      default:
+         usage();
+      }
+   }
+   if(!infolder || (optind != argc))
+      usage();
+
+   /* Drop a trailing wildcard and slashes */
+   cp = infolder + strlen(infolder);
+   if((cp > infolder) && (cp[-1] == '*'))
+      *--cp = 0;
+   while((cp > infolder + 1) && ((cp[-1] == '/') || (cp[-1] == '\\')))
+      *--cp = 0;
+
+   errno = 0;
+   add_dir(infolder, "\\");
+   /* End of the chain */
+   add_entry(lastdir, 0, 1);
+   put32(image, imagelen - EFS_ALIGN(EFS_HDRSIZE + strlen(lastdir) + 1), 0);
+
+   img_grow(&out, &outlen, &outsize, sizeof(VERSION));
+   put32(out, 0, EFS_ENDIANTAG);
+   put32(out, 4, (version == 2) ? EFS_VERSION_INDEXED : EFS_VERSION_CHAIN);
+   if(version == 2)
+      img_grow(&out, &outlen, &outsize, etags ? EFS_INDEXETAGS : EFS_INDEXSIZE);
+   root = img_grow(&out, &outlen, &outsize, imagelen);
+   memcpy(out + root, image, imagelen);
+   if(version == 2)
+      add_index(&out, &outlen, &outsize, root, etags);
+
+   outpath = xalloc(NULL, strlen(outfolder) + strlen(outname) + 2);
+   sprintf(outpath, "%s/%s", outfolder, outname);
+   fp = fopen(outpath, "wb");
+   if(!fp)
+      fail("can't open the output file \"%s\"", outpath);
+   if((fwrite(out, 1, outlen, fp) != outlen) || fclose(fp))
+      fail("can't write the output file \"%s\"", outpath);
+
+   printf("%s: %d files and %d folders, %lu bytes, version %d%s\n",
+      outpath, nfiles, ndirs, (unsigned long)outlen, version,
+      etags ? " with entity tags" : "");
+   return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Makes src/webserver/fsWebSite.bin from src/webserver/website, as
+# dos_scripts/Build_Compiletime_Script.bat does with EmbedFS.exe, using
+# embedfs from util/embedfs. Options are passed to embedfs: -2 for the
+# hash table of the files, -e for the table and the entity tags.
+#
+# The image is made from a copy of the website with a gzip copy of each
+# compressible file, served to clients that send "Accept-Encoding: gzip".
+# Every file keeps its raw copy as well (gzip -k), for SSI, the language
+# folders and clients without gzip.
+set -e
+UTIL=$(cd "$(dirname "$0")/.." && pwd)
+WEB="$UTIL/../src/webserver"
+EMBEDFS="$UTIL/embedfs/embedfs"
+
+[ -x "$EMBEDFS" ] || make -C "$UTIL/embedfs" embedfs
+
+EFS_STAGE=$(mktemp -d "${TMPDIR:-/tmp}/efs_website.XXXXXX")
+trap 'rm -rf "$EFS_STAGE"' EXIT
+echo "Creating $WEB/fsWebSite.bin"
+cp -R "$WEB/website/." "$EFS_STAGE"
+find "$EFS_STAGE" -type f \( -name '*.html' -o -name '*.htm' \
+   -o -name '*.css' -o -name '*.js' \) -exec gzip -9 -n -k {} \;
+"$EMBEDFS" -l "$@" -i "$EFS_STAGE" -o "$WEB" -f fsWebSite.bin
+echo "Script complete"